@@ -20,7 +20,9 @@
 
 #include "qemu-common.h"
 #include "qemu/atomic.h"
+#include "qemu/bitmap.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
@@ -68,6 +70,7 @@
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -105,8 +108,17 @@ struct KVMState
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
 #endif
     KVMMemoryListener memory_listener;
+    QLIST_HEAD(, KVMMemoryListener) kmls;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
 
+    bool manual_dirty_log_protect;
+    /* dirty ring, number of entries per vCPU (0 if disabled) */
+    uint32_t kvm_dirty_ring_size;
+    QemuThread dirty_ring_reaper;
+    /* Posted to stop the reaper thread when QEMU exits */
+    QemuSemaphore dirty_ring_reaper_stop;
+    Notifier dirty_ring_reaper_exit;
+
     /* memory encryption */
     void *memcrypt_handle;
     int (*memcrypt_encrypt_data)(void *handle, uint8_t *ptr, uint64_t len);
@@ -244,18 +256,21 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
                                        hwaddr *phys_addr)
 {
     KVMMemoryListener *kml = &s->memory_listener;
-    int i;
+    int i, ret = 0;
 
+    qemu_mutex_lock(&kml->slots_lock);
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &kml->slots[i];
 
         if (ram >= mem->ram && ram < mem->ram + mem->memory_size) {
             *phys_addr = mem->start_addr + (ram - mem->ram);
-            return 1;
+            ret = 1;
+            break;
         }
     }
+    qemu_mutex_unlock(&kml->slots_lock);
 
-    return 0;
+    return ret;
 }
 
 static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, bool new)
@@ -283,6 +298,8 @@ static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, boo
     return ret;
 }
 
+static uint64_t kvm_dirty_ring_reap(KVMState *s);
+
 int kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -304,15 +321,28 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* Do not lose the pages that are still in the ring */
+        kvm_dirty_ring_reap(s);
+        ret = munmap(cpu->kvm_dirty_gfns,
+                     s->kvm_dirty_ring_size * sizeof(struct kvm_dirty_gfn));
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id,
+                        uint32_t *fetch_index)
 {
     struct KVMParkedVcpu *cpu;
 
@@ -322,11 +352,14 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            /* The kernel kept its ring position across the unplug */
+            *fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    *fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
@@ -338,7 +371,7 @@ int kvm_init_vcpu(CPUState *cpu)
 
     DPRINTF("kvm_init_vcpu\n");
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu), &cpu->kvm_fetch_index);
     if (ret < 0) {
         DPRINTF("kvm_create_vcpu failed\n");
         goto err;
@@ -368,6 +401,20 @@ int kvm_init_vcpu(CPUState *cpu)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->kvm_dirty_ring_size) {
+        /* Use MAP_SHARED to share pages with the kernel */
+        cpu->kvm_dirty_gfns =
+            mmap(NULL, s->kvm_dirty_ring_size * sizeof(struct kvm_dirty_gfn),
+                 PROT_READ | PROT_WRITE, MAP_SHARED, cpu->kvm_fd,
+                 PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            ret = -errno;
+            cpu->kvm_dirty_gfns = NULL;
+            DPRINTF("mmap'ing vcpu dirty gfns failed\n");
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
 err:
     return ret;
@@ -409,19 +456,22 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
 {
     hwaddr start_addr, size;
     KVMSlot *mem;
+    int ret = 0;
 
     size = kvm_align_section(section, &start_addr);
     if (!size) {
         return 0;
     }
 
+    qemu_mutex_lock(&kml->slots_lock);
     mem = kvm_lookup_matching_slot(kml, start_addr, size);
-    if (!mem) {
-        /* We don't have a slot if we want to trap every access. */
-        return 0;
+    /* We don't have a slot if we want to trap every access. */
+    if (mem) {
+        ret = kvm_slot_update_flags(kml, mem, section->mr);
     }
+    qemu_mutex_unlock(&kml->slots_lock);
 
-    return kvm_slot_update_flags(kml, mem, section->mr);
+    return ret;
 }
 
 static void kvm_log_start(MemoryListener *listener,
@@ -478,6 +528,11 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
  * memory_region_set_dirty().  This means all bits are set
  * to dirty.
  *
+ * With manual dirty log protection the bitmap is kept in the slot, so
+ * that kvm_physical_log_clear() knows which pages to clear.
+ *
+ * Must be called with the slots lock held.
+ *
  * @start_add: start of logged region.
  * @end_addr: end of logged region.
  */
@@ -511,22 +566,300 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
          */
         size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
                      /*HOST_LONG_BITS*/ 64) / 8;
-        d.dirty_bitmap = g_malloc0(size);
+        if (!mem->dirty_bmap) {
+            mem->dirty_bmap = g_malloc0(size);
+        }
+        d.dirty_bitmap = mem->dirty_bmap;
 
         d.slot = mem->slot | (kml->as_id << 16);
         if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
             DPRINTF("ioctl failed %d\n", errno);
-            g_free(d.dirty_bitmap);
             return -1;
         }
 
         kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
-        g_free(d.dirty_bitmap);
     }
 
     return 0;
 }
 
+#define KVM_CLEAR_LOG_ALIGN  64
+
+/* Must be called with the slots lock held */
+static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
+                                  uint64_t size)
+{
+    KVMState *s = kvm_state;
+    uint64_t psize = qemu_real_host_page_size;
+    uint64_t first, last, end, bmap_start, bmap_npages, i;
+    struct kvm_clear_dirty_log d;
+    unsigned long *bmap_clear;
+    int ret = 0;
+
+    if (!mem->dirty_bmap) {
+        /* Never synced, there is nothing to clear */
+        return 0;
+    }
+
+    first = (start - mem->start_addr) / psize;
+    last = DIV_ROUND_UP(start + size - mem->start_addr, psize);
+
+    /*
+     * KVM wants first_page aligned to 64 pages and num_pages a multiple
+     * of 64, except at the end of the slot.  Widen the range for the
+     * ioctl, but only hand it the bits that are inside the request.
+     */
+    bmap_start = QEMU_ALIGN_DOWN(first, KVM_CLEAR_LOG_ALIGN);
+    end = MIN(QEMU_ALIGN_UP(last, KVM_CLEAR_LOG_ALIGN),
+              mem->memory_size / psize);
+    bmap_npages = end - bmap_start;
+
+    bmap_clear = bitmap_new(bmap_npages);
+    for (i = find_next_bit(mem->dirty_bmap, last, first); i < last;
+         i = find_next_bit(mem->dirty_bmap, last, i + 1)) {
+        set_bit(i - bmap_start, bmap_clear);
+    }
+
+    if (!bitmap_empty(bmap_clear, bmap_npages)) {
+        d.slot = mem->slot | (as_id << 16);
+        d.first_page = bmap_start;
+        d.num_pages = bmap_npages;
+        d.dirty_bitmap = bmap_clear;
+        ret = kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &d);
+        if (ret < 0) {
+            error_report("%s: KVM_CLEAR_DIRTY_LOG failed, slot=%d, "
+                         "start=0x%"PRIx64", size=0x%"PRIx32", errno=%d",
+                         __func__, d.slot, d.first_page, d.num_pages, -ret);
+        } else {
+            /* These pages will be reported again when they are written */
+            bitmap_clear(mem->dirty_bmap, first, last - first);
+        }
+    }
+
+    g_free(bmap_clear);
+    return ret;
+}
+
+/**
+ * kvm_physical_log_clear - Clear the kernel's dirty bitmap for range
+ *
+ * NOTE: this will be a no-op if we haven't enabled manual dirty log
+ * protection in the host kernel because in that case this operation
+ * will be done within log_sync().
+ *
+ * @kml:     the kvm memory listener
+ * @section: the memory range to clear dirty bitmap
+ */
+static int kvm_physical_log_clear(KVMMemoryListener *kml,
+                                  MemoryRegionSection *section)
+{
+    KVMState *s = kvm_state;
+    uint64_t start, size;
+    KVMSlot *mem;
+    int ret = 0, i;
+
+    if (!s->manual_dirty_log_protect) {
+        return 0;
+    }
+
+    start = section->offset_within_address_space;
+    size = int128_get64(section->size);
+    if (!size) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&kml->slots_lock);
+    for (i = 0; i < s->nr_slots; i++) {
+        mem = &kml->slots[i];
+        if (mem->memory_size && mem->start_addr <= start &&
+            start + size <= mem->start_addr + mem->memory_size) {
+            ret = kvm_log_clear_one_slot(mem, kml->as_id, start, size);
+            break;
+        }
+    }
+    qemu_mutex_unlock(&kml->slots_lock);
+
+    return ret;
+}
+
+/*
+ * Dirty ring
+ *
+ * With KVM_CAP_DIRTY_LOG_RING, KVM pushes the GFN of every page that
+ * becomes dirty into a ring shared with each vCPU, instead of setting a
+ * bit in the per-slot bitmap.  Harvesting the rings costs time in
+ * proportion to the number of dirty pages rather than to the size of the
+ * guest.  The rings are harvested by a reaper thread, by the vCPUs when
+ * their ring is full, and on every dirty log sync.  Harvested pages go
+ * straight to the ram_list dirty bitmaps.
+ *
+ * All ring accesses on the QEMU side are serialized by the BQL, which
+ * also keeps the memory slots stable while the GFNs are translated.
+ */
+
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    return atomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    atomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml;
+    KVMSlot *mem;
+    uint8_t clients = tcg_enabled() ? DIRTY_CLIENTS_ALL : DIRTY_CLIENTS_NOCODE;
+
+    QLIST_FOREACH(kml, &s->kmls, next) {
+        if (kml->as_id == as_id) {
+            break;
+        }
+    }
+    if (!kml || slot_id >= s->nr_slots) {
+        return;
+    }
+
+    mem = &kml->slots[slot_id];
+    /* The slot may have gone away since the page was pushed */
+    if (!mem->memory_size ||
+        offset >= mem->memory_size / qemu_real_host_page_size) {
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_range(mem->ram_start_offset +
+                                        offset * qemu_real_host_page_size,
+                                        qemu_real_host_page_size, clients);
+}
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t count = 0, fetch = cpu->kvm_fetch_index;
+
+    for (;;) {
+        cur = &dirty_gfns[fetch & (ring_size - 1)];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        dirty_gfn_set_collected(cur);
+        fetch++;
+        count++;
+    }
+    cpu->kvm_fetch_index = fetch;
+    stat64_add(&cpu->dirty_pages, count);
+
+    return count;
+}
+
+/* Must be called with the BQL held */
+static uint64_t kvm_dirty_ring_reap(KVMState *s)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int64_t stamp = get_clock();
+    int ret;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    /* Have KVM write protect the harvested pages again and free up
+     * the entries, this also lets vCPUs that found their ring full
+     * run again.
+     */
+    if (total) {
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        if (ret < 0) {
+            error_report("%s: KVM_RESET_DIRTY_RINGS failed: %s",
+                         __func__, strerror(-ret));
+            abort();
+        }
+    }
+
+    trace_kvm_dirty_ring_reap(total, (get_clock() - stamp) / 1000);
+    return total;
+}
+
+#define KVM_DIRTY_RING_REAPER_PERIOD_MS 1000
+
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    rcu_register_thread();
+
+    while (qemu_sem_timedwait(&s->dirty_ring_reaper_stop,
+                              KVM_DIRTY_RING_REAPER_PERIOD_MS) < 0) {
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void kvm_dirty_ring_reaper_exit(Notifier *n, void *data)
+{
+    KVMState *s = container_of(n, KVMState, dirty_ring_reaper_exit);
+    bool locked = qemu_mutex_iothread_locked();
+
+    qemu_sem_post(&s->dirty_ring_reaper_stop);
+
+    /* The reaper may be waiting for the BQL */
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    qemu_thread_join(&s->dirty_ring_reaper);
+    if (locked) {
+        qemu_mutex_lock_iothread();
+    }
+    qemu_sem_destroy(&s->dirty_ring_reaper_stop);
+}
+
+static int kvm_dirty_ring_init(KVMState *s, MachineState *ms)
+{
+    uint32_t ring_size = machine_dirty_ring_size(ms);
+    uint64_t ring_bytes = (uint64_t)ring_size * sizeof(struct kvm_dirty_gfn);
+    int ret;
+
+    if (!ring_size) {
+        return 0;
+    }
+
+    ret = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+    if (ret <= 0) {
+        error_report("KVM dirty ring not available, "
+                     "use dirty-ring-size=0 to disable it");
+        return -EINVAL;
+    }
+    if (ring_bytes > ret) {
+        error_report("KVM dirty ring size %" PRIu32 " too big "
+                     "(maximum is %zu)", ring_size,
+                     ret / sizeof(struct kvm_dirty_gfn));
+        return -EINVAL;
+    }
+
+    ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+    if (ret) {
+        error_report("Enabling of KVM dirty ring failed: %s",
+                     strerror(-ret));
+        return ret;
+    }
+
+    s->kvm_dirty_ring_size = ring_size;
+    return 0;
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -783,16 +1116,24 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     ram = memory_region_get_ram_ptr(mr) + section->offset_within_region +
           (start_addr - section->offset_within_address_space);
 
+    qemu_mutex_lock(&kml->slots_lock);
+
     if (!add) {
         mem = kvm_lookup_matching_slot(kml, start_addr, size);
         if (!mem) {
-            return;
+            goto out;
         }
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(kml, section);
+            if (kvm_state->kvm_dirty_ring_size) {
+                kvm_dirty_ring_reap(kvm_state);
+            } else {
+                kvm_physical_sync_dirty_bitmap(kml, section);
+            }
         }
 
         /* unregister the slot */
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
         mem->memory_size = 0;
         mem->flags = 0;
         err = kvm_set_user_memory_region(kml, mem, false);
@@ -801,7 +1142,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                     __func__, strerror(-err));
             abort();
         }
-        return;
+        goto out;
     }
 
     /* register the new slot */
@@ -809,6 +1150,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->ram_start_offset = memory_region_get_ram_addr(mr) +
+                            section->offset_within_region +
+                            (start_addr - section->offset_within_address_space);
     mem->flags = kvm_mem_flags(mr);
 
     err = kvm_set_user_memory_region(kml, mem, true);
@@ -817,6 +1161,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 strerror(-err));
         abort();
     }
+
+out:
+    qemu_mutex_unlock(&kml->slots_lock);
 }
 
 static void kvm_region_add(MemoryListener *listener,
@@ -843,12 +1190,35 @@ static void kvm_log_sync(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
+    qemu_mutex_lock(&kml->slots_lock);
     r = kvm_physical_sync_dirty_bitmap(kml, section);
+    qemu_mutex_unlock(&kml->slots_lock);
+    if (r < 0) {
+        abort();
+    }
+}
+
+static void kvm_log_clear(MemoryListener *listener,
+                          MemoryRegionSection *section)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    int r;
+
+    r = kvm_physical_log_clear(kml, section);
     if (r < 0) {
         abort();
     }
 }
 
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    /* vCPUs that are still running may have dirtied pages that KVM has
+     * not pushed yet; those are picked up by the next sync.  Once the
+     * vCPUs are stopped, their rings are complete.
+     */
+    kvm_dirty_ring_reap(kvm_state);
+}
+
 static void kvm_mem_ioeventfd_add(MemoryListener *listener,
                                   MemoryRegionSection *section,
                                   bool match_data, uint64_t data,
@@ -923,6 +1293,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 {
     int i;
 
+    qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
     kml->as_id = as_id;
 
@@ -934,9 +1305,17 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
+    if (s->kvm_dirty_ring_size) {
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    } else {
+        kml->listener.log_sync = kvm_log_sync;
+    }
+    if (s->manual_dirty_log_protect) {
+        kml->listener.log_clear = kvm_log_clear;
+    }
     kml->listener.priority = 10;
 
+    QLIST_INSERT_HEAD(&s->kmls, kml, next);
     memory_listener_register(&kml->listener, as);
 }
 
@@ -1557,6 +1936,7 @@ static int kvm_init(MachineState *ms)
     QTAILQ_INIT(&s->kvm_sw_breakpoints);
 #endif
     QLIST_INIT(&s->kvm_parked_vcpus);
+    QLIST_INIT(&s->kmls);
     s->vmfd = -1;
     s->fd = qemu_open("/dev/kvm", O_RDWR);
     if (s->fd == -1) {
@@ -1699,6 +2079,38 @@ static int kvm_init(MachineState *ms)
     kvm_ioeventfd_any_length_allowed =
         (kvm_check_extension(s, KVM_CAP_IOEVENTFD_ANY_LENGTH) > 0);
 
+    ret = kvm_dirty_ring_init(s, ms);
+    if (ret < 0) {
+        goto err;
+    }
+
+    /*
+     * Let migration decide when pages are write protected again, instead
+     * of doing it for the whole slot on every KVM_GET_DIRTY_LOG.  The
+     * dirty ring resets pages on its own, so it does not need this.
+     */
+    if (!s->kvm_dirty_ring_size) {
+        int cap = 0;
+
+        if (kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2) &
+            KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE) {
+            cap = KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2;
+        } else if (kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT)) {
+            /* The first kernels with manual protection only offer this */
+            cap = KVM_CAP_MANUAL_DIRTY_LOG_PROTECT;
+        }
+        if (cap) {
+            ret = kvm_vm_enable_cap(s, cap, 0,
+                                    KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE);
+            if (ret) {
+                warn_report("Trying to enable manual dirty log protection "
+                            "but failed, falling back to legacy mode");
+            } else {
+                s->manual_dirty_log_protect = true;
+            }
+        }
+    }
+
     kvm_state = s;
 
     /*
@@ -1745,6 +2157,15 @@ static int kvm_init(MachineState *ms)
         qemu_balloon_inhibit(true);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_sem_init(&s->dirty_ring_reaper_stop, 0);
+        qemu_thread_create(&s->dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_JOINABLE);
+        s->dirty_ring_reaper_exit.notify = kvm_dirty_ring_reaper_exit;
+        qemu_add_exit_notifier(&s->dirty_ring_reaper_exit);
+    }
+
     return 0;
 
 err:
@@ -2052,6 +2473,19 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_INTERNAL_ERROR:
             ret = kvm_handle_internal_error(cpu, run);
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /*
+             * Our ring is full, KVM will not run the vCPU again until the
+             * rings are reset.  Harvest them here rather than waiting for
+             * the reaper, this is what throttles vCPUs that dirty memory
+             * faster than it is collected.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SYSTEM_EVENT:
             switch (run->system_event.type) {
             case KVM_SYSTEM_EVENT_SHUTDOWN:
@@ -2222,6 +2656,11 @@ bool kvm_has_sync_mmu(void)
     return kvm_state->sync_mmu;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
 int kvm_has_vcpu_events(void)
 {
     return kvm_state->vcpu_events;
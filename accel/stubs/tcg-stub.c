@@ -17,6 +17,8 @@
 #include "exec/cpu-common.h"
 #include "exec/exec-all.h"
 
+bool tcg_tiered;
+
 void tb_flush(CPUState *cpu)
 {
 }
@@ -29,6 +29,7 @@
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
@@ -74,6 +75,171 @@ QEMU_BUILD_BUG_ON(sizeof(target_ulong) > sizeof(run_on_cpu_data));
 QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
 #define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Resize window, see tlb_mmu_resize_locked() */
+#define TLB_RESIZE_WINDOW_NS (100 * SCALE_MS)
+
+/* Bounds of the TLB size, set by -accel tcg before any CPU is created */
+static unsigned tlb_min_bits = CPU_TLB_DYN_MIN_BITS;
+static unsigned tlb_max_bits = CPU_TLB_DYN_MAX_BITS;
+
+void tlb_set_size_bits(unsigned min_bits, unsigned max_bits, Error **errp)
+{
+    min_bits = min_bits ? min_bits : CPU_TLB_DYN_MIN_BITS;
+    max_bits = max_bits ? max_bits : CPU_TLB_DYN_MAX_BITS;
+
+    if (min_bits < CPU_TLB_DYN_MIN_BITS || max_bits > CPU_TLB_DYN_MAX_BITS ||
+        min_bits > max_bits) {
+        error_setg(errp, "TLB size bits must satisfy %d <= tlb-min-bits "
+                   "<= tlb-max-bits <= %d", CPU_TLB_DYN_MIN_BITS,
+                   (int)CPU_TLB_DYN_MAX_BITS);
+        return;
+    }
+    tlb_min_bits = min_bits;
+    tlb_max_bits = max_bits;
+}
+
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns, size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+}
+
+static void tlb_dyn_init(CPUArchState *env)
+{
+    unsigned bits = MIN(MAX(CPU_TLB_DYN_DEFAULT_BITS, tlb_min_bits),
+                        tlb_max_bits);
+    size_t n_entries = (size_t)1 << bits;
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        tlb_window_reset(&env->tlb_d[i], get_clock_realtime(), 0);
+        env->tlb_d[i].n_used_entries = 0;
+        env->tlb_mask[i] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+        env->tlb_table[i] = g_new(CPUTLBEntry, n_entries);
+        env->iotlb[i] = g_new(CPUIOTLBEntry, n_entries);
+        memset(env->tlb_table[i], -1, n_entries * sizeof(CPUTLBEntry));
+    }
+}
+
+/**
+ * tlb_mmu_resize_locked: resize the TLB of @mmu_idx if its use rate calls
+ * for it
+ * @env: CPU that owns the TLB
+ * @mmu_idx: MMU index of the TLB
+ *
+ * Called with tlb_c.lock held, on a flush of the whole TLB of @mmu_idx:
+ * resizing at any other time would mean rehashing the table.
+ *
+ * A TLB that is too small causes conflict misses and tlb_fill calls, one
+ * that is too large makes each flush more expensive and hurts locality.
+ * The size follows the maximum number of entries in use observed in a
+ * window of TLB_RESIZE_WINDOW_NS:
+ *  - when more than 70% of the entries are in use, the TLB is doubled
+ *    right away, since the guest process that filled it is likely to run
+ *    again soon;
+ *  - when less than 30% of the entries have been in use for a whole
+ *    window, the TLB shrinks to fit the maximum use of that window.
+ */
+static void tlb_mmu_resize_locked(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    size_t min_size = (size_t)1 << tlb_min_bits;
+    size_t max_size = (size_t)1 << tlb_max_bits;
+    int64_t now = get_clock_realtime();
+    bool window_expired = now > desc->window_begin_ns + TLB_RESIZE_WINDOW_NS;
+    size_t rate;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, max_size);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(desc->window_max_entries);
+
+        /*
+         * Keep the expected use rate below 70%, or a maximum just below
+         * a power of two would have the TLB grow again on the next flush.
+         */
+        if (desc->window_max_entries * 100 / ceil > 70) {
+            ceil *= 2;
+        }
+        new_size = MAX(ceil, min_size);
+    }
+    /* The bounds may have been changed since the last resize */
+    new_size = MIN(MAX(new_size, min_size), max_size);
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+
+    tlb_window_reset(desc, now, 0);
+    env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+    env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+    /*
+     * Large allocations can fail on a loaded host; fall back to smaller
+     * sizes rather than killing the guest, and only give up below
+     * min_size.
+     */
+    while (env->tlb_table[mmu_idx] == NULL || env->iotlb[mmu_idx] == NULL) {
+        if (new_size == min_size) {
+            error_report("%s: %s", __func__, strerror(errno));
+            abort();
+        }
+        new_size = MAX(new_size >> 1, min_size);
+
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+        env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+    }
+    env->tlb_mask[mmu_idx] = (new_size - 1) << CPU_TLB_ENTRY_BITS;
+
+    atomic_set(&env->tlb_c.resize_count, env->tlb_c.resize_count + 1);
+}
+
+static void tlb_dyn_destroy(CPUArchState *env)
+{
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        g_free(env->tlb_table[i]);
+        g_free(env->iotlb[i]);
+        env->tlb_table[i] = NULL;
+        env->iotlb[i] = NULL;
+    }
+}
+#else
+void tlb_set_size_bits(unsigned min_bits, unsigned max_bits, Error **errp)
+{
+    error_setg(errp, "The TCG backend of this host does not support "
+               "resizing the TLB");
+}
+
+static inline void tlb_dyn_init(CPUArchState *env)
+{
+}
+
+static inline void tlb_mmu_resize_locked(CPUArchState *env, int mmu_idx)
+{
+}
+
+static inline void tlb_dyn_destroy(CPUArchState *env)
+{
+}
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -82,6 +248,13 @@ void tlb_init(CPUState *cpu)
 
     /* Ensure that cpu_reset performs a full flush.  */
     env->tlb_c.dirty = ALL_MMUIDX_BITS;
+
+    tlb_dyn_init(env);
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+    tlb_dyn_destroy(cpu->env_ptr);
 }
 
 /* flush_all_helper: run fn across all cpus
@@ -120,10 +293,35 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_miss_counts(size_t *pvhit, size_t *pfill, size_t *presize)
+{
+    CPUState *cpu;
+    size_t vhit = 0, fill = 0, resize = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        vhit += atomic_read(&env->tlb_c.vtlb_hit_count);
+        fill += atomic_read(&env->tlb_c.fill_count);
+        resize += atomic_read(&env->tlb_c.resize_count);
+    }
+    *pvhit = vhit;
+    *pfill = fill;
+    *presize = resize;
+}
+
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
+}
+
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
 {
-    memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
+    tlb_mmu_resize_locked(env, mmu_idx);
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
     memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+    env->tlb_d[mmu_idx].n_used_entries = 0;
     env->tlb_d[mmu_idx].large_page_addr = -1;
     env->tlb_d[mmu_idx].large_page_mask = -1;
     env->tlb_d[mmu_idx].vindex = 0;
@@ -224,13 +422,15 @@ static inline bool tlb_hit_page_anyprot(CPUTLBEntry *tlb_entry,
            tlb_hit_page(tlb_entry->addr_code, page);
 }
 
-/* Called with tlb_c.lock held */
-static inline void tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
+/* Called with tlb_c.lock held; returns true if the entry was flushed */
+static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
                                           target_ulong page)
 {
     if (tlb_hit_page_anyprot(tlb_entry, page)) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
 /* Called with tlb_c.lock held */
@@ -258,7 +458,9 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
                   midx, lp_addr, lp_mask);
         tlb_flush_one_mmuidx_locked(env, midx);
     } else {
-        tlb_flush_entry_locked(tlb_entry(env, midx, page), page);
+        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+            env->tlb_d[midx].n_used_entries--;
+        }
         tlb_flush_vtlb_page_locked(env, midx, page);
     }
 }
@@ -435,8 +637,9 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     qemu_spin_lock(&env->tlb_c.lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         unsigned int i;
+        unsigned int n = tlb_n_entries(env, mmu_idx);
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range_locked(&env->tlb_table[mmu_idx][i], start1,
                                          length);
         }
@@ -587,6 +790,10 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     /* Make sure there's no cached translation for the new page.  */
     tlb_flush_vtlb_page_locked(env, mmu_idx, vaddr_page);
 
+    if (tlb_entry_is_empty(te)) {
+        env->tlb_d[mmu_idx].n_used_entries++;
+    }
+
     /*
      * Only evict the old entry to the victim tlb if it's for a
      * different page; otherwise just overwrite the stale data.
@@ -831,6 +1038,9 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
 
             qemu_spin_lock(&env->tlb_c.lock);
+            if (tlb_entry_is_empty(tlb)) {
+                env->tlb_d[mmu_idx].n_used_entries++;
+            }
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
             copy_tlb_helper_locked(vtlb, &tmptlb);
@@ -839,9 +1049,14 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
             tmpio = *io; *io = *vio; *vio = tmpio;
+
+            atomic_set(&env->tlb_c.vtlb_hit_count,
+                       env->tlb_c.vtlb_hit_count + 1);
             return true;
         }
     }
+    /* All callers go on with tlb_fill */
+    atomic_set(&env->tlb_c.fill_count, env->tlb_c.fill_count + 1);
     return false;
 }
 
@@ -865,6 +1080,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
     if (unlikely(!tlb_hit(entry->addr_code, addr))) {
         if (!VICTIM_TLB_HIT(addr_code, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, 0, MMU_INST_FETCH, mmu_idx, 0);
+            index = tlb_index(env, mmu_idx, addr);
+            entry = tlb_entry(env, mmu_idx, addr);
         }
         assert(tlb_hit(entry->addr_code, addr));
     }
@@ -945,6 +1162,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_STORE,
                      mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
+            tlbe = tlb_entry(env, mmu_idx, addr);
         }
         tlb_addr = tlb_addr_write(tlbe) & ~TLB_INVALID_MASK;
     }
@@ -31,6 +31,8 @@
 #include "qom/cpu.h"
 #include "sysemu/cpus.h"
 #include "qemu/main-loop.h"
+#include "hw/boards.h"
+#include "exec/tcg-dirty-ring.h"
 
 unsigned long tcg_tb_size;
 
@@ -65,6 +67,7 @@ static int tcg_init(MachineState *ms)
 {
     tcg_exec_init(tcg_tb_size * 1024 * 1024);
     cpu_interrupt_handler = tcg_handle_interrupt;
+    tcg_dirty_ring_init(machine_dirty_ring_size(ms));
     return 0;
 }
 
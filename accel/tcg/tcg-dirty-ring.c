@@ -0,0 +1,177 @@
+/*
+ * Simulated dirty rings for TCG
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qom/cpu.h"
+#include "sysemu/sysemu.h"
+#include "exec/memory.h"
+#include "exec/address-spaces.h"
+#include "exec/ram_addr.h"
+#include "exec/tcg-dirty-ring.h"
+#include "trace.h"
+
+/*
+ * Each vCPU owns a ring of dirty pages.  The vCPU is the only producer;
+ * harvesting is serialized by tcg_dirty_ring_lock and can happen from
+ * the reaper thread, from a dirty log sync or from the vCPU itself when
+ * its ring is full.
+ */
+typedef struct TCGDirtyRing {
+    ram_addr_t *pages;
+    uint32_t push_index;
+    uint32_t fetch_index;
+} TCGDirtyRing;
+
+#define TCG_DIRTY_RING_REAPER_PERIOD_MS 1000
+
+uint32_t tcg_dirty_ring_size;
+
+static QemuMutex tcg_dirty_ring_lock;
+static QemuThread tcg_dirty_ring_reaper;
+static QemuSemaphore tcg_dirty_ring_reaper_stop;
+static Notifier tcg_dirty_ring_reaper_exit;
+
+/* Must be called with tcg_dirty_ring_lock held */
+static uint32_t tcg_dirty_ring_reap_one(CPUState *cpu, TCGDirtyRing *ring)
+{
+    uint32_t fetch = ring->fetch_index;
+    uint32_t push = atomic_load_acquire(&ring->push_index);
+    uint32_t count = push - fetch;
+
+    /* The VGA bit was set when the page was pushed */
+    for (; fetch != push; fetch++) {
+        cpu_physical_memory_set_dirty_range(
+            ring->pages[fetch & (tcg_dirty_ring_size - 1)], TARGET_PAGE_SIZE,
+            1 << DIRTY_MEMORY_MIGRATION);
+    }
+    atomic_store_release(&ring->fetch_index, fetch);
+    stat64_add(&cpu->dirty_pages, count);
+
+    return count;
+}
+
+static uint64_t tcg_dirty_ring_reap(void)
+{
+    CPUState *cpu;
+    TCGDirtyRing *ring;
+    uint64_t total = 0;
+    int64_t stamp = get_clock();
+
+    qemu_mutex_lock(&tcg_dirty_ring_lock);
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        ring = atomic_rcu_read(&cpu->tcg_dirty_ring);
+        if (ring) {
+            total += tcg_dirty_ring_reap_one(cpu, ring);
+        }
+    }
+    rcu_read_unlock();
+    qemu_mutex_unlock(&tcg_dirty_ring_lock);
+
+    trace_tcg_dirty_ring_reap(total, (get_clock() - stamp) / 1000);
+    return total;
+}
+
+void tcg_dirty_ring_push(CPUState *cpu, ram_addr_t ram_addr)
+{
+    TCGDirtyRing *ring = cpu->tcg_dirty_ring;
+    uint32_t push;
+
+    if (unlikely(!ring)) {
+        ring = g_new0(TCGDirtyRing, 1);
+        ring->pages = g_new(ram_addr_t, tcg_dirty_ring_size);
+        atomic_rcu_set(&cpu->tcg_dirty_ring, ring);
+    }
+
+    push = ring->push_index;
+    if (push - atomic_load_acquire(&ring->fetch_index) ==
+        tcg_dirty_ring_size) {
+        /* Like KVM_EXIT_DIRTY_RING_FULL, the vCPU pays for the harvest */
+        trace_tcg_dirty_ring_full(cpu->cpu_index);
+        qemu_mutex_lock(&tcg_dirty_ring_lock);
+        tcg_dirty_ring_reap_one(cpu, ring);
+        qemu_mutex_unlock(&tcg_dirty_ring_lock);
+    }
+
+    ring->pages[push & (tcg_dirty_ring_size - 1)] = ram_addr & TARGET_PAGE_MASK;
+    atomic_store_release(&ring->push_index, push + 1);
+}
+
+void tcg_dirty_ring_free(CPUState *cpu)
+{
+    TCGDirtyRing *ring;
+
+    qemu_mutex_lock(&tcg_dirty_ring_lock);
+    ring = cpu->tcg_dirty_ring;
+    if (ring) {
+        tcg_dirty_ring_reap_one(cpu, ring);
+        atomic_rcu_set(&cpu->tcg_dirty_ring, NULL);
+    }
+    qemu_mutex_unlock(&tcg_dirty_ring_lock);
+
+    if (ring) {
+        g_free(ring->pages);
+        g_free(ring);
+    }
+}
+
+static void tcg_dirty_ring_log_sync_global(MemoryListener *listener)
+{
+    tcg_dirty_ring_reap();
+}
+
+static MemoryListener tcg_dirty_ring_listener = {
+    .log_sync_global = tcg_dirty_ring_log_sync_global,
+};
+
+static void *tcg_dirty_ring_reaper_thread(void *opaque)
+{
+    rcu_register_thread();
+
+    while (qemu_sem_timedwait(&tcg_dirty_ring_reaper_stop,
+                              TCG_DIRTY_RING_REAPER_PERIOD_MS) < 0) {
+        tcg_dirty_ring_reap();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void tcg_dirty_ring_reaper_exit_notify(Notifier *n, void *data)
+{
+    /* Unlike the KVM reaper, this one never takes the BQL */
+    qemu_sem_post(&tcg_dirty_ring_reaper_stop);
+    qemu_thread_join(&tcg_dirty_ring_reaper);
+    qemu_sem_destroy(&tcg_dirty_ring_reaper_stop);
+}
+
+void tcg_dirty_ring_init(uint32_t size)
+{
+    if (!size) {
+        return;
+    }
+
+    assert(is_power_of_2(size));
+    qemu_mutex_init(&tcg_dirty_ring_lock);
+    tcg_dirty_ring_size = size;
+
+    memory_listener_register(&tcg_dirty_ring_listener, &address_space_memory);
+    qemu_sem_init(&tcg_dirty_ring_reaper_stop, 0);
+    qemu_thread_create(&tcg_dirty_ring_reaper, "tcg-reaper",
+                       tcg_dirty_ring_reaper_thread, NULL,
+                       QEMU_THREAD_JOINABLE);
+
+    tcg_dirty_ring_reaper_exit.notify = tcg_dirty_ring_reaper_exit_notify;
+    qemu_add_exit_notifier(&tcg_dirty_ring_reaper_exit);
+}
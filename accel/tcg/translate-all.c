@@ -211,6 +211,8 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+/* Count TB executions and retranslate hot TBs as traces */
+bool tcg_tiered;
 
 static void page_table_config_init(void)
 {
@@ -1225,16 +1227,11 @@ static gboolean tb_host_size_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-/* flush all the translation blocks */
-static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
+/* flush all the translation blocks; call with mmap_lock held */
+static void do_tb_flush__locked(void)
 {
-    mmap_lock();
-    /* If it is already been done on request of another CPU,
-     * just retry.
-     */
-    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
-        goto done;
-    }
+    CPUState *cpu;
+    int64_t ti = get_clock();
 
     if (DEBUG_TB_FLUSH_GATE) {
         size_t nb_tbs = tcg_nb_tbs();
@@ -1257,7 +1254,20 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
        expensive */
     atomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
 
-done:
+    ti = get_clock() - ti;
+    tb_ctx.tb_flush_time += ti;
+    tb_ctx.tb_flush_time_max = MAX(tb_ctx.tb_flush_time_max, ti);
+}
+
+static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    mmap_lock();
+    /* If it is already been done on request of another CPU,
+     * just retry.
+     */
+    if (tb_ctx.tb_flush_count == tb_flush_count.host_int) {
+        do_tb_flush__locked();
+    }
     mmap_unlock();
 }
 
@@ -1270,6 +1280,51 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    size_t *nb_tbs = data;
+
+    /* TBs that were already invalidated are not counted a second time */
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        tb_phys_invalidate(tb, -1);
+        (*nb_tbs)++;
+    }
+    return false;
+}
+
+/*
+ * Make room in the code buffer by evicting the oldest region of it. This
+ * unlinks only the TBs of that region, and leaves the rest of the translated
+ * code alone.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data data)
+{
+    size_t nb_tbs = 0;
+    int64_t ti;
+    int ret;
+
+    mmap_lock();
+    ti = get_clock();
+    ret = tcg_region_evict(tb_evict_iter, &nb_tbs);
+    if (ret < 0) {
+        /* every region is in use, so there is nothing we can evict */
+        do_tb_flush__locked();
+    } else if (ret > 0) {
+        ti = get_clock() - ti;
+        tb_ctx.tb_evict_tbs += nb_tbs;
+        tb_ctx.tb_evict_time += ti;
+        tb_ctx.tb_evict_time_max = MAX(tb_ctx.tb_evict_time_max, ti);
+        atomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    }
+    mmap_unlock();
+}
+
+static void tb_evict(CPUState *cpu)
+{
+    async_safe_run_on_cpu(cpu, do_tb_evict, RUN_ON_CPU_NULL);
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1688,11 +1743,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cflags |= CF_NOCACHE | 1;
     }
 
+    /* Count the executions of TBs that can be retranslated as a trace */
+    if (tcg_tiered && !(cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_NOCACHE |
+                                  CF_USE_ICOUNT | CF_TRACE))) {
+        cflags |= CF_TIERED;
+    }
+
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* evict the oldest code, or flush everything if we cannot */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1706,6 +1767,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
+    tb->exit_count = 0;
+    tb->taken_count = 0;
+    tb->trace_blocks = 0;
     tcg_ctx->tb_cflags = cflags;
 
 #ifdef CONFIG_PROFILER
@@ -1837,6 +1902,32 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/*
+ * Retranslate a CF_TIERED TB, whose execution counter reached
+ * TB_TRACE_THRESHOLD, as a trace.  The guest PC must point to the start
+ * of @tb.  The TB is invalidated first, so that the trace replaces it
+ * in the hash table and in the jump caches.
+ */
+void tb_promote(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = tb_cflags(tb);
+
+    if (cflags & CF_INVALID) {
+        return;
+    }
+    cflags = (cflags & ~CF_TIERED) | CF_TRACE;
+
+    /* The TB's memory may be reused while the trace is translated */
+    tcg_ctx->trace_exec_count = atomic_read(&tb->exec_count);
+    tcg_ctx->trace_taken_count = atomic_read(&tb->taken_count);
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+    mmap_unlock();
+    atomic_inc(&tb_ctx.tb_promote_count);
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -2257,6 +2348,11 @@ struct tb_tree_stats {
     size_t direct_jmp_count;
     size_t direct_jmp2_count;
     size_t cross_page;
+    size_t tiered_count;
+    size_t trace_count;
+    size_t trace_blocks;
+    uint64_t trace_execs;
+    uint64_t trace_exits;
 };
 
 static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
@@ -2279,6 +2375,16 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
             tst->direct_jmp2_count++;
         }
     }
+    if (!(tb->cflags & CF_INVALID)) {
+        if (tb->cflags & CF_TIERED) {
+            tst->tiered_count++;
+        } else if (tb->cflags & CF_TRACE) {
+            tst->trace_count++;
+            tst->trace_blocks += tb->trace_blocks;
+            tst->trace_execs += atomic_read(&tb->exec_count);
+            tst->trace_exits += atomic_read(&tb->exit_count);
+        }
+    }
     return false;
 }
 
@@ -2287,6 +2393,7 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t vtlb_hits, tlb_fills, tlb_resizes;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2313,6 +2420,19 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 nb_tbs ? (tst.direct_jmp_count * 100) / nb_tbs : 0,
                 tst.direct_jmp2_count,
                 nb_tbs ? (tst.direct_jmp2_count * 100) / nb_tbs : 0);
+    if (tcg_tiered) {
+        cpu_fprintf(f, "tiered TB count     %zu\n", tst.tiered_count);
+        cpu_fprintf(f, "trace count         %zu (avg blocks=%0.1f)\n",
+                    tst.trace_count,
+                    tst.trace_count ?
+                    (double)tst.trace_blocks / tst.trace_count : 0);
+        cpu_fprintf(f, "trace hit rate      %0.1f%% "
+                    "(executions=%" PRIu64 " side exits=%" PRIu64 ")\n",
+                    tst.trace_execs ?
+                    (double)(tst.trace_execs - tst.trace_exits) * 100 /
+                    tst.trace_execs : 0,
+                    tst.trace_execs, tst.trace_exits);
+    }
 
     qht_statistics_init(&tb_ctx.htable, &hst);
     print_qht_statistics(f, cpu_fprintf, hst);
@@ -2321,12 +2441,35 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %u\n",
                 atomic_read(&tb_ctx.tb_flush_count));
-    cpu_fprintf(f, "TB invalidate count %zu\n", tcg_tb_phys_invalidate_count());
+    cpu_fprintf(f, "TB flush pause      avg %" PRId64 " us, max %" PRId64
+                " us\n",
+                tb_ctx.tb_flush_count ?
+                tb_ctx.tb_flush_time / tb_ctx.tb_flush_count / SCALE_US : 0,
+                tb_ctx.tb_flush_time_max / SCALE_US);
+    cpu_fprintf(f, "TB eviction count   %u (%zu TBs)\n",
+                atomic_read(&tb_ctx.tb_evict_count), tb_ctx.tb_evict_tbs);
+    cpu_fprintf(f, "TB eviction pause   avg %" PRId64 " us, max %" PRId64
+                " us\n",
+                tb_ctx.tb_evict_count ?
+                tb_ctx.tb_evict_time / tb_ctx.tb_evict_count / SCALE_US : 0,
+                tb_ctx.tb_evict_time_max / SCALE_US);
+    /* Evicted TBs go through tb_phys_invalidate() too, but are counted
+     * above */
+    cpu_fprintf(f, "TB invalidate count %zu\n",
+                tcg_tb_phys_invalidate_count() - tb_ctx.tb_evict_tbs);
+    if (tcg_tiered) {
+        cpu_fprintf(f, "TB promotions       %u\n",
+                    atomic_read(&tb_ctx.tb_promote_count));
+    }
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     cpu_fprintf(f, "TLB full flushes    %zu\n", flush_full);
     cpu_fprintf(f, "TLB partial flushes %zu\n", flush_part);
     cpu_fprintf(f, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_miss_counts(&vtlb_hits, &tlb_fills, &tlb_resizes);
+    cpu_fprintf(f, "TLB victim hits     %zu\n", vtlb_hits);
+    cpu_fprintf(f, "TLB fills           %zu\n", tlb_fills);
+    cpu_fprintf(f, "TLB resizes         %zu\n", tlb_resizes);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -31,6 +31,69 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+bool translator_trace_follow(DisasContextBase *db, target_ulong dest)
+{
+    if (!(tb_cflags(db->tb) & CF_TRACE)
+        || db->num_blocks >= TB_TRACE_MAX_BLOCKS
+        || dest <= db->pc_next
+        || (dest & TARGET_PAGE_MASK) != (db->pc_first & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    db->num_blocks++;
+    db->block_first = dest;
+    return true;
+}
+
+bool translator_trace_loop(DisasContextBase *db, target_ulong dest)
+{
+    return (tb_cflags(db->tb) & CF_TRACE) && dest == db->pc_first;
+}
+
+bool translator_trace_branch_taken(DisasContextBase *db, CPUState *cpu)
+{
+    TranslationBlock *tb;
+    uint32_t execs, taken;
+
+    if (db->block_first == db->pc_first) {
+        /* The counted TB has been invalidated by tb_promote() */
+        execs = tcg_ctx->trace_exec_count;
+        taken = tcg_ctx->trace_taken_count;
+    } else {
+        tb = tb_htable_lookup(cpu, db->block_first, db->tb->cs_base,
+                              db->tb->flags, tb_cflags(db->tb) & CF_HASH_MASK);
+        if (!tb || !(tb_cflags(tb) & CF_TIERED)) {
+            return false;
+        }
+        execs = atomic_read(&tb->exec_count);
+        taken = atomic_read(&tb->taken_count);
+    }
+    return taken > execs - taken;
+}
+
+static void gen_count(uint32_t *counter)
+{
+    TCGv_ptr ptr = tcg_const_ptr(counter);
+    TCGv_i32 count = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+void translator_profile_branch(DisasContextBase *db)
+{
+    if (tb_cflags(db->tb) & CF_TIERED) {
+        gen_count(&db->tb->taken_count);
+    }
+}
+
+void translator_trace_exit(DisasContextBase *db)
+{
+    gen_count(&db->tb->exit_count);
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb)
 {
@@ -42,6 +105,8 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->pc_next = db->pc_first;
     db->is_jmp = DISAS_NEXT;
     db->num_insns = 0;
+    db->num_blocks = 1;
+    db->block_first = db->pc_first;
     db->singlestep_enabled = cpu->singlestep_enabled;
 
     /* Instruction counting */
@@ -127,6 +192,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     /* The disas_log hook may use these values rather than recompute.  */
     db->tb->size = db->pc_next - db->pc_first;
     db->tb->icount = db->num_insns;
+    if (tb_cflags(db->tb) & CF_TRACE) {
+        db->tb->trace_blocks = db->num_blocks;
+    }
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
@@ -351,6 +351,7 @@ BlockDriverState *bdrv_new(void)
     bs->aio_context = qemu_get_aio_context();
 
     qemu_co_queue_init(&bs->flush_queue);
+    qemu_co_queue_init(&bs->coalesce_queue);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -828,6 +829,30 @@ int bdrv_parse_discard_flags(const char *mode, int *flags)
     return 0;
 }
 
+/**
+ * Set open flags for a given AIO engine
+ *
+ * Return 0 on success, -1 if the AIO engine was invalid.
+ */
+int bdrv_parse_aio(const char *mode, int *flags)
+{
+    *flags &= ~(BDRV_O_NATIVE_AIO | BDRV_O_IO_URING);
+
+    if (!strcmp(mode, "threads")) {
+        /* this is the default */
+    } else if (!strcmp(mode, "native")) {
+        *flags |= BDRV_O_NATIVE_AIO;
+#ifdef CONFIG_LINUX_IO_URING
+    } else if (!strcmp(mode, "io_uring")) {
+        *flags |= BDRV_O_IO_URING;
+#endif
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Set open flags for a given cache mode
  *
@@ -919,7 +944,7 @@ static void bdrv_temp_snapshot_options(int *child_flags, QDict *child_options,
 
     /* aio=native doesn't work for cache.direct=off, so disable it for the
      * temporary snapshot */
-    *child_flags &= ~BDRV_O_NATIVE_AIO;
+    *child_flags &= ~(BDRV_O_NATIVE_AIO | BDRV_O_IO_URING);
 }
 
 /*
@@ -2173,15 +2198,59 @@ BdrvChild *bdrv_root_attach_child(BlockDriverState *child_bs,
     return child;
 }
 
+/* Whether the parent of @c, or any node or BlockBackend above it, submits
+ * requests from several AioContexts at the same time */
+static bool bdrv_child_needs_multiqueue(BdrvChild *c)
+{
+    BlockDriverState *parent;
+    BdrvChild *p;
+
+    if (c->role->get_multiqueue) {
+        return c->role->get_multiqueue(c);
+    }
+    if (!c->role->parent_is_bds) {
+        return false;
+    }
+
+    parent = c->opaque;
+    QLIST_FOREACH(p, &parent->parents, next_parent) {
+        if (bdrv_child_needs_multiqueue(p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Refuses to put @bs below a parent that submits requests from several
+ * AioContexts unless @bs and all nodes below it support that */
+static int bdrv_check_multiqueue(BlockDriverState *bs, bool needs_multiqueue,
+                                 Error **errp)
+{
+    if (needs_multiqueue && !bdrv_supports_multiqueue(bs)) {
+        error_setg(errp, "Node '%s' cannot be used by a device that submits "
+                   "requests from multiple iothreads",
+                   bdrv_get_node_name(bs));
+        return -ENOTSUP;
+    }
+    return 0;
+}
+
 BdrvChild *bdrv_attach_child(BlockDriverState *parent_bs,
                              BlockDriverState *child_bs,
                              const char *child_name,
                              const BdrvChildRole *child_role,
                              Error **errp)
 {
-    BdrvChild *child;
+    BdrvChild *child, *c;
     uint64_t perm, shared_perm;
 
+    QLIST_FOREACH(c, &parent_bs->parents, next_parent) {
+        if (bdrv_check_multiqueue(child_bs, bdrv_child_needs_multiqueue(c),
+                                  errp) < 0) {
+            return NULL;
+        }
+    }
+
     bdrv_get_cumulative_perm(parent_bs, &perm, &shared_perm);
 
     assert(parent_bs->drv);
@@ -3589,6 +3658,7 @@ void bdrv_replace_node(BlockDriverState *from, BlockDriverState *to,
     GSList *list = NULL, *p;
     uint64_t old_perm, old_shared;
     uint64_t perm = 0, shared = BLK_PERM_ALL;
+    bool needs_multiqueue = false;
     int ret;
 
     assert(!atomic_read(&from->in_flight));
@@ -3607,6 +3677,13 @@ void bdrv_replace_node(BlockDriverState *from, BlockDriverState *to,
         list = g_slist_prepend(list, c);
         perm |= c->perm;
         shared &= c->shared_perm;
+        needs_multiqueue |= bdrv_child_needs_multiqueue(c);
+    }
+
+    /* Filters and overlays must not end up below a multiqueue device */
+    ret = bdrv_check_multiqueue(to, needs_multiqueue, errp);
+    if (ret < 0) {
+        goto out;
     }
 
     /* Check whether the required permissions can be granted on @to, ignoring
@@ -4316,6 +4393,15 @@ ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs)
     return NULL;
 }
 
+BlockStatsSpecific *bdrv_get_specific_stats(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv || !drv->bdrv_get_specific_stats) {
+        return NULL;
+    }
+    return drv->bdrv_get_specific_stats(bs);
+}
+
 void bdrv_debug_event(BlockDriverState *bs, BlkdebugEvent event)
 {
     if (!bs || !bs->drv || !bs->drv->bdrv_debug_event) {
@@ -5216,6 +5302,23 @@ bool bdrv_recurse_is_first_non_filter(BlockDriverState *bs,
     return false;
 }
 
+/* Whether requests may be submitted to @bs and all nodes below it from
+ * several AioContexts at the same time */
+bool bdrv_supports_multiqueue(BlockDriverState *bs)
+{
+    BdrvChild *child;
+
+    if (!bs->drv || !bs->drv->supports_multiqueue) {
+        return false;
+    }
+    QLIST_FOREACH(child, &bs->children, next) {
+        if (!bdrv_supports_multiqueue(child->bs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /* This function checks if the candidate is the first non filter bs down it's
  * bs chain. Since we don't have pointers to parents it explore all bs chains
  * from the top. Some filters can choose not to pass down the recursion.
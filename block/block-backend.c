@@ -75,6 +75,11 @@ struct BlockBackend {
 
     bool allow_write_beyond_eof;
 
+    /* If true, aio requests may be submitted from any thread. They run and
+     * complete in the AioContext of the submitting thread instead of being
+     * moved to the AioContext of the root node. */
+    bool multiqueue;
+
     NotifierList remove_bs_notifiers, insert_bs_notifiers;
     QLIST_HEAD(, BlockBackendAioNotifier) aio_notifiers;
 
@@ -285,6 +290,13 @@ static void blk_root_detach(BdrvChild *child)
     }
 }
 
+static bool blk_root_get_multiqueue(BdrvChild *child)
+{
+    BlockBackend *blk = child->opaque;
+
+    return blk->multiqueue;
+}
+
 static const BdrvChildRole child_root = {
     .inherit_options    = blk_root_inherit_options,
 
@@ -302,6 +314,8 @@ static const BdrvChildRole child_root = {
 
     .attach             = blk_root_attach,
     .detach             = blk_root_detach,
+
+    .get_multiqueue     = blk_root_get_multiqueue,
 };
 
 /*
@@ -793,6 +807,13 @@ void blk_remove_bs(BlockBackend *blk)
 int blk_insert_bs(BlockBackend *blk, BlockDriverState *bs, Error **errp)
 {
     ThrottleGroupMember *tgm = &blk->public.throttle_group_member;
+
+    if (blk->multiqueue && !bdrv_supports_multiqueue(bs)) {
+        error_setg(errp, "Node '%s' cannot be used by a device that submits "
+                   "requests from multiple iothreads", bdrv_get_node_name(bs));
+        return -ENOTSUP;
+    }
+
     blk->root = bdrv_root_attach_child(bs, "root", &child_root,
                                        blk->perm, blk->shared_perm, blk, errp);
     if (blk->root == NULL) {
@@ -1117,6 +1138,48 @@ void blk_set_allow_write_beyond_eof(BlockBackend *blk, bool allow)
     blk->allow_write_beyond_eof = allow;
 }
 
+/*
+ * Allow aio requests to be submitted from several iothreads at the same
+ * time. This fails if I/O throttling is enabled, since throttled requests
+ * are always resumed in the AioContext of the root node, and unless every
+ * node below the BlockBackend supports it.  While multiqueue is enabled,
+ * graph changes that would put other nodes below the BlockBackend fail.
+ */
+int blk_set_multiqueue(BlockBackend *blk, bool multiqueue, Error **errp)
+{
+    BlockDriverState *bs = blk_bs(blk);
+
+    if (multiqueue) {
+        if (blk->public.throttle_group_member.throttle_state) {
+            error_setg(errp, "multiple iothreads are not supported with "
+                       "I/O throttling");
+            return -ENOTSUP;
+        }
+        if (bs && !bdrv_supports_multiqueue(bs)) {
+            error_setg(errp, "multiple iothreads are only supported if all "
+                       "nodes of '%s' use the file or raw driver",
+                       bdrv_get_device_or_node_name(bs));
+            return -ENOTSUP;
+        }
+    }
+    blk->multiqueue = multiqueue;
+    return 0;
+}
+
+bool blk_get_multiqueue(BlockBackend *blk)
+{
+    return blk->multiqueue;
+}
+
+/* The AioContext in which a new aio request runs and completes */
+static AioContext *blk_get_submit_aio_context(BlockBackend *blk)
+{
+    if (blk->multiqueue) {
+        return qemu_get_current_aio_context();
+    }
+    return blk_get_aio_context(blk);
+}
+
 static int blk_check_byte_request(BlockBackend *blk, int64_t offset,
                                   size_t size)
 {
@@ -1324,7 +1387,8 @@ BlockAIOCB *blk_abort_aio_request(BlockBackend *blk,
     acb->blk = blk;
     acb->ret = ret;
 
-    aio_bh_schedule_oneshot(blk_get_aio_context(blk), error_callback_bh, acb);
+    aio_bh_schedule_oneshot(blk_get_submit_aio_context(blk),
+                            error_callback_bh, acb);
     return &acb->common;
 }
 
@@ -1362,6 +1426,7 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
 {
     BlkAioEmAIOCB *acb;
     Coroutine *co;
+    AioContext *ctx = blk_get_submit_aio_context(blk);
 
     blk_inc_in_flight(blk);
     acb = blk_aio_get(&blk_aio_em_aiocb_info, blk, cb, opaque);
@@ -1376,12 +1441,11 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset, int bytes,
     acb->has_returned = false;
 
     co = qemu_coroutine_create(co_entry, acb);
-    bdrv_coroutine_enter(blk_bs(blk), co);
+    aio_co_enter(ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        aio_bh_schedule_oneshot(blk_get_aio_context(blk),
-                                blk_aio_complete_bh, acb);
+        aio_bh_schedule_oneshot(ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
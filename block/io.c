@@ -41,6 +41,8 @@
 static void bdrv_parent_cb_resize(BlockDriverState *bs);
 static int coroutine_fn bdrv_co_do_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags);
+static int coroutine_fn bdrv_co_do_pdiscard(BdrvChild *child, int64_t offset,
+                                            int bytes);
 
 void bdrv_parent_drained_begin(BlockDriverState *bs, BdrvChild *ignore,
                                bool ignore_bds_parents)
@@ -711,6 +713,14 @@ void bdrv_inc_in_flight(BlockDriverState *bs)
 
 void bdrv_wakeup(BlockDriverState *bs)
 {
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    /* Requests submitted through a multiqueue BlockBackend complete in the
+     * thread that submitted them.  If that is not the home thread of @bs,
+     * a BDRV_POLL_WHILE() running there has to be woken up explicitly. */
+    if (!in_aio_context_home_thread(ctx)) {
+        aio_notify(ctx);
+    }
     aio_wait_kick();
 }
 
@@ -1845,7 +1855,7 @@ fail:
 /*
  * Handle a write request in coroutine context
  */
-int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
+static int coroutine_fn bdrv_co_do_pwritev(BdrvChild *child,
     int64_t offset, unsigned int bytes, QEMUIOVector *qiov,
     BdrvRequestFlags flags)
 {
@@ -1975,6 +1985,123 @@ out:
     return ret;
 }
 
+/*
+ * Discard and write zeroes requests that overlap or touch each other are
+ * merged before they are passed on: guests running fstrim send thousands of
+ * small discards, and each one would otherwise cause separate metadata
+ * updates in format drivers and a separate discard on the host.
+ *
+ * A request that finds no pending request to merge with is dispatched
+ * immediately unless another discard or write zeroes request is already in
+ * flight on the node.  In that case it waits for one iteration of the event
+ * loop, so that requests submitted in the same batch (e.g. by one virtqueue
+ * notification) can join it.  Requests that were merged complete with the
+ * request they were merged into; since they are all in flight at the same
+ * time, the caller cannot tell the difference.
+ */
+static int coroutine_fn bdrv_co_coalesce(BdrvChild *child, int64_t offset,
+                                         int bytes, BdrvRequestFlags flags,
+                                         bool is_discard)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvCoalescedReq req = {
+        .offset     = offset,
+        .bytes      = bytes,
+        .flags      = flags,
+        .is_discard = is_discard,
+    };
+    BdrvCoalescedReq *pending, *merged, *next;
+    int ret;
+
+    stat64_add(is_discard ? &bs->discard_requests : &bs->zero_requests, 1);
+    bdrv_inc_in_flight(bs);
+
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    QLIST_FOREACH(pending, &bs->coalesced_reqs, list) {
+        int64_t start = MIN(pending->offset, offset);
+        int64_t end = MAX(pending->offset + pending->bytes, offset + bytes);
+
+        if (pending->is_discard != is_discard || pending->flags != flags ||
+            offset > pending->offset + pending->bytes ||
+            offset + bytes < pending->offset ||
+            end - start > BDRV_REQUEST_MAX_BYTES)
+        {
+            continue;
+        }
+
+        trace_bdrv_co_coalesce_merge(bs, offset, bytes, start, end - start);
+        pending->offset = start;
+        pending->bytes = end - start;
+        QLIST_INSERT_HEAD(&pending->merged, &req, list);
+        stat64_add(is_discard ? &bs->discard_merged : &bs->zero_merged, 1);
+
+        while (!req.done) {
+            qemu_co_queue_wait(&bs->coalesce_queue, &bs->reqs_lock);
+        }
+        qemu_co_mutex_unlock(&bs->reqs_lock);
+        ret = req.ret;
+        goto out;
+    }
+
+    if (bs->coalesce_in_flight > 0) {
+        QLIST_INSERT_HEAD(&bs->coalesced_reqs, &req, list);
+        qemu_co_mutex_unlock(&bs->reqs_lock);
+
+        aio_co_schedule(qemu_get_current_aio_context(), qemu_coroutine_self());
+        qemu_coroutine_yield();
+
+        qemu_co_mutex_lock(&bs->reqs_lock);
+        QLIST_REMOVE(&req, list);
+    }
+    bs->coalesce_in_flight++;
+    qemu_co_mutex_unlock(&bs->reqs_lock);
+
+    if (is_discard) {
+        ret = bdrv_co_do_pdiscard(child, req.offset, req.bytes);
+    } else {
+        ret = bdrv_co_do_pwritev(child, req.offset, req.bytes, NULL, flags);
+    }
+
+    /* The merged requests cannot return before they get reqs_lock back */
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    bs->coalesce_in_flight--;
+    QLIST_FOREACH_SAFE(merged, &req.merged, list, next) {
+        merged->ret = ret;
+        merged->done = true;
+    }
+    if (!QLIST_EMPTY(&req.merged)) {
+        qemu_co_queue_restart_all(&bs->coalesce_queue);
+    }
+    qemu_co_mutex_unlock(&bs->reqs_lock);
+
+out:
+    bdrv_dec_in_flight(bs);
+    return ret;
+}
+
+int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
+    int64_t offset, unsigned int bytes, QEMUIOVector *qiov,
+    BdrvRequestFlags flags)
+{
+    BlockDriverState *bs = child->bs;
+    int ret;
+
+    if (!(flags & BDRV_REQ_ZERO_WRITE)) {
+        return bdrv_co_do_pwritev(child, offset, bytes, qiov, flags);
+    }
+
+    if (!bs->drv) {
+        return -ENOMEDIUM;
+    }
+
+    ret = bdrv_check_byte_request(bs, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return bdrv_co_coalesce(child, offset, bytes, flags, false);
+}
+
 int coroutine_fn bdrv_co_pwrite_zeroes(BdrvChild *child, int64_t offset,
                                        int bytes, BdrvRequestFlags flags)
 {
@@ -2706,35 +2833,14 @@ static void coroutine_fn bdrv_pdiscard_co_entry(void *opaque)
     rwco->ret = bdrv_co_pdiscard(rwco->child, rwco->offset, rwco->bytes);
 }
 
-int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset, int bytes)
+static int coroutine_fn bdrv_co_do_pdiscard(BdrvChild *child, int64_t offset,
+                                            int bytes)
 {
     BdrvTrackedRequest req;
     int max_pdiscard, ret;
     int head, tail, align;
     BlockDriverState *bs = child->bs;
 
-    if (!bs || !bs->drv) {
-        return -ENOMEDIUM;
-    }
-
-    if (bdrv_has_readonly_bitmaps(bs)) {
-        return -EPERM;
-    }
-
-    ret = bdrv_check_byte_request(bs, offset, bytes);
-    if (ret < 0) {
-        return ret;
-    }
-
-    /* Do nothing if disabled.  */
-    if (!(bs->open_flags & BDRV_O_UNMAP)) {
-        return 0;
-    }
-
-    if (!bs->drv->bdrv_co_pdiscard && !bs->drv->bdrv_aio_pdiscard) {
-        return 0;
-    }
-
     /* Discard is advisory, but some devices track and coalesce
      * unaligned requests, so we must pass everything down rather than
      * round here.  Still, most devices will just silently ignore
@@ -2820,6 +2926,36 @@ out:
     return ret;
 }
 
+int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset, int bytes)
+{
+    BlockDriverState *bs = child->bs;
+    int ret;
+
+    if (!bs || !bs->drv) {
+        return -ENOMEDIUM;
+    }
+
+    if (bdrv_has_readonly_bitmaps(bs)) {
+        return -EPERM;
+    }
+
+    ret = bdrv_check_byte_request(bs, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Do nothing if disabled.  */
+    if (!(bs->open_flags & BDRV_O_UNMAP)) {
+        return 0;
+    }
+
+    if (!bs->drv->bdrv_co_pdiscard && !bs->drv->bdrv_aio_pdiscard) {
+        return 0;
+    }
+
+    return bdrv_co_coalesce(child, offset, bytes, 0, true);
+}
+
 int bdrv_pdiscard(BdrvChild *child, int64_t offset, int bytes)
 {
     Coroutine *co;
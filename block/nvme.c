@@ -29,6 +29,7 @@
 #define NVME_CQ_ENTRY_BYTES 16
 #define NVME_QUEUE_SIZE 128
 #define NVME_BAR_SIZE 8192
+#define NVME_MAX_IO_QUEUES 64
 
 typedef struct {
     int32_t  head, tail;
@@ -42,6 +43,8 @@ typedef struct {
     BlockCompletionFunc *cb;
     void *opaque;
     int cid;
+    /* Where to copy dword 0 of the completion entry, or NULL */
+    uint32_t *result;
     void *prp_list_page;
     uint64_t prp_list_iova;
     bool busy;
@@ -55,6 +58,9 @@ typedef struct {
     int         index;
     uint8_t     *prp_list_pages;
 
+    /* AioContext whose requests use this queue first, claimed atomically */
+    AioContext  *home_ctx;
+
     /* Fields protected by @lock */
     NVMeQueue   sq, cq;
     int         cq_phase;
@@ -96,6 +102,10 @@ typedef struct {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    /* Number of io queues requested by the user */
+    int nr_io_queues;
+    /* Round-robin counter for contexts without a home queue */
+    unsigned next_home_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -115,6 +125,7 @@ typedef struct {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -130,6 +141,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of NVMe I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -330,8 +346,12 @@ static bool nvme_process_completion(BDRVNVMeState *s, NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         preq->busy = false;
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, nvme_translate_error(c));
         qemu_mutex_lock(&q->lock);
@@ -386,26 +406,46 @@ static void nvme_submit_command(BDRVNVMeState *s, NVMeQueuePair *q,
     qemu_mutex_unlock(&q->lock);
 }
 
+typedef struct {
+    int ret;
+    uint32_t result;
+} NVMeCmdSyncData;
+
 static void nvme_cmd_sync_cb(void *opaque, int ret)
 {
-    int *pret = opaque;
-    *pret = ret;
+    NVMeCmdSyncData *data = opaque;
+    data->ret = ret;
 }
 
-static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
-                         NvmeCmd *cmd)
+/* Run @cmd and wait for it, storing dword 0 of the completion in @result if
+ * it isn't NULL.  Only used on the admin queue, whose commands are issued
+ * one at a time. */
+static int nvme_cmd_sync_result(BlockDriverState *bs, NVMeQueuePair *q,
+                                NvmeCmd *cmd, uint32_t *result)
 {
     NVMeRequest *req;
     BDRVNVMeState *s = bs->opaque;
-    int ret = -EINPROGRESS;
+    NVMeCmdSyncData data = { .ret = -EINPROGRESS };
     req = nvme_get_free_req(q);
     if (!req) {
         return -EBUSY;
     }
-    nvme_submit_command(s, q, req, cmd, nvme_cmd_sync_cb, &ret);
+    /* The slot may be reused as soon as the command completes, so
+     * nvme_process_completion() copies dword 0 into @data right away */
+    req->result = &data.result;
+    nvme_submit_command(s, q, req, cmd, nvme_cmd_sync_cb, &data);
+
+    BDRV_POLL_WHILE(bs, data.ret == -EINPROGRESS);
+    if (result) {
+        *result = data.result;
+    }
+    return data.ret;
+}
 
-    BDRV_POLL_WHILE(bs, ret == -EINPROGRESS);
-    return ret;
+static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
+                         NvmeCmd *cmd)
+{
+    return nvme_cmd_sync_result(bs, q, cmd, NULL);
 }
 
 static void nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
@@ -474,6 +514,13 @@ static bool nvme_poll_queues(BDRVNVMeState *s)
 
     for (i = 0; i < s->nr_queues; i++) {
         NVMeQueuePair *q = s->queues[i];
+
+        /* Idle queues are common with many queue pairs; checking them without
+         * taking q->lock keeps the busy-poll loop cheap. A completion racing
+         * with this check is picked up by the next poll or by the irq. */
+        if (!atomic_read(&q->inflight)) {
+            continue;
+        }
         qemu_mutex_lock(&q->lock);
         while (nvme_process_completion(s, q)) {
             /* Keep polling */
@@ -501,6 +548,11 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     NvmeCmd cmd;
     int queue_size = NVME_QUEUE_SIZE;
 
+    if ((n + 1) * 2 * s->doorbell_scale * sizeof(uint32_t) >
+        NVME_BAR_SIZE - offsetof(NVMeRegs, doorbells)) {
+        error_setg(errp, "No doorbell space for io queue [%d]", n);
+        return false;
+    }
     q = nvme_create_queue_pair(bs, n, queue_size, errp);
     if (!q) {
         return false;
@@ -533,6 +585,29 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     return true;
 }
 
+/* Ask the controller for @n io submission and completion queues, returns the
+ * number of queues it is willing to give us or a negative errno. */
+static int nvme_set_num_queues(BlockDriverState *bs, int n)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((n - 1) << 16) | (n - 1)),
+    };
+    uint32_t result;
+    int ret;
+
+    ret = nvme_cmd_sync_result(bs, s->queues[0], &cmd, &result);
+    if (ret) {
+        return ret;
+    }
+
+    /* Both counts are zero based: completion queues in the upper half,
+     * submission queues in the lower one */
+    return MIN(MIN(result >> 16, result & 0xFFFF) + 1, n);
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -650,9 +725,32 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
-    /* Set up command queues. */
+    /* Set up command queues. Only the first one is mandatory, if the
+     * controller runs out of queues we continue with what we have got. */
+    if (s->nr_io_queues > 1) {
+        ret = nvme_set_num_queues(bs, s->nr_io_queues);
+        if (ret < 0) {
+            warn_report("nvme: controller rejected %d io queues, using one",
+                        s->nr_io_queues);
+            s->nr_io_queues = 1;
+        } else if (ret < s->nr_io_queues) {
+            warn_report("nvme: controller allocated %d of %d io queues",
+                        ret, s->nr_io_queues);
+            s->nr_io_queues = ret;
+        }
+        ret = 0;
+    }
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->nr_queues <= s->nr_io_queues) {
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            warn_reportf_err(local_err, "nvme: using %d io queues: ",
+                             s->nr_queues - 1);
+            local_err = NULL;
+            break;
+        }
     }
 out:
     /* Cleaning up is done in nvme_file_open() upon error. */
@@ -749,6 +847,13 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
+    s->nr_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    if (s->nr_io_queues < 1 || s->nr_io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between 1 "
+                   "and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
     ret = nvme_init(bs, device, namespace, errp);
     qemu_opts_del(opts);
     if (ret) {
@@ -876,6 +981,61 @@ fail:
     return r;
 }
 
+/* Each AioContext submitting I/O gets a home queue of its own on every
+ * device, so that requests coming from different iothreads don't contend on
+ * the same q->lock.  Queues are claimed in order; once they are all taken,
+ * requests from further contexts are spread over them round-robin.
+ *
+ * bdrv_nvme does not set .supports_multiqueue, so for now all requests come
+ * from the node's AioContext and the other queues only take the overflow
+ * of a full home queue. */
+static unsigned nvme_get_home_queue(BDRVNVMeState *s, int nr_io_queues)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    AioContext *owner;
+    int i;
+
+    for (i = 0; i < nr_io_queues; i++) {
+        NVMeQueuePair *q = s->queues[1 + i];
+
+        owner = atomic_read(&q->home_ctx);
+        if (!owner) {
+            owner = atomic_cmpxchg(&q->home_ctx, NULL, ctx);
+            if (!owner) {
+                return i;
+            }
+        }
+        if (owner == ctx) {
+            return i;
+        }
+    }
+    return atomic_fetch_inc(&s->next_home_queue) % nr_io_queues;
+}
+
+/* Pick an io queue for a new request: the home queue of the calling
+ * context, or the next one with free slots if the home queue is full. */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    int nr_io_queues = s->nr_queues - 1;
+    unsigned start;
+    int i;
+
+    assert(nr_io_queues > 0);
+    if (nr_io_queues == 1) {
+        return s->queues[1];
+    }
+    start = nvme_get_home_queue(s, nr_io_queues);
+    for (i = 0; i < nr_io_queues; i++) {
+        NVMeQueuePair *q = s->queues[1 + (start + i) % nr_io_queues];
+        /* Unlocked check, nvme_get_free_req() does the real accounting */
+        if (atomic_read(&q->inflight) + atomic_read(&q->need_kick) <
+            NVME_QUEUE_SIZE - 2) {
+            return q;
+        }
+    }
+    return s->queues[1 + start % nr_io_queues];
+}
+
 typedef struct {
     Coroutine *co;
     int ret;
@@ -907,7 +1067,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     uint32_t cdw12 = (((bytes >> BDRV_SECTOR_BITS) - 1) & 0xFFFF) |
                        (flags & BDRV_REQ_FUA ? 1 << 30 : 0);
@@ -923,8 +1083,10 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .ret = -EINPROGRESS,
     };
 
-    trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
+    trace_nvme_prw_aligned(s, ioq->index, is_write, offset, bytes, flags,
+                           qiov->niov);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1021,7 +1183,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1032,7 +1194,10 @@ static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
         .ret = -EINPROGRESS,
     };
 
+    /* A flush covers all commands completed before it, regardless of the
+     * queue they were submitted on. */
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(s, ioq, req, &cmd, nvme_rw_cb, &data);
@@ -529,6 +529,22 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    s->driver_specific = bdrv_get_specific_stats(bs);
+    if (s->driver_specific) {
+        s->has_driver_specific = true;
+    }
+
+    if (stat64_get(&bs->discard_requests) || stat64_get(&bs->zero_requests)) {
+        s->has_coalesce = true;
+        s->coalesce = g_new(BlockCoalesceStats, 1);
+        *s->coalesce = (BlockCoalesceStats) {
+            .discard_requests   = stat64_get(&bs->discard_requests),
+            .discard_merged     = stat64_get(&bs->discard_merged),
+            .zero_requests      = stat64_get(&bs->zero_requests),
+            .zero_merged        = stat64_get(&bs->zero_merged),
+        };
+    }
+
     if (bs->file) {
         s->has_parent = true;
         s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level);
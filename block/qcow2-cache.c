@@ -33,6 +33,7 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,6 +45,16 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Maps the offset of every cached table to its index in @entries.  The
+     * key points to the offset field of the entry itself, so an entry must be
+     * removed from the index before its offset is changed. */
+    GHashTable             *index;
+
+    /* Unreferenced entries, least recently used first.  Unused entries (with
+     * offset 0) are kept at the head so that they are reused before any
+     * cached table is evicted.  An entry is on this list iff its ref is 0. */
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +70,40 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline int qcow2_cache_entry_idx(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    return t - c->entries;
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    gpointer idx = g_hash_table_lookup(c->index, &offset);
+    return idx ? GPOINTER_TO_INT(idx) - 1 : -1;
+}
+
+static void qcow2_cache_index_insert(Qcow2Cache *c, int i)
+{
+    g_hash_table_insert(c->index, &c->entries[i].offset,
+                        GINT_TO_POINTER(i + 1));
+}
+
+/* Forget the table cached in entry @i and make the entry the first one to be
+ * reused.  The entry must not be referenced. */
+static void qcow2_cache_entry_reset(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    assert(t->ref == 0);
+    if (t->offset) {
+        g_hash_table_remove(c->index, &t->offset);
+    }
+    t->offset = 0;
+    t->lru_counter = 0;
+
+    QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    QTAILQ_INSERT_HEAD(&c->lru, t, lru_entry);
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,8 +151,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_reset(c, i);
             i++;
             to_clean++;
         }
@@ -125,6 +169,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -142,7 +187,13 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
         qemu_vfree(c->table_array);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < num_tables; i++) {
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
     }
 
     return c;
@@ -156,6 +207,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    g_hash_table_destroy(c->index);
     qemu_vfree(c->table_array);
     g_free(c->entries);
     g_free(c);
@@ -306,9 +358,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     }
 
     for (i = 0; i < c->size; i++) {
-        assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        qcow2_cache_entry_reset(c, i);
     }
 
     qcow2_cache_table_release(c, 0, c->size);
@@ -322,11 +372,9 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *victim;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -341,29 +389,20 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    victim = QTAILQ_FIRST(&c->lru);
+    if (victim == NULL) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    i = qcow2_cache_entry_idx(c, victim);
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -374,7 +413,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_entry_reset(c, i);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -389,10 +428,13 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     c->entries[i].offset = offset;
+    qcow2_cache_index_insert(c, i);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    if (c->entries[i].ref++ == 0) {
+        QTAILQ_REMOVE(&c->lru, &c->entries[i], lru_entry);
+    }
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -413,6 +455,39 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     return qcow2_cache_do_get(bs, c, offset, table, false);
 }
 
+/* Insert a table that the caller has already read from the image into the
+ * cache.  Only unused entries are filled, so that prefetching never evicts a
+ * table that has actually been used.  Returns -EEXIST if the table is cached
+ * already and -ENOSPC if there is no unused entry left. */
+int qcow2_cache_prefetch(Qcow2Cache *c, uint64_t offset, const void *table)
+{
+    Qcow2CachedTable *t;
+    int i;
+
+    assert(offset != 0 && QEMU_IS_ALIGNED(offset, c->table_size));
+
+    if (qcow2_cache_lookup(c, offset) >= 0) {
+        return -EEXIST;
+    }
+
+    t = QTAILQ_FIRST(&c->lru);
+    if (t == NULL || t->offset != 0) {
+        return -ENOSPC;
+    }
+
+    i = qcow2_cache_entry_idx(c, t);
+    memcpy(qcow2_cache_get_table_addr(c, i), table, c->table_size);
+    t->offset = offset;
+    t->dirty = false;
+    t->lru_counter = ++c->lru_counter;
+    qcow2_cache_index_insert(c, i);
+
+    QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    QTAILQ_INSERT_TAIL(&c->lru, t, lru_entry);
+
+    return 0;
+}
+
 void qcow2_cache_put(Qcow2Cache *c, void **table)
 {
     int i = qcow2_cache_get_table_idx(c, *table);
@@ -422,6 +497,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -436,24 +512,55 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
+    int i = qcow2_cache_lookup(c, offset);
+
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
+}
+
+/* Asserts that the index and the LRU list agree with the entries */
+void qcow2_cache_check_consistency(Qcow2Cache *c)
+{
+    Qcow2CachedTable *t;
+    uint64_t last_lru_counter = 0;
+    bool seen_cached = false;
+    int cached = 0, unreferenced = 0;
     int i;
 
     for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
+        t = &c->entries[i];
+        assert(t->ref >= 0);
+        if (t->offset) {
+            assert(qcow2_cache_lookup(c, t->offset) == i);
+            cached++;
+        } else {
+            assert(t->ref == 0 && !t->dirty);
+        }
+        if (t->ref == 0) {
+            unreferenced++;
         }
     }
-    return NULL;
+    assert(g_hash_table_size(c->index) == cached);
+
+    /* Unused entries come first, then the others by release time */
+    QTAILQ_FOREACH(t, &c->lru, lru_entry) {
+        assert(t->ref == 0);
+        if (t->offset) {
+            assert(t->lru_counter >= last_lru_counter);
+            last_lru_counter = t->lru_counter;
+            seen_cached = true;
+        } else {
+            assert(!seen_cached);
+        }
+        unreferenced--;
+    }
+    assert(unreferenced == 0);
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
 {
     int i = qcow2_cache_get_table_idx(c, table);
 
-    assert(c->entries[i].ref == 0);
-
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_reset(c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
@@ -27,6 +27,11 @@
 #define ZLIB_CONST
 #include <zlib.h>
 
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
 #include "block/block_int.h"
 #include "block/qdict.h"
 #include "sysemu/block-backend.h"
@@ -73,10 +78,12 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_FEATURE_TABLE 0x6803f857
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
+#define  QCOW2_EXT_MAGIC_COMPRESSION_TYPE 0x434d5052
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t file_cluster_offset,
+                           const uint64_t *l2_entries,
+                           int nb_clusters,
                            uint64_t offset,
                            uint64_t bytes,
                            QEMUIOVector *qiov);
@@ -307,6 +314,41 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
         }   break;
 
+        case QCOW2_EXT_MAGIC_COMPRESSION_TYPE: {
+            Qcow2CompressionTypeExt compression_ext;
+
+            if (ext.len != sizeof(compression_ext)) {
+                error_setg(errp, "compression_type_ext: "
+                           "Invalid extension length");
+                return -EINVAL;
+            }
+
+            ret = bdrv_pread(bs->file, offset, &compression_ext, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "compression_type_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            switch (compression_ext.compression_type) {
+            case QCOW2_COMPRESSION_TYPE_ZLIB:
+                /* Images that use zlib must not have the extension */
+                error_setg(errp, "compression_type_ext: Invalid compression "
+                           "type %u", compression_ext.compression_type);
+                return -EINVAL;
+#ifdef CONFIG_ZSTD
+            case QCOW2_COMPRESSION_TYPE_ZSTD:
+                break;
+#endif
+            default:
+                error_setg(errp, "compression_type_ext: Unsupported "
+                           "compression type %u",
+                           compression_ext.compression_type);
+                return -ENOTSUP;
+            }
+            s->compression_type = compression_ext.compression_type;
+        }   break;
+
         case QCOW2_EXT_MAGIC_BITMAPS:
             if (ext.len != sizeof(bitmaps_ext)) {
                 error_setg_errno(errp, -ret, "bitmaps_ext: "
@@ -719,6 +761,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESS_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of clusters that are compressed or "
+                    "decompressed in parallel",
+        },
+        {
+            .name = QCOW2_OPT_L2_PREFETCH,
+            .type = QEMU_OPT_BOOL,
+            .help = "Read the active L2 tables into the L2 cache in the "
+                    "background after opening the image",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -780,6 +834,24 @@ static void qcow2_attach_aio_context(BlockDriverState *bs,
     cache_clean_timer_init(bs, new_context);
 }
 
+static void coroutine_fn qcow2_co_drain_begin(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    /* The L2 prefetch pauses at its next batch */
+    s->l2_prefetch_quiesce++;
+}
+
+static void coroutine_fn qcow2_co_drain_end(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    assert(s->l2_prefetch_quiesce > 0);
+    if (--s->l2_prefetch_quiesce == 0) {
+        qcow2_l2_prefetch_resume(bs);
+    }
+}
+
 static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *l2_cache_size,
                              uint64_t *l2_cache_entry_size,
@@ -790,7 +862,11 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     bool l2_cache_size_set, refcount_cache_size_set, combined_cache_size_set;
     int min_refcount_cache = MIN_REFCOUNT_CACHE_SIZE * s->cluster_size;
     uint64_t virtual_disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
-    uint64_t max_l2_cache = virtual_disk_size / (s->cluster_size / 8);
+    uint64_t max_l2_entries = DIV_ROUND_UP(virtual_disk_size, s->cluster_size);
+    /* An L2 table is always one cluster in size so the max cache size
+     * should be a multiple of the cluster size. */
+    uint64_t max_l2_cache = ROUND_UP(max_l2_entries * l2_entry_size(s),
+                                     s->cluster_size);
 
     combined_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_CACHE_SIZE);
     l2_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_SIZE);
@@ -862,6 +938,8 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t compress_threads;
+    bool l2_prefetch;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -939,7 +1017,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         }
     }
 
-    r->l2_slice_size = l2_cache_entry_size / sizeof(uint64_t);
+    r->l2_slice_size = l2_cache_entry_size / l2_entry_size(s);
     r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size,
                                            l2_cache_entry_size);
     r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size,
@@ -968,6 +1046,18 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->compress_threads = qemu_opt_get_number(opts, QCOW2_OPT_COMPRESS_THREADS,
+                                              DEFAULT_COMPRESS_THREADS);
+    if (r->compress_threads < 1 ||
+        r->compress_threads > QCOW2_MAX_COMPRESS_THREADS) {
+        error_setg(errp, QCOW2_OPT_COMPRESS_THREADS " must be between 1 and "
+                   "%d", QCOW2_MAX_COMPRESS_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->l2_prefetch = qemu_opt_get_bool(opts, QCOW2_OPT_L2_PREFETCH, false);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1118,6 +1208,9 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->compress_threads = r->compress_threads;
+    s->l2_prefetch = r->l2_prefetch;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1278,6 +1371,18 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
+    s->subclusters_per_cluster =
+        has_subclusters(s) ? QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER : 1;
+    s->subcluster_size = s->cluster_size / s->subclusters_per_cluster;
+    s->subcluster_bits = ctz32(s->subcluster_size);
+
+    if (has_subclusters(s) && s->cluster_bits < QCOW_EXTL2_MIN_CLUSTER_BITS) {
+        error_setg(errp, "Unsupported cluster size for images with extended "
+                   "L2 entries: 2^%d", s->cluster_bits);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     if (s->incompatible_features & QCOW2_INCOMPAT_CORRUPT) {
         /* Corrupt images may not be written to unless they are being repaired
          */
@@ -1329,7 +1434,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         bs->encrypted = true;
     }
 
-    s->l2_bits = s->cluster_bits - 3; /* L2 is always one cluster */
+    /* L2 is always one cluster */
+    s->l2_bits = s->cluster_bits - ctz32(l2_entry_size(s));
     s->l2_size = 1 << s->l2_bits;
     /* 2^(s->refcount_order - 3) is the refcount width in bytes */
     s->refcount_block_bits = s->cluster_bits - (s->refcount_order - 3);
@@ -1433,6 +1539,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     QTAILQ_INIT(&s->discards);
 
     /* read qcow2 extensions */
+    s->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
     if (qcow2_read_extensions(bs, header.header_length, ext_end, NULL,
                               flags, &update_header, &local_err)) {
         error_propagate(errp, local_err);
@@ -1440,6 +1547,17 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
+    /* The compression type extension and its feature bit go together, so
+     * that a reader that does not know about the extension never tries to
+     * inflate clusters that were not compressed with zlib */
+    if (!!(s->incompatible_features & QCOW2_INCOMPAT_COMPRESSION) !=
+        (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB)) {
+        error_setg(errp, "qcow2: Compression type feature bit does not match "
+                   "the compression type header extension");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* qcow2_read_extension may have set up the crypto context
      * if the crypt method needs a header region, some methods
      * don't need header extensions, so must check here
@@ -1606,6 +1724,10 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
 
     qemu_co_queue_init(&s->compress_wait_queue);
 
+    if (s->l2_prefetch && !(flags & BDRV_O_INACTIVE)) {
+        qcow2_l2_prefetch_start(bs);
+    }
+
     return ret;
 
  fail:
@@ -1685,7 +1807,7 @@ static void qcow2_refresh_limits(BlockDriverState *bs, Error **errp)
         /* Encryption works on a sector granularity */
         bs->bl.request_alignment = qcrypto_block_get_sector_size(s->crypto);
     }
-    bs->bl.pwrite_zeroes_alignment = s->cluster_size;
+    bs->bl.pwrite_zeroes_alignment = s->subcluster_size;
     bs->bl.pdiscard_alignment = s->cluster_size;
 }
 
@@ -1796,13 +1918,14 @@ static int coroutine_fn qcow2_co_block_status(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t cluster_offset;
+    QCow2SubclusterType type;
     int index_in_cluster, ret;
     unsigned int bytes;
     int status = 0;
 
     bytes = MIN(INT_MAX, count);
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_get_cluster_offset(bs, offset, &bytes, &cluster_offset);
+    ret = qcow2_get_cluster_offset(bs, offset, &bytes, &cluster_offset, &type);
     qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
         return ret;
@@ -1810,16 +1933,18 @@ static int coroutine_fn qcow2_co_block_status(BlockDriverState *bs,
 
     *pnum = bytes;
 
-    if (cluster_offset != 0 && ret != QCOW2_CLUSTER_COMPRESSED &&
-        !s->crypto) {
+    if ((type == QCOW2_SUBCLUSTER_NORMAL ||
+         type == QCOW2_SUBCLUSTER_ZERO_ALLOC ||
+         type == QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC) && !s->crypto) {
         index_in_cluster = offset & (s->cluster_size - 1);
         *map = cluster_offset | index_in_cluster;
         *file = bs->file->bs;
         status |= BDRV_BLOCK_OFFSET_VALID;
     }
-    if (ret == QCOW2_CLUSTER_ZERO_PLAIN || ret == QCOW2_CLUSTER_ZERO_ALLOC) {
+    if (qcow2_subcluster_is_zero(type)) {
         status |= BDRV_BLOCK_ZERO;
-    } else if (ret != QCOW2_CLUSTER_UNALLOCATED) {
+    } else if (type != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+               type != QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC) {
         status |= BDRV_BLOCK_DATA;
     }
     return status;
@@ -1860,6 +1985,83 @@ out:
     return ret;
 }
 
+/*
+ * Decode the host offset and the (sector-rounded) size of the compressed
+ * data referenced by the compressed cluster descriptor @l2_entry.
+ */
+static void qcow2_parse_compressed_l2_entry(BDRVQcow2State *s,
+                                            uint64_t l2_entry,
+                                            uint64_t *coffset, int *csize)
+{
+    int nb_csectors;
+
+    *coffset = l2_entry & s->cluster_offset_mask;
+    nb_csectors = ((l2_entry >> s->csize_shift) & s->csize_mask) + 1;
+    *csize = nb_csectors * 512 - (*coffset & 511);
+}
+
+/*
+ * Starting with the compressed cluster described by @l2_entry, which covers
+ * @cur_bytes bytes at guest @offset, collect the following clusters of the
+ * request (@bytes bytes in total) as long as they are compressed, too, and
+ * their compressed data is stored right behind the previous one in the image
+ * file.  This is the usual layout of images written by qemu-img convert -c,
+ * and it allows to read the whole batch with a single I/O request.
+ *
+ * The descriptors are stored in @l2_entries, which must have room for
+ * QCOW2_MAX_COMPRESSED_BATCH entries.  *@batch_bytes is set to the number of
+ * guest bytes covered by the batch.
+ *
+ * Returns the number of clusters in the batch, which is at least 1.
+ *
+ * Called with s->lock held.
+ */
+static int qcow2_get_compressed_batch(BlockDriverState *bs, uint64_t offset,
+                                      uint64_t bytes, uint64_t l2_entry,
+                                      unsigned int cur_bytes,
+                                      uint64_t *l2_entries,
+                                      uint64_t *batch_bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t coffset, host_end;
+    int csize, nb_clusters = 1;
+    int max_clusters = MAX(1, MIN(QCOW2_MAX_COMPRESSED_BATCH,
+                                  QCOW2_MAX_COMPRESSED_BATCH_BYTES >>
+                                  s->cluster_bits));
+
+    l2_entries[0] = l2_entry;
+    *batch_bytes = cur_bytes;
+
+    qcow2_parse_compressed_l2_entry(s, l2_entry, &coffset, &csize);
+    host_end = coffset + csize;
+
+    while (nb_clusters < max_clusters && bytes > *batch_bytes) {
+        unsigned int next_bytes = MIN(bytes - *batch_bytes, INT_MAX);
+        uint64_t next_entry, next_coffset;
+        QCow2SubclusterType type;
+        int ret;
+
+        ret = qcow2_get_cluster_offset(bs, offset + *batch_bytes, &next_bytes,
+                                       &next_entry, &type);
+        if (ret < 0 || type != QCOW2_SUBCLUSTER_COMPRESSED) {
+            /* Errors are reported when the main loop gets here */
+            break;
+        }
+
+        qcow2_parse_compressed_l2_entry(s, next_entry, &next_coffset, &csize);
+        if (next_coffset < coffset || next_coffset > host_end) {
+            break;
+        }
+
+        l2_entries[nb_clusters++] = next_entry;
+        *batch_bytes += next_bytes;
+        coffset = next_coffset;
+        host_end = MAX(host_end, next_coffset + csize);
+    }
+
+    return nb_clusters;
+}
+
 static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                                         uint64_t bytes, QEMUIOVector *qiov,
                                         int flags)
@@ -1872,6 +2074,7 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     uint64_t bytes_done = 0;
     QEMUIOVector hd_qiov;
     uint8_t *cluster_data = NULL;
+    QCow2SubclusterType type;
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
@@ -1886,7 +2089,8 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        ret = qcow2_get_cluster_offset(bs, offset, &cur_bytes, &cluster_offset);
+        ret = qcow2_get_cluster_offset(bs, offset, &cur_bytes, &cluster_offset,
+                                       &type);
         if (ret < 0) {
             goto fail;
         }
@@ -1896,8 +2100,9 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
         qemu_iovec_reset(&hd_qiov);
         qemu_iovec_concat(&hd_qiov, qiov, bytes_done, cur_bytes);
 
-        switch (ret) {
-        case QCOW2_CLUSTER_UNALLOCATED:
+        switch (type) {
+        case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
 
             if (bs->backing) {
                 BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
@@ -1914,14 +2119,26 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             }
             break;
 
-        case QCOW2_CLUSTER_ZERO_PLAIN:
-        case QCOW2_CLUSTER_ZERO_ALLOC:
+        case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+        case QCOW2_SUBCLUSTER_ZERO_ALLOC:
             qemu_iovec_memset(&hd_qiov, 0, 0, cur_bytes);
             break;
 
-        case QCOW2_CLUSTER_COMPRESSED:
+        case QCOW2_SUBCLUSTER_COMPRESSED:
+        {
+            uint64_t l2_entries[QCOW2_MAX_COMPRESSED_BATCH];
+            uint64_t batch_bytes;
+            int nb_clusters;
+
+            nb_clusters = qcow2_get_compressed_batch(bs, offset, bytes,
+                                                     cluster_offset, cur_bytes,
+                                                     l2_entries, &batch_bytes);
+            cur_bytes = batch_bytes;
+            qemu_iovec_reset(&hd_qiov);
+            qemu_iovec_concat(&hd_qiov, qiov, bytes_done, cur_bytes);
+
             qemu_co_mutex_unlock(&s->lock);
-            ret = qcow2_co_preadv_compressed(bs, cluster_offset,
+            ret = qcow2_co_preadv_compressed(bs, l2_entries, nb_clusters,
                                              offset, cur_bytes,
                                              &hd_qiov);
             qemu_co_mutex_lock(&s->lock);
@@ -1930,8 +2147,9 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             }
 
             break;
+        }
 
-        case QCOW2_CLUSTER_NORMAL:
+        case QCOW2_SUBCLUSTER_NORMAL:
             if ((cluster_offset & 511) != 0) {
                 ret = -EIO;
                 goto fail;
@@ -2174,6 +2392,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_l2_prefetch_cancel(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2237,6 +2457,7 @@ static void coroutine_fn qcow2_co_invalidate_cache(BlockDriverState *bs,
     BDRVQcow2State *s = bs->opaque;
     int flags = s->flags;
     QCryptoBlock *crypto = NULL;
+    int l2_prefetch_quiesce;
     QDict *options;
     Error *local_err = NULL;
     int ret;
@@ -2251,7 +2472,10 @@ static void coroutine_fn qcow2_co_invalidate_cache(BlockDriverState *bs,
 
     qcow2_close(bs);
 
+    /* The node may be in a drained section that ends after reopening */
+    l2_prefetch_quiesce = s->l2_prefetch_quiesce;
     memset(s, 0, sizeof(BDRVQcow2State));
+    s->l2_prefetch_quiesce = l2_prefetch_quiesce;
     options = qdict_clone_shallow(bs->options);
 
     flags &= ~BDRV_O_INACTIVE;
@@ -2412,6 +2636,21 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Compression type header extension */
+    if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        Qcow2CompressionTypeExt compression_ext = {
+            .compression_type = s->compression_type,
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_COMPRESSION_TYPE,
+                             &compression_ext, sizeof(compression_ext),
+                             buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Feature table */
     if (s->qcow_version >= 3) {
         Qcow2Feature features[] = {
@@ -2425,6 +2664,16 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_CORRUPT_BITNR,
                 .name = "corrupt bit",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_COMPRESSION_BITNR,
+                .name = "compression type",
+            },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
+                .name = "extended L2 entries",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
@@ -2704,28 +2953,31 @@ int64_t qcow2_refcount_metadata_size(int64_t clusters, size_t cluster_size,
  * @total_size: virtual disk size in bytes
  * @cluster_size: cluster size in bytes
  * @refcount_order: refcount bits power-of-2 exponent
+ * @extended_l2: true if the image has extended L2 entries
  *
  * Returns: Total number of bytes required for the fully allocated image
  * (including metadata).
  */
 static int64_t qcow2_calc_prealloc_size(int64_t total_size,
                                         size_t cluster_size,
-                                        int refcount_order)
+                                        int refcount_order,
+                                        bool extended_l2)
 {
     int64_t meta_size = 0;
     uint64_t nl1e, nl2e;
     int64_t aligned_total_size = ROUND_UP(total_size, cluster_size);
+    size_t l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
 
     /* header: 1 cluster */
     meta_size += cluster_size;
 
     /* total size of L2 tables */
     nl2e = aligned_total_size / cluster_size;
-    nl2e = ROUND_UP(nl2e, cluster_size / sizeof(uint64_t));
-    meta_size += nl2e * sizeof(uint64_t);
+    nl2e = ROUND_UP(nl2e, cluster_size / l2e_size);
+    meta_size += nl2e * l2e_size;
 
     /* total size of L1 tables */
-    nl1e = nl2e * sizeof(uint64_t) / cluster_size;
+    nl1e = nl2e * l2e_size / cluster_size;
     nl1e = ROUND_UP(nl1e, cluster_size / sizeof(uint64_t));
     meta_size += nl1e * sizeof(uint64_t);
 
@@ -2737,7 +2989,8 @@ static int64_t qcow2_calc_prealloc_size(int64_t total_size,
     return meta_size + aligned_total_size;
 }
 
-static bool validate_cluster_size(size_t cluster_size, Error **errp)
+static bool validate_cluster_size(size_t cluster_size, bool extended_l2,
+                                  Error **errp)
 {
     int cluster_bits = ctz32(cluster_size);
     if (cluster_bits < MIN_CLUSTER_BITS || cluster_bits > MAX_CLUSTER_BITS ||
@@ -2747,16 +3000,25 @@ static bool validate_cluster_size(size_t cluster_size, Error **errp)
                    "%dk", 1 << MIN_CLUSTER_BITS, 1 << (MAX_CLUSTER_BITS - 10));
         return false;
     }
+
+    if (extended_l2 && cluster_bits < QCOW_EXTL2_MIN_CLUSTER_BITS) {
+        error_setg(errp, "Extended L2 entries are only supported with cluster "
+                   "sizes of at least %dk",
+                   1 << (QCOW_EXTL2_MIN_CLUSTER_BITS - 10));
+        return false;
+    }
+
     return true;
 }
 
-static size_t qcow2_opt_get_cluster_size_del(QemuOpts *opts, Error **errp)
+static size_t qcow2_opt_get_cluster_size_del(QemuOpts *opts, bool extended_l2,
+                                             Error **errp)
 {
     size_t cluster_size;
 
     cluster_size = qemu_opt_get_size_del(opts, BLOCK_OPT_CLUSTER_SIZE,
                                          DEFAULT_CLUSTER_SIZE);
-    if (!validate_cluster_size(cluster_size, errp)) {
+    if (!validate_cluster_size(cluster_size, extended_l2, errp)) {
         return 0;
     }
     return cluster_size;
@@ -2868,7 +3130,30 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         cluster_size = DEFAULT_CLUSTER_SIZE;
     }
 
-    if (!validate_cluster_size(cluster_size, errp)) {
+    if (!qcow2_opts->has_extended_l2) {
+        qcow2_opts->extended_l2 = false;
+    }
+    if (qcow2_opts->extended_l2 && version < 3) {
+        error_setg(errp, "Extended L2 entries are only supported with "
+                   "compatibility level 1.1 and above (use version=v3 or "
+                   "greater)");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (!validate_cluster_size(cluster_size, qcow2_opts->extended_l2, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (!qcow2_opts->has_compression_type) {
+        qcow2_opts->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+    }
+    if (qcow2_opts->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB &&
+        version < 3) {
+        error_setg(errp, "Non-zlib compression type is only supported with "
+                   "compatibility level 1.1 and above (use version=v3 or "
+                   "greater)");
         ret = -EINVAL;
         goto out;
     }
@@ -2940,7 +3225,7 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
     {
         int64_t prealloc_size =
             qcow2_calc_prealloc_size(qcow2_opts->size, cluster_size,
-                                     refcount_order);
+                                     refcount_order, qcow2_opts->extended_l2);
 
         ret = blk_truncate(blk, prealloc_size, qcow2_opts->preallocation, errp);
         if (ret < 0) {
@@ -2971,6 +3256,24 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         header->compatible_features |=
             cpu_to_be64(QCOW2_COMPAT_LAZY_REFCOUNTS);
     }
+    if (qcow2_opts->extended_l2) {
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_EXTL2);
+    }
+    if (qcow2_opts->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        /* The feature bit must not be set without the extension, so store
+         * it in the initial header already; qcow2_update_header() keeps it */
+        Qcow2CompressionTypeExt compression_ext = {
+            .compression_type = qcow2_opts->compression_type,
+        };
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_COMPRESSION);
+        ret = header_ext_add((char *) header + sizeof(*header),
+                             QCOW2_EXT_MAGIC_COMPRESSION_TYPE,
+                             &compression_ext, sizeof(compression_ext),
+                             cluster_size - sizeof(*header));
+        assert(ret > 0);
+    }
 
     ret = blk_pwrite(blk, 0, header, cluster_size, 0);
     g_free(header);
@@ -3149,6 +3452,8 @@ static int coroutine_fn qcow2_co_create_opts(const char *filename, QemuOpts *opt
         { BLOCK_OPT_CLUSTER_SIZE,       "cluster-size" },
         { BLOCK_OPT_LAZY_REFCOUNTS,     "lazy-refcounts" },
         { BLOCK_OPT_REFCOUNT_BITS,      "refcount-bits" },
+        { BLOCK_OPT_EXTL2,              "extended-l2" },
+        { BLOCK_OPT_COMPRESSION_TYPE,   "compression-type" },
         { BLOCK_OPT_ENCRYPT,            BLOCK_OPT_ENCRYPT_FORMAT },
         { BLOCK_OPT_COMPAT_LEVEL,       "version" },
         { NULL, NULL },
@@ -3234,8 +3539,8 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
-    uint32_t head = offset % s->cluster_size;
-    uint32_t tail = (offset + bytes) % s->cluster_size;
+    uint32_t head = offset_into_subcluster(s, offset);
+    uint32_t tail = offset_into_subcluster(s, offset + bytes);
 
     trace_qcow2_pwrite_zeroes_start_req(qemu_coroutine_self(), offset, bytes);
     if (offset + bytes == bs->total_sectors * BDRV_SECTOR_SIZE) {
@@ -3245,27 +3550,30 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     if (head || tail) {
         uint64_t off;
         unsigned int nr;
+        QCow2SubclusterType type;
 
-        assert(head + bytes <= s->cluster_size);
+        assert(head + bytes <= s->subcluster_size);
 
-        /* check whether remainder of cluster already reads as zero */
+        /* check whether remainder of subcluster already reads as zero */
         if (!(is_zero(bs, offset - head, head) &&
               is_zero(bs, offset + bytes,
-                      tail ? s->cluster_size - tail : 0))) {
+                      tail ? s->subcluster_size - tail : 0))) {
             return -ENOTSUP;
         }
 
         qemu_co_mutex_lock(&s->lock);
         /* We can have new write after previous check */
-        offset = QEMU_ALIGN_DOWN(offset, s->cluster_size);
-        bytes = s->cluster_size;
-        nr = s->cluster_size;
-        ret = qcow2_get_cluster_offset(bs, offset, &nr, &off);
-        if (ret != QCOW2_CLUSTER_UNALLOCATED &&
-            ret != QCOW2_CLUSTER_ZERO_PLAIN &&
-            ret != QCOW2_CLUSTER_ZERO_ALLOC) {
+        offset = QEMU_ALIGN_DOWN(offset, s->subcluster_size);
+        bytes = s->subcluster_size;
+        nr = s->subcluster_size;
+        ret = qcow2_get_cluster_offset(bs, offset, &nr, &off, &type);
+        if (ret < 0 ||
+            (type != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+             type != QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC &&
+             type != QCOW2_SUBCLUSTER_ZERO_PLAIN &&
+             type != QCOW2_SUBCLUSTER_ZERO_ALLOC)) {
             qemu_co_mutex_unlock(&s->lock);
-            return -ENOTSUP;
+            return ret < 0 ? ret : -ENOTSUP;
         }
     } else {
         qemu_co_mutex_lock(&s->lock);
@@ -3321,17 +3629,20 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
 
     while (bytes != 0) {
         uint64_t copy_offset = 0;
+        QCow2SubclusterType type;
         /* prepare next request */
         cur_bytes = MIN(bytes, INT_MAX);
         cur_write_flags = write_flags;
 
-        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes, &copy_offset);
+        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes, &copy_offset,
+                                       &type);
         if (ret < 0) {
             goto out;
         }
 
-        switch (ret) {
-        case QCOW2_CLUSTER_UNALLOCATED:
+        switch (type) {
+        case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
             if (bs->backing && bs->backing->bs) {
                 int64_t backing_length = bdrv_getlength(bs->backing->bs);
                 if (src_offset >= backing_length) {
@@ -3346,16 +3657,16 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
             }
             break;
 
-        case QCOW2_CLUSTER_ZERO_PLAIN:
-        case QCOW2_CLUSTER_ZERO_ALLOC:
+        case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+        case QCOW2_SUBCLUSTER_ZERO_ALLOC:
             cur_write_flags |= BDRV_REQ_ZERO_WRITE;
             break;
 
-        case QCOW2_CLUSTER_COMPRESSED:
+        case QCOW2_SUBCLUSTER_COMPRESSED:
             ret = -ENOTSUP;
             goto out;
 
-        case QCOW2_CLUSTER_NORMAL:
+        case QCOW2_SUBCLUSTER_NORMAL:
             child = bs->file;
             copy_offset += offset_into_cluster(s, src_offset);
             if ((copy_offset & 511) != 0) {
@@ -3611,7 +3922,7 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
          *  preallocation. All that matters is that we will not have to allocate
          *  new refcount structures for them.) */
         nb_new_l2_tables = DIV_ROUND_UP(nb_new_data_clusters,
-                                        s->cluster_size / sizeof(uint64_t));
+                                        s->cluster_size / l2_entry_size(s));
         /* The cluster range may not be aligned to L2 boundaries, so add one L2
          * table for a potential head/tail */
         nb_new_l2_tables++;
@@ -3661,6 +3972,9 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
                 .offset       = guest_offset,
                 .alloc_offset = host_offset,
                 .nb_clusters  = nb_clusters,
+                .cow_end      = {
+                    .offset   = nb_clusters << s->cluster_bits,
+                },
             };
             qemu_co_queue_init(&allocation.dependent_requests);
 
@@ -3721,7 +4035,7 @@ fail:
 }
 
 /*
- * qcow2_compress()
+ * qcow2_zlib_compress()
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
@@ -3730,8 +4044,8 @@ fail:
  *          -1 destination buffer is not enough to store compressed data
  *          -2 on any other error
  */
-static ssize_t qcow2_compress(void *dest, size_t dest_size,
-                              const void *src, size_t src_size)
+static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
+                                   const void *src, size_t src_size)
 {
     ssize_t ret;
     z_stream strm;
@@ -3764,7 +4078,7 @@ static ssize_t qcow2_compress(void *dest, size_t dest_size,
 }
 
 /*
- * qcow2_decompress()
+ * qcow2_zlib_decompress()
  *
  * Decompress some data (not more than @src_size bytes) to produce exactly
  * @dest_size bytes.
@@ -3775,8 +4089,8 @@ static ssize_t qcow2_compress(void *dest, size_t dest_size,
  * Returns: 0 on success
  *          -1 on fail
  */
-static ssize_t qcow2_decompress(void *dest, size_t dest_size,
-                                const void *src, size_t src_size)
+static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
+                                     const void *src, size_t src_size)
 {
     int ret = 0;
     z_stream strm;
@@ -3805,7 +4119,107 @@ static ssize_t qcow2_decompress(void *dest, size_t dest_size,
     return ret;
 }
 
-#define MAX_COMPRESS_THREADS 4
+#ifdef CONFIG_ZSTD
+/*
+ * qcow2_zstd_compress()
+ *
+ * Compress @src into a single zstd frame.
+ *
+ * @dest - destination buffer, @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: compressed size on success
+ *          -1 destination buffer is not enough to store compressed data
+ *          -2 on any other error
+ */
+static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
+                                   const void *src, size_t src_size)
+{
+    ssize_t ret;
+    size_t zstd_ret;
+    ZSTD_outBuffer output = { .dst = dest, .size = dest_size, .pos = 0 };
+    ZSTD_inBuffer input = { .src = src, .size = src_size, .pos = 0 };
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    if (!cctx) {
+        return -2;
+    }
+
+    /* ZSTD_e_end returns the number of bytes still to be flushed, so loop
+     * until the whole frame is out or we run out of room */
+    do {
+        zstd_ret = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_end);
+        if (ZSTD_isError(zstd_ret)) {
+            ret = ZSTD_getErrorCode(zstd_ret) == ZSTD_error_dstSize_tooSmall ?
+                  -1 : -2;
+            goto out;
+        }
+        if (zstd_ret > output.size - output.pos) {
+            ret = -1;
+            goto out;
+        }
+    } while (zstd_ret);
+
+    ret = output.pos;
+
+out:
+    ZSTD_freeCCtx(cctx);
+    return ret;
+}
+
+/*
+ * qcow2_zstd_decompress()
+ *
+ * Decompress some data (not more than @src_size bytes) to produce exactly
+ * @dest_size bytes.  As with zlib, @src may extend past the end of the
+ * compressed data up to the next sector boundary.
+ *
+ * @dest - destination buffer, @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: 0 on success
+ *          -1 on fail
+ */
+static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
+                                     const void *src, size_t src_size)
+{
+    ssize_t ret = 0;
+    size_t zstd_ret = 0;
+    ZSTD_outBuffer output = { .dst = dest, .size = dest_size, .pos = 0 };
+    ZSTD_inBuffer input = { .src = src, .size = src_size, .pos = 0 };
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+    if (!dctx) {
+        return -1;
+    }
+
+    while (output.pos < output.size) {
+        size_t last_in_pos = input.pos;
+        size_t last_out_pos = output.pos;
+
+        zstd_ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(zstd_ret)) {
+            ret = -1;
+            break;
+        }
+
+        /* Don't spin if the input is truncated and no progress is made */
+        if (last_in_pos >= input.pos && last_out_pos >= output.pos) {
+            ret = -1;
+            break;
+        }
+    }
+
+    /* A frame that is not complete once @dest is full means the compressed
+     * data describes more than one cluster, so it must be corrupted */
+    if (zstd_ret > 0) {
+        ret = -1;
+    }
+
+    ZSTD_freeDCtx(dctx);
+    return ret;
+}
+#endif
 
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
                                      const void *src, size_t src_size);
@@ -3849,7 +4263,7 @@ qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         .func = func,
     };
 
-    while (s->nb_compress_threads >= MAX_COMPRESS_THREADS) {
+    while (s->nb_compress_threads >= s->compress_threads) {
         qemu_co_queue_wait(&s->compress_wait_queue, NULL);
     }
 
@@ -3873,16 +4287,46 @@ static ssize_t coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                   const void *src, size_t src_size)
 {
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size,
-                                qcow2_compress);
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressFunc fn;
+
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        fn = qcow2_zlib_compress;
+        break;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        fn = qcow2_zstd_compress;
+        break;
+#endif
+    default:
+        abort();
+    }
+
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
 }
 
 static ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size)
 {
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size,
-                                qcow2_decompress);
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressFunc fn;
+
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        fn = qcow2_zlib_decompress;
+        break;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        fn = qcow2_zstd_decompress;
+        break;
+#endif
+    default:
+        abort();
+    }
+
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
 }
 
 /* XXX: put compressed sectors first, then all the cluster aligned
@@ -3978,46 +4422,133 @@ fail:
     return ret;
 }
 
+typedef struct Qcow2DecompressBatch {
+    BlockDriverState *bs;
+    Coroutine *co;
+    int in_flight;
+    bool waiting;
+    int ret;
+    uint64_t time_ns;
+} Qcow2DecompressBatch;
+
+typedef struct Qcow2DecompressTask {
+    Qcow2DecompressBatch *batch;
+    void *dest;
+    const void *src;
+    size_t src_size;
+} Qcow2DecompressTask;
+
+static void coroutine_fn qcow2_co_decompress_entry(void *opaque)
+{
+    Qcow2DecompressTask *task = opaque;
+    Qcow2DecompressBatch *batch = task->batch;
+    BDRVQcow2State *s = batch->bs->opaque;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (qcow2_co_decompress(batch->bs, task->dest, s->cluster_size,
+                            task->src, task->src_size) < 0) {
+        batch->ret = -EIO;
+    }
+    batch->time_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+
+    batch->in_flight--;
+    if (batch->in_flight == 0 && batch->waiting) {
+        aio_co_wake(batch->co);
+    }
+}
+
+/*
+ * Read @nb_clusters compressed clusters, whose descriptors are given in
+ * @l2_entries and whose compressed data is stored contiguously in the image
+ * file (see qcow2_get_compressed_batch()), and copy @bytes bytes starting at
+ * guest @offset into @qiov.
+ *
+ * The compressed data is read with a single request and the clusters are
+ * decompressed in parallel in the thread pool.
+ */
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t file_cluster_offset,
+                           const uint64_t *l2_entries,
+                           int nb_clusters,
                            uint64_t offset,
                            uint64_t bytes,
                            QEMUIOVector *qiov)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret = 0, csize, nb_csectors;
-    uint64_t coffset;
+    int ret = 0, csize, i;
+    uint64_t coffset, host_start, host_end;
     uint8_t *buf, *out_buf;
     struct iovec iov;
     QEMUIOVector local_qiov;
     int offset_in_cluster = offset_into_cluster(s, offset);
+    Qcow2DecompressTask tasks[QCOW2_MAX_COMPRESSED_BATCH];
+    Qcow2DecompressBatch batch = {
+        .bs = bs,
+        .co = qemu_coroutine_self(),
+    };
 
-    coffset = file_cluster_offset & s->cluster_offset_mask;
-    nb_csectors = ((file_cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
-    csize = nb_csectors * 512 - (coffset & 511);
+    assert(nb_clusters > 0 && nb_clusters <= QCOW2_MAX_COMPRESSED_BATCH);
 
-    buf = g_try_malloc(csize);
+    qcow2_parse_compressed_l2_entry(s, l2_entries[0], &host_start, &csize);
+    host_end = host_start + csize;
+    for (i = 1; i < nb_clusters; i++) {
+        qcow2_parse_compressed_l2_entry(s, l2_entries[i], &coffset, &csize);
+        host_end = MAX(host_end, coffset + csize);
+    }
+
+    buf = g_try_malloc(host_end - host_start);
     if (!buf) {
         return -ENOMEM;
     }
     iov.iov_base = buf;
-    iov.iov_len = csize;
+    iov.iov_len = host_end - host_start;
     qemu_iovec_init_external(&local_qiov, &iov, 1);
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
+    out_buf = qemu_try_blockalign(bs, (size_t) nb_clusters * s->cluster_size);
+    if (!out_buf) {
+        g_free(buf);
+        return -ENOMEM;
+    }
 
     BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_preadv(bs->file, coffset, csize, &local_qiov, 0);
+    ret = bdrv_co_preadv(bs->file, host_start, host_end - host_start,
+                         &local_qiov, 0);
     if (ret < 0) {
         goto fail;
     }
 
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
+    for (i = 0; i < nb_clusters; i++) {
+        Coroutine *co;
+
+        qcow2_parse_compressed_l2_entry(s, l2_entries[i], &coffset, &csize);
+        tasks[i] = (Qcow2DecompressTask) {
+            .batch      = &batch,
+            .dest       = out_buf + (size_t) i * s->cluster_size,
+            .src        = buf + (coffset - host_start),
+            .src_size   = csize,
+        };
+
+        batch.in_flight++;
+        co = qemu_coroutine_create(qcow2_co_decompress_entry, &tasks[i]);
+        qemu_coroutine_enter(co);
+    }
+
+    while (batch.in_flight > 0) {
+        batch.waiting = true;
+        qemu_coroutine_yield();
+        batch.waiting = false;
+    }
+
+    s->compressed_clusters_read += nb_clusters;
+    s->compressed_bytes_read += host_end - host_start;
+    s->decompress_time_ns += batch.time_ns;
+
+    ret = batch.ret;
+    if (ret < 0) {
         goto fail;
     }
 
+    s->decompressed_bytes += (uint64_t) nb_clusters * s->cluster_size;
     qemu_iovec_from_buf(qiov, 0, out_buf + offset_in_cluster, bytes);
 
 fail:
@@ -4245,9 +4776,14 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     char *optstr;
     PreallocMode prealloc;
     bool has_backing_file;
+    bool extended_l2;
+    size_t l2e_size;
 
     /* Parse image creation options */
-    cluster_size = qcow2_opt_get_cluster_size_del(opts, &local_err);
+    extended_l2 = qemu_opt_get_bool_del(opts, BLOCK_OPT_EXTL2, false);
+
+    cluster_size = qcow2_opt_get_cluster_size_del(opts, extended_l2,
+                                                  &local_err);
     if (local_err) {
         goto err;
     }
@@ -4278,8 +4814,9 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     virtual_size = ROUND_UP(virtual_size, cluster_size);
 
     /* Check that virtual disk size is valid */
+    l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
     l2_tables = DIV_ROUND_UP(virtual_size / cluster_size,
-                             cluster_size / sizeof(uint64_t));
+                             cluster_size / l2e_size);
     if (l2_tables * sizeof(uint64_t) > QCOW_MAX_L1_SIZE) {
         error_setg(&local_err, "The image size is too large "
                                "(try using a larger cluster size)");
@@ -4344,7 +4881,7 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     info = g_new(BlockMeasureInfo, 1);
     info->fully_allocated =
         qcow2_calc_prealloc_size(virtual_size, cluster_size,
-                                 ctz32(refcount_bits));
+                                 ctz32(refcount_bits), extended_l2);
 
     /* Remove data clusters that are not required.  This overestimates the
      * required size because metadata needed for the fully allocated file is
@@ -4386,6 +4923,7 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
         *spec_info->u.qcow2.data = (ImageInfoSpecificQCow2){
             .compat             = g_strdup("0.10"),
             .refcount_bits      = s->refcount_bits,
+            .compression_type   = s->compression_type,
         };
     } else if (s->qcow_version == 3) {
         *spec_info->u.qcow2.data = (ImageInfoSpecificQCow2){
@@ -4396,7 +4934,10 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
             .corrupt            = s->incompatible_features &
                                   QCOW2_INCOMPAT_CORRUPT,
             .has_corrupt        = true,
+            .has_extended_l2    = true,
+            .extended_l2        = has_subclusters(s),
             .refcount_bits      = s->refcount_bits,
+            .compression_type   = s->compression_type,
         };
     } else {
         /* if this assertion fails, this probably means a new version was
@@ -4430,6 +4971,28 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    *stats = (BlockStatsSpecific) {
+        .driver = BLOCKDEV_DRIVER_QCOW2,
+        .u.qcow2 = {
+            .compressed_clusters_read   = s->compressed_clusters_read,
+            .compressed_bytes_read      = s->compressed_bytes_read,
+            .decompressed_bytes         = s->decompressed_bytes,
+            .decompress_time_ns         = s->decompress_time_ns,
+            .has_l2_prefetch_total      = s->l2_prefetch,
+            .l2_prefetch_total          = s->l2_prefetch_total,
+            .has_l2_prefetch_done       = s->l2_prefetch,
+            .l2_prefetch_done           = s->l2_prefetch_done,
+        },
+    };
+
+    return stats;
+}
+
 static int qcow2_save_vmstate(BlockDriverState *bs, QEMUIOVector *qiov,
                               int64_t pos)
 {
@@ -4676,6 +5239,23 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
                            "may not exceed 64 bits");
                 return -EINVAL;
             }
+        } else if (!strcmp(desc->name, BLOCK_OPT_EXTL2)) {
+            if (qemu_opt_get_bool(opts, BLOCK_OPT_EXTL2, has_subclusters(s)) !=
+                has_subclusters(s)) {
+                error_setg(errp, "Changing the extended L2 entries setting is "
+                           "not supported");
+                return -ENOTSUP;
+            }
+        } else if (!strcmp(desc->name, BLOCK_OPT_COMPRESSION_TYPE)) {
+            const char *compression_type =
+                qemu_opt_get(opts, BLOCK_OPT_COMPRESSION_TYPE);
+            if (compression_type &&
+                strcmp(compression_type,
+                       Qcow2CompressionType_str(s->compression_type))) {
+                error_setg(errp, "Changing the compression type is not "
+                           "supported");
+                return -ENOTSUP;
+            }
         } else {
             /* if this point is reached, this probably means a new option was
              * added without having it covered here */
@@ -4912,6 +5492,18 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Width of a reference count entry in bits",
             .def_value_str = "16"
         },
+        {
+            .name = BLOCK_OPT_EXTL2,
+            .type = QEMU_OPT_BOOL,
+            .help = "Extended L2 tables (subcluster allocation)",
+            .def_value_str = "off"
+        },
+        {
+            .name = BLOCK_OPT_COMPRESSION_TYPE,
+            .type = QEMU_OPT_STRING,
+            .help = "Compression method used for image cluster compression",
+            .def_value_str = "zlib"
+        },
         { /* end of list */ }
     }
 };
@@ -4952,6 +5544,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -4969,6 +5562,8 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_detach_aio_context  = qcow2_detach_aio_context,
     .bdrv_attach_aio_context  = qcow2_attach_aio_context,
+    .bdrv_co_drain_begin      = qcow2_co_drain_begin,
+    .bdrv_co_drain_end        = qcow2_co_drain_end,
 
     .bdrv_reopen_bitmaps_rw = qcow2_reopen_bitmaps_rw,
     .bdrv_can_store_new_dirty_bitmap = qcow2_can_store_new_dirty_bitmap,
@@ -78,6 +78,8 @@ int64_t max_advance;
 /* vcpu throttling controls */
 static QEMUTimer *throttle_timer;
 static unsigned int throttle_percentage;
+/* Period of throttle_timer, only accessed with the BQL held */
+static int64_t throttle_period_ns;
 
 #define CPU_THROTTLE_PCT_MIN 1
 #define CPU_THROTTLE_PCT_MAX 99
@@ -229,6 +231,25 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+    if (qemu_opt_get_bool(opts, "tiered", false)) {
+#ifndef TARGET_SUPPORTS_TCG_TRACES
+        error_setg(errp, "Guest does not support tiered translation");
+        return;
+#endif
+        if (use_icount) {
+            error_setg(errp, "No tiered translation when icount is enabled");
+            return;
+        }
+        tcg_tiered = true;
+    }
+
+    if (qemu_opt_get(opts, "tlb-min-bits") ||
+        qemu_opt_get(opts, "tlb-max-bits")) {
+        tlb_set_size_bits(qemu_opt_get_number(opts, "tlb-min-bits", 0),
+                          qemu_opt_get_number(opts, "tlb-max-bits", 0),
+                          errp);
+    }
 }
 
 /* The current number of executed instructions is based on what we
@@ -770,19 +791,29 @@ static const VMStateDescription vmstate_timers = {
     }
 };
 
+static int cpu_throttle_clamp(int pct)
+{
+    /* Ensure throttle percentage is within valid range */
+    pct = MIN(pct, CPU_THROTTLE_PCT_MAX);
+    return MAX(pct, CPU_THROTTLE_PCT_MIN);
+}
+
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
     double pct;
-    double throttle_ratio;
     long sleeptime_ns;
 
-    if (!cpu_throttle_get_percentage()) {
+    pct = (double)cpu_throttle_get_vcpu_percentage(cpu) / 100;
+    if (!pct) {
+        atomic_set(&cpu->throttle_thread_scheduled, 0);
         return;
     }
 
-    pct = (double)cpu_throttle_get_percentage()/100;
-    throttle_ratio = pct / (1 - pct);
-    sleeptime_ns = (long)(throttle_ratio * CPU_THROTTLE_TIMESLICE_NS);
+    /* Sleep for the throttled share of the period of the timer, which is
+     * sized after the most throttled vCPU.  With a single percentage this
+     * is pct / (1 - pct) time slices.
+     */
+    sleeptime_ns = (long)(pct * throttle_period_ns);
 
     qemu_mutex_unlock_iothread();
     g_usleep(sleeptime_ns / 1000); /* Convert ns to us for usleep call */
@@ -793,31 +824,50 @@ static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 static void cpu_throttle_timer_tick(void *opaque)
 {
     CPUState *cpu;
+    int max_pct = 0;
     double pct;
 
+    CPU_FOREACH(cpu) {
+        max_pct = MAX(max_pct, cpu_throttle_get_vcpu_percentage(cpu));
+    }
+
     /* Stop the timer if needed */
-    if (!cpu_throttle_get_percentage()) {
+    if (!max_pct) {
         return;
     }
+
+    pct = (double)max_pct / 100;
+    throttle_period_ns = CPU_THROTTLE_TIMESLICE_NS / (1 - pct);
+
     CPU_FOREACH(cpu) {
-        if (!atomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
+        if (cpu_throttle_get_vcpu_percentage(cpu) &&
+            !atomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
             async_run_on_cpu(cpu, cpu_throttle_thread,
                              RUN_ON_CPU_NULL);
         }
     }
 
-    pct = (double)cpu_throttle_get_percentage()/100;
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
-                                   CPU_THROTTLE_TIMESLICE_NS / (1-pct));
+                                   throttle_period_ns);
 }
 
 void cpu_throttle_set(int new_throttle_pct)
 {
-    /* Ensure throttle percentage is within valid range */
-    new_throttle_pct = MIN(new_throttle_pct, CPU_THROTTLE_PCT_MAX);
-    new_throttle_pct = MAX(new_throttle_pct, CPU_THROTTLE_PCT_MIN);
+    atomic_set(&throttle_percentage, cpu_throttle_clamp(new_throttle_pct));
+
+    timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                       CPU_THROTTLE_TIMESLICE_NS);
+}
+
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct)
+{
+    if (!new_throttle_pct) {
+        atomic_set(&cpu->throttle_percentage, 0);
+        return;
+    }
 
-    atomic_set(&throttle_percentage, new_throttle_pct);
+    atomic_set(&cpu->throttle_percentage,
+               cpu_throttle_clamp(new_throttle_pct));
 
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
                                        CPU_THROTTLE_TIMESLICE_NS);
@@ -825,12 +875,29 @@ void cpu_throttle_set(int new_throttle_pct)
 
 void cpu_throttle_stop(void)
 {
+    CPUState *cpu;
+
     atomic_set(&throttle_percentage, 0);
+
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        atomic_set(&cpu->throttle_percentage, 0);
+    }
+    rcu_read_unlock();
 }
 
 bool cpu_throttle_active(void)
 {
-    return (cpu_throttle_get_percentage() != 0);
+    CPUState *cpu;
+    bool active = cpu_throttle_get_percentage() != 0;
+
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        active |= atomic_read(&cpu->throttle_percentage) != 0;
+    }
+    rcu_read_unlock();
+
+    return active;
 }
 
 int cpu_throttle_get_percentage(void)
@@ -838,6 +905,12 @@ int cpu_throttle_get_percentage(void)
     return atomic_read(&throttle_percentage);
 }
 
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu)
+{
+    return MAX(cpu_throttle_get_percentage(),
+               atomic_read(&cpu->throttle_percentage));
+}
+
 void cpu_ticks_init(void)
 {
     seqlock_init(&timers_state.vm_clock_seqlock);
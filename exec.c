@@ -60,6 +60,7 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "exec/tcg-dirty-ring.h"
 #include "exec/log.h"
 
 #include "migration/vmstate.h"
@@ -917,6 +918,7 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     CPUClass *cc = CPU_GET_CLASS(cpu);
 
     cpu_list_remove(cpu);
+    tlb_destroy(cpu);
 
     if (cc->vmsd != NULL) {
         vmstate_unregister(NULL, cc->vmsd, cpu);
@@ -926,6 +928,9 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     }
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_free_notifier_list(cpu);
+    if (tcg_dirty_ring_enabled()) {
+        tcg_dirty_ring_free(cpu);
+    }
 #endif
 }
 
@@ -2665,20 +2670,36 @@ void memory_notdirty_write_prepare(NotDirtyInfo *ndi,
 /* Called within RCU critical section. */
 void memory_notdirty_write_complete(NotDirtyInfo *ndi)
 {
+    uint8_t clients = DIRTY_CLIENTS_NOCODE;
+    bool pushed = false;
+
     if (ndi->pages) {
         assert(tcg_enabled());
         page_collection_unlock(ndi->pages);
         ndi->pages = NULL;
     }
 
+    /* With dirty rings, the migration bit is only set when the ring
+     * is harvested.
+     */
+    if (tcg_dirty_ring_enabled() &&
+        !cpu_physical_memory_get_dirty_flag(ndi->ram_addr,
+                                            DIRTY_MEMORY_MIGRATION)) {
+        tcg_dirty_ring_push(ndi->cpu, ndi->ram_addr);
+        clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
+        pushed = true;
+    }
+
     /* Set both VGA and migration bits for simplicity and to remove
      * the notdirty callback faster.
      */
-    cpu_physical_memory_set_dirty_range(ndi->ram_addr, ndi->size,
-                                        DIRTY_CLIENTS_NOCODE);
+    cpu_physical_memory_set_dirty_range(ndi->ram_addr, ndi->size, clients);
     /* we remove the notdirty callback only if the code has been
-       flushed */
-    if (!cpu_physical_memory_is_clean(ndi->ram_addr)) {
+       flushed; a page sitting in a dirty ring counts as dirty for
+       migration, so that it is only pushed once */
+    if (pushed ? cpu_physical_memory_get_dirty_flag(ndi->ram_addr,
+                                                    DIRTY_MEMORY_CODE)
+               : !cpu_physical_memory_is_clean(ndi->ram_addr)) {
         tlb_set_dirty(ndi->cpu, ndi->mem_vaddr);
     }
 }
@@ -594,6 +594,20 @@ STEXI
 @item info migrate_cache_size
 @findex info migrate_cache_size
 Show current migration xbzrle cache size.
+ETEXI
+
+    {
+        .name       = "dirty_rate",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the last dirty rate measurement",
+        .cmd        = hmp_info_dirty_rate,
+    },
+
+STEXI
+@item info dirty_rate
+@findex info dirty_rate
+Show the last dirty rate measurement, for the whole guest and for each vCPU.
 ETEXI
 
     {
@@ -1039,6 +1039,22 @@ STEXI
 @item migrate_set_cache_size @var{value}
 @findex migrate_set_cache_size
 Set cache size to @var{value} (in bytes) for xbzrle migrations.
+ETEXI
+
+    {
+        .name       = "calc_dirty_rate",
+        .args_type  = "calc_time:i",
+        .params     = "calc_time",
+        .help       = "measure the dirty rate of the guest and of each vCPU"
+                      " for calc_time seconds",
+        .cmd        = hmp_calc_dirty_rate,
+    },
+
+STEXI
+@item calc_dirty_rate @var{calc_time}
+@findex calc_dirty_rate
+Measure the dirty rate of the guest and of each vCPU for @var{calc_time}
+seconds, in the background.  The result is shown by @code{info dirty_rate}.
 ETEXI
 
     {
@@ -38,6 +38,7 @@
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-tpm.h"
 #include "qapi/qapi-commands-ui.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/string-input-visitor.h"
@@ -236,6 +237,16 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
                        info->ram->multifd_bytes >> 10);
+        if (info->ram->dirty_sync_missed_zero_copy) {
+            monitor_printf(mon, "dirty sync missed zero copy: %" PRIu64 "\n",
+                           info->ram->dirty_sync_missed_zero_copy);
+        }
+        if (info->ram->dirty_log_clear_count) {
+            monitor_printf(mon, "dirty log clear count: %" PRIu64 "\n",
+                           info->ram->dirty_log_clear_count);
+            monitor_printf(mon, "dirty log clear time: %" PRIu64 " us\n",
+                           info->ram->dirty_log_clear_time);
+        }
 
         if (info->ram->dirty_pages_rate) {
             monitor_printf(mon, "dirty pages rate: %" PRIu64 " pages\n",
@@ -269,6 +280,12 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->cache_miss_rate);
         monitor_printf(mon, "xbzrle overflow : %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache hit: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_hit);
+        monitor_printf(mon, "xbzrle cache hit rate: %0.2f\n",
+                       info->xbzrle_cache->cache_hit_rate);
+        monitor_printf(mon, "xbzrle cache eviction: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_eviction);
     }
 
     if (info->has_compression) {
@@ -284,6 +301,20 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->compression->compression_rate);
     }
 
+    if (info->has_multifd_channels) {
+        MultiFDChannelStatsList *c;
+
+        for (c = info->multifd_channels; c; c = c->next) {
+            monitor_printf(mon, "multifd channel %" PRId64 ": "
+                           "packets: %" PRIu64 " pages: %" PRIu64
+                           " bytes: %" PRIu64 " compression rate: %0.2f"
+                           " compression mbps: %0.2f\n",
+                           c->value->id, c->value->packets, c->value->pages,
+                           c->value->bytes, c->value->compression_rate,
+                           c->value->compression_mbps);
+        }
+    }
+
     if (info->has_cpu_throttle_percentage) {
         monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
                        info->cpu_throttle_percentage);
@@ -304,6 +335,23 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+
+    if (info->has_postcopy_fault_latency) {
+        PostcopyFaultLatency *lat = info->postcopy_fault_latency;
+        Visitor *v;
+        char *str;
+
+        monitor_printf(mon, "postcopy page requests: %" PRIu64
+                       " served: %" PRIu64 "\n", lat->requests, lat->served);
+        monitor_printf(mon, "postcopy fault latency: average %" PRIu64
+                       " us max %" PRIu64 " us\n", lat->average, lat->max);
+        v = string_output_visitor_new(false, &str);
+        visit_type_uint64List(v, NULL, &lat->histogram, NULL);
+        visit_complete(v, &str);
+        monitor_printf(mon, "postcopy fault latency histogram: %s\n", str);
+        g_free(str);
+        visit_free(v);
+    }
     qapi_free_MigrationInfo(info);
     qapi_free_MigrationCapabilityStatusList(caps);
 }
@@ -390,6 +438,14 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_PAGE_COUNT),
             params->x_multifd_page_count);
+        assert(params->has_multifd_compression);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_COMPRESSION),
+            MultiFDCompression_str(params->multifd_compression));
+        assert(params->has_postcopy_prefetch_pages);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -407,6 +463,31 @@ void hmp_info_migrate_cache_size(Monitor *mon, const QDict *qdict)
                    qmp_query_migrate_cache_size(NULL) >> 10);
 }
 
+void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
+{
+    DirtyRateInfo *info = qmp_query_dirty_rate(NULL);
+    DirtyRateVcpuList *vcpu;
+
+    monitor_printf(mon, "Status: %s\n",
+                   DirtyRateStatus_str(info->status));
+    if (info->status != DIRTY_RATE_STATUS_UNSTARTED) {
+        monitor_printf(mon, "Start time: %" PRId64 " s\n", info->start_time);
+        monitor_printf(mon, "Calc time: %" PRId64 " s\n", info->calc_time);
+    }
+    if (info->has_dirty_rate) {
+        monitor_printf(mon, "Dirty rate: %" PRId64 " MB/s\n",
+                       info->dirty_rate);
+    }
+    for (vcpu = info->vcpu_dirty_rate; vcpu; vcpu = vcpu->next) {
+        monitor_printf(mon, "  CPU #%" PRId64 ": %" PRId64
+                       " MB/s, throttled %" PRId64 "%%\n",
+                       vcpu->value->id, vcpu->value->dirty_rate,
+                       vcpu->value->throttle_percentage);
+    }
+
+    qapi_free_DirtyRateInfo(info);
+}
+
 void hmp_info_cpus(Monitor *mon, const QDict *qdict)
 {
     CpuInfoFastList *cpu_list, *cpu;
@@ -1619,6 +1700,15 @@ void hmp_migrate_set_cache_size(Monitor *mon, const QDict *qdict)
     hmp_handle_error(mon, &err);
 }
 
+void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
+{
+    int64_t calc_time = qdict_get_int(qdict, "calc_time");
+    Error *err = NULL;
+
+    qmp_calc_dirty_rate(calc_time, &err);
+    hmp_handle_error(mon, &err);
+}
+
 /* Kept for backwards compatibility */
 void hmp_migrate_set_speed(Monitor *mon, const QDict *qdict)
 {
@@ -1741,6 +1831,15 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_x_multifd_page_count = true;
         visit_type_int(v, param, &p->x_multifd_page_count, &err);
         break;
+    case MIGRATION_PARAMETER_MULTIFD_COMPRESSION:
+        p->has_multifd_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->multifd_compression,
+                                      &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_int(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         visit_type_size(v, param, &cache_size, &err);
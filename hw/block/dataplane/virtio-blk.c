@@ -42,12 +42,22 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /* With the iothreads property, virtqueue i is processed by
+     * iothreads[i % num_iothreads]; the BlockBackend's home context @ctx is
+     * the one of iothreads[0].  Otherwise all virtqueues use @ctx.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    AioContext **vq_ctx;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
-    if (s->batch_notifications) {
+    /* batch_notify_vqs is only touched from the home context, so completions
+     * coming from other iothreads notify the guest directly */
+    if (s->batch_notifications && s->num_iothreads <= 1) {
         set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
@@ -79,6 +89,69 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+/* The AioContext in which requests from @vq are processed and completed */
+AioContext *virtio_blk_data_plane_get_aio_context(VirtIOBlockDataPlane *s,
+                                                  VirtQueue *vq)
+{
+    return s->vq_ctx[virtio_get_queue_index(vq)];
+}
+
+/* bdrv_drained_begin() only quiesces the home context; stop the other
+ * iothreads from picking up new requests as well.
+ *
+ * Context: QEMU global mutex held
+ */
+void virtio_blk_data_plane_drained_begin(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_disable_external(iothread_get_aio_context(s->iothreads[i]));
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_blk_data_plane_drained_end(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_enable_external(iothread_get_aio_context(s->iothreads[i]));
+    }
+}
+
+/* Requests from several iothreads may only complete in the thread that
+ * submitted them, which rules out everything that moves them elsewhere.
+ * blk_set_multiqueue() checks the BlockBackend and its node graph, and
+ * later graph changes that would break multiqueue are refused. */
+static bool virtio_blk_data_plane_check_multiqueue(VirtIOBlkConf *conf,
+                                                   Error **errp)
+{
+    BlockBackend *blk = conf->conf.blk;
+    BlockdevOnError rerror = blk_get_on_error(blk, true);
+    BlockdevOnError werror = blk_get_on_error(blk, false);
+
+    if (conf->iothread) {
+        error_setg(errp, "iothread and iothreads are mutually exclusive");
+        return false;
+    }
+    if (conf->num_iothreads > conf->num_queues) {
+        error_setg(errp, "more iothreads (%" PRIu32 ") than queues (%"
+                   PRIu16 ")", conf->num_iothreads, conf->num_queues);
+        return false;
+    }
+    if (conf->num_iothreads == 1) {
+        return true;
+    }
+    if (rerror == BLOCKDEV_ON_ERROR_STOP || rerror == BLOCKDEV_ON_ERROR_ENOSPC ||
+        werror == BLOCKDEV_ON_ERROR_STOP || werror == BLOCKDEV_ON_ERROR_ENOSPC) {
+        error_setg(errp, "multiple iothreads require rerror and werror to "
+                   "be 'report' or 'ignore'");
+        return false;
+    }
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -87,10 +160,16 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->num_iothreads &&
+        !virtio_blk_data_plane_check_multiqueue(conf, errp)) {
+        return false;
+    }
+
+    if (conf->iothread || conf->num_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -119,16 +198,46 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
+    if (conf->num_iothreads) {
+        s->iothreads = g_new0(IOThread *, conf->num_iothreads);
+        for (i = 0; i < conf->num_iothreads; i++) {
+            IOThread *iothread = iothread_by_id(conf->iothreads[i]);
+
+            if (!iothread) {
+                error_setg(errp, "iothread '%s' not found",
+                           conf->iothreads[i] ?: "");
+                virtio_blk_data_plane_destroy(s);
+                return false;
+            }
+            object_ref(OBJECT(iothread));
+            s->iothreads[s->num_iothreads++] = iothread;
+        }
+        s->iothread = s->iothreads[0];
+        object_ref(OBJECT(s->iothread));
+        s->ctx = iothread_get_aio_context(s->iothread);
+    } else if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+    s->vq_ctx = g_new(AioContext *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        s->vq_ctx[i] = s->num_iothreads ?
+            iothread_get_aio_context(s->iothreads[i % s->num_iothreads]) :
+            s->ctx;
+    }
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
+    /* Let each iothread submit requests in its own AioContext */
+    if (s->num_iothreads > 1 &&
+        blk_set_multiqueue(conf->conf.blk, true, errp) < 0) {
+        virtio_blk_data_plane_destroy(s);
+        return false;
+    }
+
     *dataplane = s;
 
     return true;
@@ -138,6 +247,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -145,8 +255,18 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
+    if (s->num_iothreads > 1) {
+        blk_set_multiqueue(s->conf->conf.blk, false, &error_abort);
+    }
     g_free(s->batch_notify_vqs);
-    qemu_bh_delete(s->bh);
+    if (s->bh) {
+        qemu_bh_delete(s->bh);
+    }
+    g_free(s->vq_ctx);
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
@@ -222,14 +342,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(s->vq_ctx[i]);
+        virtio_queue_aio_set_host_notifier_handler(vq, s->vq_ctx[i],
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(s->vq_ctx[i]);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -246,12 +366,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vq_ctx[i] == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
+        }
     }
 }
 
@@ -278,6 +401,14 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 1; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
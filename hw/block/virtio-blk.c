@@ -28,6 +28,15 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Requests from @vq are processed and completed in this AioContext */
+static AioContext *virtio_blk_get_aio_context(VirtIOBlock *s, VirtQueue *vq)
+{
+    if (s->dataplane_started && !s->dataplane_disabled) {
+        return virtio_blk_data_plane_get_aio_context(s->dataplane, vq);
+    }
+    return blk_get_aio_context(s->conf.conf.blk);
+}
+
 static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
                                     VirtIOBlockReq *req)
 {
@@ -88,8 +97,9 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
     VirtIOBlockReq *next = opaque;
     VirtIOBlock *s = next->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    AioContext *ctx = virtio_blk_get_aio_context(s, next->vq);
 
-    aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_acquire(ctx);
     while (next) {
         VirtIOBlockReq *req = next;
         next = req->mr_next;
@@ -122,15 +132,16 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
         block_acct_done(blk_get_stats(req->dev->blk), &req->acct);
         virtio_blk_free_request(req);
     }
-    aio_context_release(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_release(ctx);
 }
 
 static void virtio_blk_flush_complete(void *opaque, int ret)
 {
     VirtIOBlockReq *req = opaque;
     VirtIOBlock *s = req->dev;
+    AioContext *ctx = virtio_blk_get_aio_context(s, req->vq);
 
-    aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_acquire(ctx);
     if (ret) {
         if (virtio_blk_handle_rw_error(req, -ret, 0)) {
             goto out;
@@ -142,7 +153,7 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
     virtio_blk_free_request(req);
 
 out:
-    aio_context_release(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_release(ctx);
 }
 
 #ifdef __linux__
@@ -158,6 +169,7 @@ static void virtio_blk_ioctl_complete(void *opaque, int status)
     VirtIOBlockReq *req = ioctl_req->req;
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    AioContext *ctx;
     struct virtio_scsi_inhdr *scsi;
     struct sg_io_hdr *hdr;
 
@@ -189,10 +201,11 @@ static void virtio_blk_ioctl_complete(void *opaque, int status)
     virtio_stl_p(vdev, &scsi->data_len, hdr->dxfer_len);
 
 out:
-    aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
+    ctx = virtio_blk_get_aio_context(s, req->vq);
+    aio_context_acquire(ctx);
     virtio_blk_req_complete(req, status);
     virtio_blk_free_request(req);
-    aio_context_release(blk_get_aio_context(s->conf.conf.blk));
+    aio_context_release(ctx);
     g_free(ioctl_req);
 }
 
@@ -596,9 +609,14 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     VirtIOBlockReq *req;
     MultiReqBuffer mrb = {};
     bool progress = false;
+    AioContext *ctx = virtio_blk_get_aio_context(s, vq);
+    /* The plug counter of the BlockDriverState is shared by all threads */
+    bool plug = !blk_get_multiqueue(s->blk);
 
-    aio_context_acquire(blk_get_aio_context(s->blk));
-    blk_io_plug(s->blk);
+    aio_context_acquire(ctx);
+    if (plug) {
+        blk_io_plug(s->blk);
+    }
 
     do {
         virtio_queue_set_notification(vq, 0);
@@ -619,8 +637,10 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         virtio_blk_submit_multireq(s->blk, &mrb);
     }
 
-    blk_io_unplug(s->blk);
-    aio_context_release(blk_get_aio_context(s->blk));
+    if (plug) {
+        blk_io_unplug(s->blk);
+    }
+    aio_context_release(ctx);
     return progress;
 }
 
@@ -903,8 +923,28 @@ static void virtio_blk_resize(void *opaque)
     virtio_notify_config(vdev);
 }
 
+static void virtio_blk_drained_begin(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    if (s->dataplane) {
+        virtio_blk_data_plane_drained_begin(s->dataplane);
+    }
+}
+
+static void virtio_blk_drained_end(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    if (s->dataplane) {
+        virtio_blk_data_plane_drained_end(s->dataplane);
+    }
+}
+
 static const BlockDevOps virtio_block_ops = {
     .resize_cb = virtio_blk_resize,
+    .drained_begin = virtio_blk_drained_begin,
+    .drained_end = virtio_blk_drained_end,
 };
 
 static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
@@ -1024,6 +1064,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 128),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_ARRAY("iothreads", VirtIOBlock, conf.num_iothreads,
+                      conf.iothreads, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
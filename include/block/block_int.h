@@ -56,6 +56,8 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_EXTL2             "extended_l2"
+#define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -83,6 +85,21 @@ typedef struct BdrvTrackedRequest {
     struct BdrvTrackedRequest *waiting_for;
 } BdrvTrackedRequest;
 
+/* A discard or write zeroes request that takes part in coalescing */
+typedef struct BdrvCoalescedReq {
+    int64_t offset;
+    int bytes;
+    BdrvRequestFlags flags;
+    bool is_discard;
+
+    /* Set by the request that this one was merged into when it completes */
+    bool done;
+    int ret;
+
+    QLIST_ENTRY(BdrvCoalescedReq) list;
+    QLIST_HEAD(, BdrvCoalescedReq) merged; /* requests merged into this one */
+} BdrvCoalescedReq;
+
 struct BlockDriver {
     const char *format_name;
     int instance_size;
@@ -118,6 +135,13 @@ struct BlockDriver {
     /* Set if a driver can support backing files */
     bool supports_backing;
 
+    /*
+     * Set if the driver copes with requests that are submitted from several
+     * AioContexts at the same time, see blk_set_multiqueue().  Drivers with
+     * per-node state such as a CoMutex or metadata caches must not set it.
+     */
+    bool supports_multiqueue;
+
     /* For handling image reopen for split or non-split files */
     int (*bdrv_reopen_prepare)(BDRVReopenState *reopen_state,
                                BlockReopenQueue *queue, Error **errp);
@@ -320,6 +344,7 @@ struct BlockDriver {
                                   Error **errp);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs);
+    BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
 
     int coroutine_fn (*bdrv_save_vmstate)(BlockDriverState *bs,
                                           QEMUIOVector *qiov,
@@ -633,6 +658,12 @@ struct BdrvChildRole {
     void (*attach)(BdrvChild *child);
     void (*detach)(BdrvChild *child);
 
+    /* Returns whether the parent submits requests to the child from several
+     * AioContexts at the same time. Only nodes for which
+     * bdrv_supports_multiqueue() is true may be attached below such a
+     * parent. */
+    bool (*get_multiqueue)(BdrvChild *child);
+
     /* Notifies the parent that the filename of its child has changed (e.g.
      * because the direct child was removed from the backing chain), so that it
      * can update its reference. */
@@ -782,6 +813,13 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /* Discard and write zeroes requests submitted to this node, and how many
+     * of them were merged into another request before reaching the driver */
+    Stat64 discard_requests;
+    Stat64 discard_merged;
+    Stat64 zero_requests;
+    Stat64 zero_merged;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -813,6 +851,11 @@ struct BlockDriverState {
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
+    /* Coalescable requests that have not been dispatched yet, and the number
+     * of dispatched ones that are still in flight */
+    QLIST_HEAD(, BdrvCoalescedReq) coalesced_reqs;
+    unsigned int coalesce_in_flight;
+    CoQueue coalesce_queue;               /* Requests merged into others */
 
     /* Only read/written by whoever has set active_flush_req to true.  */
     unsigned int flushed_gen;             /* Flushed write generation */
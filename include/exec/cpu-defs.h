@@ -67,6 +67,30 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/*
+ * The TLB of each MMU mode is resized on flush, between
+ * 1 << tlb-min-bits and 1 << tlb-max-bits entries (see -accel tcg).
+ * CPU_TLB_DYN_MIN_BITS and CPU_TLB_DYN_MAX_BITS bound those options.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+
+# if HOST_LONG_BITS == 32
+/* Make sure we do not require a double-word shift for the TLB load */
+#  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+# else
+/*
+ * With 4k pages, 1 << 22 entries cover 16G of address space, which is in
+ * line with the second level TLB of current hosts.  There is no point in
+ * sizing the TLB past the guest's address space either.
+ */
+#  define CPU_TLB_DYN_MAX_BITS \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+# endif
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -99,6 +123,8 @@ typedef uint64_t target_ulong;
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
        bit TARGET_PAGE_BITS-1..4  : Nonzero for accesses that should not
@@ -152,6 +178,12 @@ typedef struct CPUTLBDesc {
     target_ulong large_page_mask;
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
+    /* Host time (in ns) at the beginning of the resize window.  */
+    int64_t window_begin_ns;
+    /* Maximum number of used entries observed in the window.  */
+    size_t window_max_entries;
+    /* Number of valid entries in tlb_table.  */
+    size_t n_used_entries;
 } CPUTLBDesc;
 
 /*
@@ -174,6 +206,14 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /*
+     * Misses of the main tlb, split between those that were served by
+     * the victim tlb and those that needed a tlb_fill, and the number
+     * of times a tlb was resized.
+     */
+    size_t vtlb_hit_count;
+    size_t fill_count;
+    size_t resize_count;
 } CPUTLBCommon;
 
 /*
@@ -181,6 +221,21 @@ typedef struct CPUTLBCommon {
  * Note that NB_MMU_MODES is not yet defined; we can only reference it
  * within preprocessor defines that will be expanded later.
  */
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/*
+ * tlb_mask and tlb_table are loaded by the TCG fast path; keep them first
+ * so that their offsets from env stay small.  tlb_mask[i] is
+ * (number of entries - 1) << CPU_TLB_ENTRY_BITS.
+ */
+#define CPU_COMMON_TLB \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUTLBCommon tlb_c;                                                 \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];                                 \
+    CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];
+#else
 #define CPU_COMMON_TLB \
     CPUTLBCommon tlb_c;                                                 \
     CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
@@ -188,6 +243,7 @@ typedef struct CPUTLBCommon {
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];
+#endif
 
 #else
 
@@ -24,5 +24,6 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+void tlb_miss_counts(size_t *vhit, size_t *fill, size_t *resize);
 #endif
 #endif
@@ -104,6 +104,23 @@ void cpu_address_space_init(CPUState *cpu, int asidx,
  * @cpu: CPU whose TLB should be initialized
  */
 void tlb_init(CPUState *cpu);
+/**
+ * tlb_destroy - destroy a CPU's TLB
+ * @cpu: CPU whose TLB should be destroyed
+ */
+void tlb_destroy(CPUState *cpu);
+/**
+ * tlb_set_size_bits:
+ * @min_bits: log2 of the minimum number of entries of each TLB, 0 for
+ *            the default
+ * @max_bits: log2 of the maximum number of entries of each TLB, 0 for
+ *            the default
+ * @errp: pointer to error object
+ *
+ * Set the bounds within which the TLBs are resized.  Must be called
+ * before any CPU is created.
+ */
+void tlb_set_size_bits(unsigned min_bits, unsigned max_bits, Error **errp);
 /**
  * tlb_flush_page:
  * @cpu: CPU whose TLB should be flushed
@@ -266,6 +283,13 @@ void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
 static inline void tlb_init(CPUState *cpu)
 {
 }
+static inline void tlb_destroy(CPUState *cpu)
+{
+}
+static inline void tlb_set_size_bits(unsigned min_bits, unsigned max_bits,
+                                     Error **errp)
+{
+}
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
@@ -351,6 +375,8 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_TIERED      0x00100000 /* Count executions, retranslate when hot */
+#define CF_TRACE       0x00200000 /* Hot trace spanning several blocks */
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
     (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL)
@@ -358,6 +384,15 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Executions of a CF_TIERED or CF_TRACE TB, updated by the generated
+       code without atomics, and side exits taken out of a CF_TRACE TB */
+    uint32_t exec_count;
+    uint32_t exit_count;
+    /* Executions of a CF_TIERED TB that took the branch ending it */
+    uint32_t taken_count;
+    /* Number of guest blocks translated into a CF_TRACE TB */
+    uint16_t trace_blocks;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -405,6 +440,12 @@ struct TranslationBlock {
 };
 
 extern bool parallel_cpus;
+extern bool tcg_tiered;
+
+/* Executions of a CF_TIERED TB before it is retranslated as a trace */
+#define TB_TRACE_THRESHOLD 1000
+/* Maximum number of guest blocks in a trace */
+#define TB_TRACE_MAX_BLOCKS 8
 
 /* Hide the atomic_read to make code a little easier on the eyes */
 static inline uint32_t tb_cflags(const TranslationBlock *tb)
@@ -428,6 +469,7 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs);
 #endif
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+void tb_promote(CPUState *cpu, TranslationBlock *tb);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask);
@@ -11,6 +11,30 @@ static inline void gen_tb_start(TranslationBlock *tb)
 {
     TCGv_i32 count, imm;
 
+    if (tb_cflags(tb) & CF_TRACE) {
+        /* Looping back to the start of a trace counts one more execution
+           and checks for exit requests again */
+        tcg_ctx->trace_loop_label = gen_new_label();
+        gen_set_label(tcg_ctx->trace_loop_label);
+    }
+
+    if (tb_cflags(tb) & (CF_TIERED | CF_TRACE)) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+
+        count = tcg_temp_new_i32();
+        tcg_gen_ld_i32(count, ptr, 0);
+        tcg_gen_addi_i32(count, count, 1);
+        tcg_gen_st_i32(count, ptr, 0);
+        tcg_temp_free_ptr(ptr);
+
+        if (tb_cflags(tb) & CF_TIERED) {
+            tcg_ctx->hot_label = gen_new_label();
+            tcg_gen_brcondi_i32(TCG_COND_EQ, count, TB_TRACE_THRESHOLD,
+                                tcg_ctx->hot_label);
+        }
+        tcg_temp_free_i32(count);
+    }
+
     tcg_ctx->exitreq_label = gen_new_label();
     if (tb_cflags(tb) & CF_USE_ICOUNT) {
         count = tcg_temp_local_new_i32();
@@ -53,6 +77,11 @@ static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
 
     gen_set_label(tcg_ctx->exitreq_label);
     tcg_gen_exit_tb(tb, TB_EXIT_REQUESTED);
+
+    if (tb_cflags(tb) & CF_TIERED) {
+        gen_set_label(tcg_ctx->hot_label);
+        tcg_gen_exit_tb(tb, TB_EXIT_HOT);
+    }
 }
 
 static inline void gen_io_start(void)
@@ -126,6 +126,11 @@ typedef struct IOMMUNotifier IOMMUNotifier;
 /* RAM is a persistent kind memory */
 #define RAM_PMEM (1 << 5)
 
+/* RAM is registered with userfaultfd in write protect mode
+ * (Set during background snapshots)
+ */
+#define RAM_UF_WRITEPROTECT (1 << 6)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
@@ -414,6 +419,9 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /* Used instead of log_sync by listeners that can only sync everything */
+    void (*log_sync_global)(MemoryListener *listener);
+    void (*log_clear)(MemoryListener *listener, MemoryRegionSection *section);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
     void (*eventfd_add)(MemoryListener *listener, MemoryRegionSection *section,
@@ -1344,6 +1352,23 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr,
 void memory_region_reset_dirty(MemoryRegion *mr, hwaddr addr,
                                hwaddr size, unsigned client);
 
+/**
+ * memory_region_clear_dirty_bitmap: re-arm dirty logging for a range
+ *
+ * Some accelerators, like KVM with manual dirty log protection, keep
+ * reporting a page as dirty after a sync until it is explicitly cleared;
+ * clearing also write protects the page again.  This clears the pages
+ * of the range for all listeners that support it, and does nothing for
+ * the others.  It must only be called once the dirty bits of the range
+ * have been synced to all clients.
+ *
+ * @mr: the region being cleared.
+ * @start: the start of the range, relative to @mr.
+ * @len: the length of the range.
+ */
+void memory_region_clear_dirty_bitmap(MemoryRegion *mr, hwaddr start,
+                                      hwaddr len);
+
 /**
  * memory_region_set_readonly: Turn a memory region read-only (or read-write)
  *
@@ -1661,6 +1686,12 @@ MemoryRegionSection memory_region_find(MemoryRegion *mr,
  */
 void memory_global_dirty_log_sync(void);
 
+/**
+ * memory_global_dirty_log_clear_supported: whether dirty logging is
+ * re-armed by memory_region_clear_dirty_bitmap() rather than on sync
+ */
+bool memory_global_dirty_log_clear_supported(void);
+
 /**
  * memory_region_transaction_begin: Start a transaction.
  *
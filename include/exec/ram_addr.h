@@ -50,6 +50,21 @@ struct RAMBlock {
     unsigned long *unsentmap;
     /* bitmap of already received pages in postcopy */
     unsigned long *receivedmap;
+    /*
+     * bitmap of chunks whose dirty log has been synced but not cleared
+     * yet, each bit covers (1 << clear_bmap_shift) target pages; only
+     * used with the chunked-dirty-log-clear migration capability
+     */
+    unsigned long *clear_bmap;
+    uint8_t clear_bmap_shift;
+    /*
+     * bitmap of pages present in the file, and where the bitmap and the
+     * pages of this block live in it; only used with the fixed-ram
+     * migration capability
+     */
+    unsigned long *file_bmap;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
 };
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
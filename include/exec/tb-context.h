@@ -35,6 +35,14 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_promote_count;
+    unsigned tb_evict_count;
+    size_t tb_evict_tbs;
+    /* time spent with all vCPUs stopped, in ns */
+    int64_t tb_flush_time;
+    int64_t tb_flush_time_max;
+    int64_t tb_evict_time;
+    int64_t tb_evict_time_max;
 };
 
 extern TBContext tb_ctx;
@@ -0,0 +1,50 @@
+/*
+ * Simulated dirty rings for TCG
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_TCG_DIRTY_RING_H
+#define EXEC_TCG_DIRTY_RING_H
+
+#include "qemu-common.h"
+#include "exec/cpu-common.h"
+
+extern uint32_t tcg_dirty_ring_size;
+
+/**
+ * tcg_dirty_ring_enabled: whether dirty pages go through the vCPU rings
+ *
+ * When enabled, writes that clear a page's migration dirty bit push the
+ * page to the ring of the vCPU doing the write instead of setting the
+ * bit; the bit is only set once the ring is harvested.  This mimics the
+ * KVM dirty ring, so that it can be tested without host support.
+ */
+static inline bool tcg_dirty_ring_enabled(void)
+{
+    return tcg_enabled() && tcg_dirty_ring_size;
+}
+
+/**
+ * tcg_dirty_ring_init: enable the simulated dirty rings
+ * @size: number of entries in each ring, a power of two (0 to disable)
+ */
+void tcg_dirty_ring_init(uint32_t size);
+
+/**
+ * tcg_dirty_ring_push: record a dirty page
+ * @cpu: the vCPU which dirtied the page, must be the current one
+ * @ram_addr: address of the page in the ram_addr_t space
+ *
+ * If the ring is full, it is harvested before returning.
+ */
+void tcg_dirty_ring_push(CPUState *cpu, ram_addr_t ram_addr);
+
+/**
+ * tcg_dirty_ring_free: harvest and free the ring of an unplugged vCPU
+ * @cpu: the vCPU
+ */
+void tcg_dirty_ring_free(CPUState *cpu);
+
+#endif
@@ -59,6 +59,9 @@ typedef enum DisasJumpType {
  * @is_jmp: What instruction to disassemble next.
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
+ * @num_blocks: Number of guest blocks translated in this TB (CF_TRACE).
+ * @block_first: Address of the first instruction of the current guest
+ *               block (CF_TRACE).
  * @singlestep_enabled: "Hardware" single stepping enabled.
  *
  * Architecture-agnostic disassembly context.
@@ -70,6 +73,8 @@ typedef struct DisasContextBase {
     DisasJumpType is_jmp;
     int num_insns;
     int max_insns;
+    int num_blocks;
+    target_ulong block_first;
     bool singlestep_enabled;
 } DisasContextBase;
 
@@ -141,4 +146,70 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_trace_follow:
+ * @db: Disassembly context.
+ * @dest: Address of the guest block executed next.
+ *
+ * When translating a trace (CF_TRACE), a direct branch to @dest need not
+ * end the TB; translation can instead go on with the block at @dest.  The
+ * block is only followed if it lies after the current instruction, so that
+ * [pc_first, pc_next) still covers all the code of the TB, and on the same
+ * page as @pc_first, so that the usual limits on the size of a TB apply.
+ *
+ * Returns true, and counts the new block, if the target should go on
+ * translating at @dest.
+ */
+bool translator_trace_follow(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_trace_loop:
+ * @db: Disassembly context.
+ * @dest: Address of the guest block executed next.
+ *
+ * When translating a trace (CF_TRACE), a direct branch back to @pc_first
+ * need not leave the TB; the target can instead branch to
+ * tcg_ctx->trace_loop_label, which checks for exit requests before running
+ * the trace again.  The target must make sure that the state it assumes at
+ * the start of the TB holds at the branch.
+ *
+ * Returns true if the branch to @dest can loop inside the trace.
+ */
+bool translator_trace_loop(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_trace_branch_taken:
+ * @db: Disassembly context.
+ * @cpu: CPU state the trace is translated for.
+ *
+ * When translating a trace (CF_TRACE), tell which way to follow the
+ * conditional branch that ends the current guest block.  The decision is
+ * based on the counts that translator_profile_branch() collected while the
+ * block ran as a counted TB (CF_TIERED).
+ *
+ * Returns true if the branch was taken more often than not; without a
+ * profile, the branch is assumed not to be taken.
+ */
+bool translator_trace_branch_taken(DisasContextBase *db, CPUState *cpu);
+
+/**
+ * translator_profile_branch:
+ * @db: Disassembly context.
+ *
+ * In a counted TB (CF_TIERED), count the executions that take the
+ * conditional branch ending the TB.  To be emitted by the target on the
+ * taken path.
+ */
+void translator_profile_branch(DisasContextBase *db);
+
+/**
+ * translator_trace_exit:
+ * @db: Disassembly context.
+ *
+ * Account a side exit out of a trace, i.e. a branch that leaves the hot
+ * path followed by translator_trace_follow().  To be emitted by the target
+ * on the exit path, before leaving the TB.
+ */
+void translator_trace_exit(DisasContextBase *db);
+
 #endif  /* EXEC__TRANSLATOR_H */
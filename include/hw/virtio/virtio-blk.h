@@ -40,6 +40,8 @@ struct VirtIOBlkConf
     uint32_t request_merging;
     uint16_t num_queues;
     uint16_t queue_size;
+    uint32_t num_iothreads;
+    char **iothreads;
 };
 
 struct VirtIOBlockDataPlane;
@@ -48,6 +48,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    /* zero copy writes issued, and completed by the kernel */
+    ssize_t zero_copy_queued;
+    ssize_t zero_copy_sent;
 };
 
 
@@ -32,4 +32,9 @@
 
 uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length);
 
+/* Switch crc32c() to the next slower implementation supported by the host,
+ * returns false once the generic table-driven one is in use.  For testing.
+ */
+bool test_crc32c_next_accel(void);
+
 #endif
@@ -29,6 +29,7 @@
 #include "qemu/fprintf-fn.h"
 #include "qemu/rcu_queue.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 
 typedef int (*WriteCoreDumpFunction)(const void *buf, size_t size,
@@ -246,6 +247,8 @@ struct CPUWatchpoint {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
+struct TCGDirtyRing;
 
 struct hax_vcpu_state;
 
@@ -316,6 +319,10 @@ struct qemu_work_item;
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_dirty_gfns: Dirty ring of this vCPU, mapped from KVM.
+ * @kvm_fetch_index: Next entry of @kvm_dirty_gfns to harvest.
+ * @tcg_dirty_ring: Simulated dirty ring of this vCPU under TCG.
+ * @dirty_pages: Pages harvested from the dirty ring of this vCPU.
  * @work_mutex: Lock to prevent multiple access to queued_work_*.
  * @queued_work_first: First asynchronous work pending.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -398,6 +405,10 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    struct TCGDirtyRing *tcg_dirty_ring;
+    Stat64 dirty_pages;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -416,6 +427,8 @@ struct CPUState {
      * autoconverge
      */
     bool throttle_thread_scheduled;
+    /* Throttle of this vCPU alone, on top of the global one */
+    int throttle_percentage;
 
     bool ignore_memory_transaction_failures;
 
@@ -816,17 +829,28 @@ CPUState *cpu_by_arch_id(int64_t id);
  */
 void cpu_throttle_set(int new_throttle_pct);
 
+/**
+ * cpu_throttle_set_vcpu:
+ * @cpu: The vCPU to throttle.
+ * @new_throttle_pct: Percent of sleep time, 0 to stop throttling @cpu.
+ *
+ * Like cpu_throttle_set, but only throttles @cpu.  The vCPU sleeps for the
+ * larger of this percentage and the one given to cpu_throttle_set.
+ */
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct);
+
 /**
  * cpu_throttle_stop:
  *
- * Stops the vcpu throttling started by cpu_throttle_set.
+ * Stops the vcpu throttling started by cpu_throttle_set or
+ * cpu_throttle_set_vcpu.
  */
 void cpu_throttle_stop(void);
 
 /**
  * cpu_throttle_active:
  *
- * Returns: %true if the vcpus are currently being throttled, %false otherwise.
+ * Returns: %true if any vcpu is currently being throttled, %false otherwise.
  */
 bool cpu_throttle_active(void);
 
@@ -839,6 +863,14 @@ bool cpu_throttle_active(void);
  */
 int cpu_throttle_get_percentage(void);
 
+/**
+ * cpu_throttle_get_vcpu_percentage:
+ * @cpu: The vCPU to query.
+ *
+ * Returns: The percentage @cpu is throttled by, 0 if it is not throttled.
+ */
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu);
+
 #ifndef CONFIG_USER_ONLY
 
 typedef void (*CPUInterruptHandler)(CPUState *, int);
@@ -25,6 +25,14 @@
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
+#ifdef CONFIG_LINUX
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#endif
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -153,6 +161,18 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
+#ifdef QEMU_MSG_ZEROCOPY
+    {
+        int v = 1;
+
+        /* Fails on sockets and kernels that cannot do zero copy */
+        if (qemu_setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+            qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                    QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        }
+    }
+#endif
+
     return 0;
 }
 
@@ -507,6 +527,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          size_t niov,
                                          int *fds,
                                          size_t nfds,
+                                         int flags,
                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
@@ -515,9 +536,16 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     char control[CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS)];
     size_t fdsize = sizeof(int) * nfds;
     struct cmsghdr *cmsg;
+    int sflags = 0;
 
     memset(control, 0, CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS));
 
+#ifdef QEMU_MSG_ZEROCOPY
+    if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+        sflags = MSG_ZEROCOPY;
+    }
+#endif
+
     msg.msg_iov = (struct iovec *)iov;
     msg.msg_iovlen = niov;
 
@@ -540,7 +568,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     }
 
  retry:
-    ret = sendmsg(sioc->fd, &msg, 0);
+    ret = sendmsg(sioc->fd, &msg, sflags);
     if (ret <= 0) {
         if (errno == EAGAIN) {
             return QIO_CHANNEL_ERR_BLOCK;
@@ -548,12 +576,88 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         if (errno == EINTR) {
             goto retry;
         }
+#ifdef QEMU_MSG_ZEROCOPY
+        if (errno == ENOBUFS && (sflags & MSG_ZEROCOPY)) {
+            error_setg_errno(errp, errno,
+                             "Process can't lock enough memory for "
+                             "zero copy writes");
+            return -1;
+        }
+#endif
         error_setg_errno(errp, errno,
                          "Unable to write to socket");
         return -1;
     }
+
+    if (sflags) {
+        sioc->zero_copy_queued++;
+    }
     return ret;
 }
+
+#ifdef QEMU_MSG_ZEROCOPY
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    struct msghdr msg = { NULL, };
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(*serr))];
+    int ret = 1;
+
+    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
+        return 0;
+    }
+
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sioc->fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN) {
+                /* Nothing on the error queue yet */
+                qio_channel_wait(ioc, G_IO_ERR);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno,
+                             "Unable to read socket error queue");
+            return -1;
+        }
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg ||
+            !((cmsg->cmsg_level == SOL_IP &&
+               cmsg->cmsg_type == IP_RECVERR) ||
+              (cmsg->cmsg_level == SOL_IPV6 &&
+               cmsg->cmsg_type == IPV6_RECVERR))) {
+            error_setg_errno(errp, EPROTOTYPE,
+                             "Unexpected message in socket error queue");
+            return -1;
+        }
+
+        serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, serr->ee_errno,
+                             "Error on socket");
+            return -1;
+        }
+
+        /* ee_info..ee_data is the range of completed zero copy writes */
+        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+
+        if (!(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+#endif /* QEMU_MSG_ZEROCOPY */
 #else /* WIN32 */
 static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
                                         const struct iovec *iov,
@@ -602,6 +706,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          size_t niov,
                                          int *fds,
                                          size_t nfds,
+                                         int flags,
                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
@@ -779,6 +884,9 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
     ioc_klass->io_set_delay = qio_channel_socket_set_delay;
     ioc_klass->io_create_watch = qio_channel_socket_create_watch;
     ioc_klass->io_set_aio_fd_handler = qio_channel_socket_set_aio_fd_handler;
+#ifdef QEMU_MSG_ZEROCOPY
+    ioc_klass->io_flush = qio_channel_socket_flush;
+#endif
 }
 
 static const TypeInfo qio_channel_socket_info = {
@@ -0,0 +1,235 @@
+/*
+ * Per-vCPU dirty rate measurement
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/rcu_queue.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qom/cpu.h"
+#include "exec/memory.h"
+#include "exec/ram_addr.h"
+#include "exec/tcg-dirty-ring.h"
+#include "sysemu/kvm.h"
+#include "migration/misc.h"
+#include "qapi/error.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-visit-migration.h"
+#include "qapi/qmp/qerror.h"
+#include "dirtyrate.h"
+#include "trace.h"
+
+#define DIRTYRATE_CALC_TIME_MAX 60
+
+/* Last measurement started by calc-dirty-rate, protected by the BQL */
+static DirtyRateInfo *dirty_rate_info;
+
+/* Whether the measurement has to stop dirty logging, protected by the BQL */
+static bool dirty_log_started;
+
+void dirtyrate_dirty_log_handover(void)
+{
+    dirty_log_started = false;
+}
+
+bool dirtyrate_vcpu_supported(void)
+{
+    return kvm_dirty_ring_enabled() || tcg_dirty_ring_enabled();
+}
+
+void dirtyrate_sample_start(DirtyRateSample *s)
+{
+    CPUState *cpu;
+    int nr_vcpus = 0;
+
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        nr_vcpus = MAX(nr_vcpus, cpu->cpu_index + 1);
+    }
+
+    if (nr_vcpus > s->nr_vcpus) {
+        s->pages = g_renew(uint64_t, s->pages, nr_vcpus);
+        s->rates = g_renew(uint64_t, s->rates, nr_vcpus);
+    }
+    s->nr_vcpus = nr_vcpus;
+    memset(s->pages, 0, nr_vcpus * sizeof(*s->pages));
+
+    CPU_FOREACH(cpu) {
+        s->pages[cpu->cpu_index] = stat64_get(&cpu->dirty_pages);
+    }
+    rcu_read_unlock();
+
+    s->start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+}
+
+uint64_t dirtyrate_sample_end(DirtyRateSample *s)
+{
+    CPUState *cpu;
+    int64_t elapsed_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - s->start_ms;
+    uint64_t pages, total = 0;
+
+    elapsed_ms = MAX(elapsed_ms, 1);
+    memset(s->rates, 0, s->nr_vcpus * sizeof(*s->rates));
+
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index >= s->nr_vcpus) {
+            continue;
+        }
+        pages = stat64_get(&cpu->dirty_pages) - s->pages[cpu->cpu_index];
+        s->rates[cpu->cpu_index] = pages * TARGET_PAGE_SIZE * 1000 /
+                                   elapsed_ms;
+        total += s->rates[cpu->cpu_index];
+        trace_dirtyrate_sample_vcpu(cpu->cpu_index, pages,
+                                    s->rates[cpu->cpu_index]);
+    }
+    rcu_read_unlock();
+
+    dirtyrate_sample_start(s);
+    return total;
+}
+
+uint64_t dirtyrate_sample_vcpu(DirtyRateSample *s, CPUState *cpu)
+{
+    return cpu->cpu_index < s->nr_vcpus ? s->rates[cpu->cpu_index] : 0;
+}
+
+void dirtyrate_sample_destroy(DirtyRateSample *s)
+{
+    g_free(s->pages);
+    g_free(s->rates);
+    memset(s, 0, sizeof(*s));
+}
+
+/*
+ * With the simulated rings, a page is only pushed when its migration
+ * dirty bit is clear.  Outside migration nobody clears the bits, so do
+ * it once at the start of the measurement.
+ */
+static void dirtyrate_clear_dirty_log(void)
+{
+    RAMBlock *block;
+
+    if (!tcg_dirty_ring_enabled()) {
+        return;
+    }
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(block) {
+        cpu_physical_memory_test_and_clear_dirty(block->offset,
+                                                 block->used_length,
+                                                 DIRTY_MEMORY_MIGRATION);
+    }
+    rcu_read_unlock();
+}
+
+static void *dirtyrate_thread(void *opaque)
+{
+    DirtyRateSample sample = { 0 };
+    DirtyRateVcpuList *list = NULL, **tail = &list, *entry;
+    CPUState *cpu;
+    uint64_t total;
+
+    rcu_register_thread();
+
+    /* Dirty logging is already on while migrating */
+    qemu_mutex_lock_iothread();
+    if (migration_is_idle()) {
+        memory_global_dirty_log_start();
+        dirtyrate_clear_dirty_log();
+        dirty_log_started = true;
+    }
+    memory_global_dirty_log_sync();
+    dirtyrate_sample_start(&sample);
+    qemu_mutex_unlock_iothread();
+
+    g_usleep(dirty_rate_info->calc_time * G_USEC_PER_SEC);
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_sync();
+    total = dirtyrate_sample_end(&sample);
+
+    /*
+     * A migration started meanwhile took dirty logging over, and stops
+     * it itself when it ends
+     */
+    if (dirty_log_started) {
+        memory_global_dirty_log_stop();
+        dirty_log_started = false;
+    }
+
+    CPU_FOREACH(cpu) {
+        entry = g_new0(DirtyRateVcpuList, 1);
+        entry->value = g_new0(DirtyRateVcpu, 1);
+        entry->value->id = cpu->cpu_index;
+        entry->value->dirty_rate = dirtyrate_sample_vcpu(&sample, cpu) >> 20;
+        entry->value->throttle_percentage =
+            cpu_throttle_get_vcpu_percentage(cpu);
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    dirty_rate_info->status = DIRTY_RATE_STATUS_MEASURED;
+    dirty_rate_info->has_dirty_rate = true;
+    dirty_rate_info->dirty_rate = total >> 20;
+    dirty_rate_info->has_vcpu_dirty_rate = true;
+    dirty_rate_info->vcpu_dirty_rate = list;
+    trace_dirtyrate_measured(dirty_rate_info->calc_time, total);
+    qemu_mutex_unlock_iothread();
+
+    dirtyrate_sample_destroy(&sample);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
+{
+    QemuThread thread;
+
+    if (calc_time < 1 || calc_time > DIRTYRATE_CALC_TIME_MAX) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "calc-time",
+                   "an integer in the range of 1 to 60");
+        return;
+    }
+
+    if (!dirtyrate_vcpu_supported()) {
+        error_setg(errp, "Dirty rate measurement needs dirty rings, "
+                   "see the dirty-ring-size machine property");
+        return;
+    }
+
+    if (dirty_rate_info &&
+        dirty_rate_info->status == DIRTY_RATE_STATUS_MEASURING) {
+        error_setg(errp, "A dirty rate measurement is already in progress");
+        return;
+    }
+
+    qapi_free_DirtyRateInfo(dirty_rate_info);
+    dirty_rate_info = g_new0(DirtyRateInfo, 1);
+    dirty_rate_info->status = DIRTY_RATE_STATUS_MEASURING;
+    dirty_rate_info->start_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) / 1000;
+    dirty_rate_info->calc_time = calc_time;
+
+    qemu_thread_create(&thread, "dirtyrate", dirtyrate_thread, NULL,
+                       QEMU_THREAD_DETACHED);
+}
+
+DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
+{
+    DirtyRateInfo *info;
+
+    if (!dirty_rate_info) {
+        info = g_new0(DirtyRateInfo, 1);
+        info->status = DIRTY_RATE_STATUS_UNSTARTED;
+        return info;
+    }
+
+    return QAPI_CLONE(DirtyRateInfo, dirty_rate_info);
+}
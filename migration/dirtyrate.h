@@ -0,0 +1,77 @@
+/*
+ * Per-vCPU dirty rate measurement
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_DIRTYRATE_H
+#define QEMU_MIGRATION_DIRTYRATE_H
+
+/*
+ * The rates are derived from the pages harvested from the dirty ring of
+ * each vCPU, so a sample only sees the pages harvested before it is
+ * taken; callers sync the dirty log first.
+ */
+typedef struct DirtyRateSample {
+    int64_t start_ms;
+    /* Number of entries in the arrays below, indexed by cpu_index */
+    int nr_vcpus;
+    /* CPUState::dirty_pages at the start of the sample */
+    uint64_t *pages;
+    /* Dirty rate of the last sample, in bytes per second */
+    uint64_t *rates;
+} DirtyRateSample;
+
+/**
+ * dirtyrate_dirty_log_handover: hand dirty logging over to migration
+ *
+ * Called with the BQL held before migration starts dirty logging, so
+ * that a measurement in progress leaves it to migration to stop it.
+ */
+void dirtyrate_dirty_log_handover(void);
+
+/**
+ * dirtyrate_vcpu_supported: whether per-vCPU dirty rates can be measured
+ *
+ * Returns true if dirty pages are tracked with per-vCPU dirty rings.
+ */
+bool dirtyrate_vcpu_supported(void);
+
+/**
+ * dirtyrate_sample_start: start a new sample
+ *
+ * @s: the sample, zero-initialized the first time
+ */
+void dirtyrate_sample_start(DirtyRateSample *s);
+
+/**
+ * dirtyrate_sample_end: compute the dirty rates since the sample started
+ *
+ * Fills @s->rates and starts a new sample.
+ *
+ * Returns the total dirty rate of the guest in bytes per second
+ *
+ * @s: the sample
+ */
+uint64_t dirtyrate_sample_end(DirtyRateSample *s);
+
+/**
+ * dirtyrate_sample_vcpu: dirty rate of a vCPU in the last sample
+ *
+ * Returns the dirty rate in bytes per second, 0 for vCPUs that were
+ * plugged after the sample started
+ *
+ * @s: the sample
+ * @cpu: the vCPU
+ */
+uint64_t dirtyrate_sample_vcpu(DirtyRateSample *s, CPUState *cpu);
+
+/**
+ * dirtyrate_sample_destroy: free the resources of a sample
+ *
+ * @s: the sample
+ */
+void dirtyrate_sample_destroy(DirtyRateSample *s);
+
+#endif
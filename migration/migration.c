@@ -19,6 +19,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "rdma.h"
 #include "ram.h"
@@ -41,7 +42,9 @@
 #include "qemu/thread.h"
 #include "trace.h"
 #include "exec/target_page.h"
+#include "exec/memory.h"
 #include "io/channel-buffer.h"
+#include "sysemu/cpus.h"
 #include "migration/colo.h"
 #include "hw/boards.h"
 #include "monitor/monitor.h"
@@ -72,6 +75,7 @@
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INITIAL 20
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INCREMENT 10
 #define DEFAULT_MIGRATE_MAX_CPU_THROTTLE 99
+#define MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES 1024
 
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE (64 * 1024 * 1024)
@@ -233,9 +237,9 @@ static void deferred_incoming_migration(Error **errp)
  * Send a message on the return channel back to the source
  * of the migration.
  */
-static int migrate_send_rp_message(MigrationIncomingState *mis,
-                                   enum mig_rp_message_type message_type,
-                                   uint16_t len, void *data)
+static int migrate_put_rp_message(MigrationIncomingState *mis,
+                                  enum mig_rp_message_type message_type,
+                                  uint16_t len, void *data, bool flush)
 {
     int ret = 0;
 
@@ -254,7 +258,9 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     qemu_put_be16(mis->to_src_file, (unsigned int)message_type);
     qemu_put_be16(mis->to_src_file, len);
     qemu_put_buffer(mis->to_src_file, data, len);
-    qemu_fflush(mis->to_src_file);
+    if (flush) {
+        qemu_fflush(mis->to_src_file);
+    }
 
     /* It's possible that qemu file got error during sending */
     ret = qemu_file_get_error(mis->to_src_file);
@@ -264,6 +270,32 @@ error:
     return ret;
 }
 
+static int migrate_send_rp_message(MigrationIncomingState *mis,
+                                   enum mig_rp_message_type message_type,
+                                   uint16_t len, void *data)
+{
+    return migrate_put_rp_message(mis, message_type, len, data, true);
+}
+
+/*
+ * Push out the messages queued on the return path
+ */
+int migrate_flush_rp(MigrationIncomingState *mis)
+{
+    int ret;
+
+    qemu_mutex_lock(&mis->rp_mutex);
+    if (!mis->to_src_file) {
+        ret = -EIO;
+    } else {
+        qemu_fflush(mis->to_src_file);
+        ret = qemu_file_get_error(mis->to_src_file);
+    }
+    qemu_mutex_unlock(&mis->rp_mutex);
+
+    return ret;
+}
+
 /* Request a range of pages from the source VM at the given
  * start address.
  *   rbname: Name of the RAMBlock to request the page in, if NULL it's the same
@@ -271,8 +303,9 @@ error:
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
-int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
-                              ram_addr_t start, size_t len)
+static int migrate_put_rp_req_pages(MigrationIncomingState *mis,
+                                    const char *rbname,
+                                    ram_addr_t start, size_t len, bool flush)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
@@ -293,7 +326,23 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
         msg_type = MIG_RP_MSG_REQ_PAGES;
     }
 
-    return migrate_send_rp_message(mis, msg_type, msglen, bufc);
+    return migrate_put_rp_message(mis, msg_type, msglen, bufc, flush);
+}
+
+int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
+                              ram_addr_t start, size_t len)
+{
+    return migrate_put_rp_req_pages(mis, rbname, start, len, true);
+}
+
+/*
+ * Like migrate_send_rp_req_pages(), but leave the request in the buffer
+ * until migrate_flush_rp() so that several can go out in one write
+ */
+int migrate_queue_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
+                               ram_addr_t start, size_t len)
+{
+    return migrate_put_rp_req_pages(mis, rbname, start, len, false);
 }
 
 static bool migration_colo_enabled;
@@ -331,6 +380,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -734,6 +785,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->max_postcopy_bandwidth = s->parameters.max_postcopy_bandwidth;
     params->has_max_cpu_throttle = true;
     params->max_cpu_throttle = s->parameters.max_cpu_throttle;
+    params->has_multifd_compression = true;
+    params->multifd_compression = s->parameters.multifd_compression;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
 
     return params;
 }
@@ -777,6 +832,10 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->postcopy_requests = ram_counters.postcopy_requests;
     info->ram->page_size = qemu_target_page_size();
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
+    info->ram->dirty_sync_missed_zero_copy =
+        ram_counters.dirty_sync_missed_zero_copy;
+    info->ram->dirty_log_clear_count = ram_counters.dirty_log_clear_count;
+    info->ram->dirty_log_clear_time = ram_counters.dirty_log_clear_time;
 
     if (migrate_use_xbzrle()) {
         info->has_xbzrle_cache = true;
@@ -787,6 +846,9 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss = xbzrle_counters.cache_miss;
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit = xbzrle_counters.cache_hit;
+        info->xbzrle_cache->cache_hit_rate = xbzrle_counters.cache_hit_rate;
+        info->xbzrle_cache->cache_eviction = xbzrle_counters.cache_eviction;
     }
 
     if (migrate_use_compression()) {
@@ -801,6 +863,11 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
                                     compression_counters.compression_rate;
     }
 
+    if (migrate_use_multifd()) {
+        info->has_multifd_channels = true;
+        info->multifd_channels = multifd_query_channel_stats();
+    }
+
     if (cpu_throttle_active()) {
         info->has_cpu_throttle_percentage = true;
         info->cpu_throttle_percentage = cpu_throttle_get_percentage();
@@ -953,6 +1020,69 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+#ifdef CONFIG_LINUX
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+        if (!cap_list[MIGRATION_CAPABILITY_X_MULTIFD]) {
+            error_setg(errp, "Zero copy send is only available with multifd");
+            return false;
+        }
+        if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "Zero copy send is not compatible "
+                       "with multifd compression");
+            return false;
+        }
+    }
+#endif
+
+    if (cap_list[MIGRATION_CAPABILITY_CHUNKED_DIRTY_LOG_CLEAR] &&
+        !memory_global_dirty_log_clear_supported()) {
+        error_setg(errp, "Chunked dirty log clear requires KVM with "
+                   "manual dirty log protection");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_FIXED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_X_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_RELEASE_RAM]) {
+            error_setg(errp, "Fixed-ram is not compatible with xbzrle, "
+                       "compress, multifd, postcopy or release-ram");
+            return false;
+        }
+#ifndef CONFIG_PREADV
+        error_setg(errp, "Fixed-ram requires preadv/pwritev support");
+        return false;
+#endif
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_X_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_RELEASE_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_BLOCK] ||
+            cap_list[MIGRATION_CAPABILITY_RETURN_PATH] ||
+            cap_list[MIGRATION_CAPABILITY_X_COLO] ||
+            cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE] ||
+            cap_list[MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER] ||
+            cap_list[MIGRATION_CAPABILITY_FIXED_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_DIRTY_BITMAPS]) {
+            error_setg(errp, "Background snapshot is not compatible with "
+                       "xbzrle, compress, multifd, postcopy, release-ram, "
+                       "block, return-path, colo, auto-converge, "
+                       "pause-before-switchover, fixed-ram or dirty-bitmaps");
+            return false;
+        }
+        if (!ram_write_tracking_available()) {
+            error_setg(errp, "Background snapshot requires userfaultfd "
+                       "write protection support");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -1110,6 +1240,24 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_compression &&
+        params->multifd_compression != MULTIFD_COMPRESSION_NONE &&
+        migrate_use_zero_copy_send()) {
+        error_setg(errp, "Multifd compression is not compatible "
+                   "with zero copy send");
+        return false;
+    }
+
+    if (params->has_postcopy_prefetch_pages &&
+        params->postcopy_prefetch_pages >
+        MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_pages",
+                   "an integer in the range of 0 to "
+                   stringify(MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES));
+        return false;
+    }
+
     return true;
 }
 
@@ -1184,6 +1332,12 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_max_cpu_throttle) {
         dest->max_cpu_throttle = params->max_cpu_throttle;
     }
+    if (params->has_multifd_compression) {
+        dest->multifd_compression = params->multifd_compression;
+    }
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1266,6 +1420,13 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_max_cpu_throttle) {
         s->parameters.max_cpu_throttle = params->max_cpu_throttle;
     }
+    if (params->has_multifd_compression) {
+        s->parameters.multifd_compression = params->multifd_compression;
+    }
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages =
+            params->postcopy_prefetch_pages;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -1786,6 +1947,23 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         return;
     }
 
+    if (migrate_fixed_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "Capability fixed-ram requires a file: URI");
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        block_cleanup_parameters(s);
+        return;
+    }
+
+    if (migrate_background_snapshot() && !ram_write_tracking_compatible()) {
+        error_setg(errp, "Background snapshot cannot write protect "
+                   "the memory backends in use");
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        block_cleanup_parameters(s);
+        return;
+    }
+
     if (strstart(uri, "tcp:", &p)) {
         tcp_start_outgoing_migration(s, p, &local_err);
 #ifdef CONFIG_RDMA
@@ -1798,6 +1976,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -1997,6 +2177,45 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_X_MULTIFD];
 }
 
+bool migrate_fixed_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_FIXED_RAM];
+}
+
+bool migrate_background_snapshot(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+}
+
+bool migrate_chunked_dirty_log_clear(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[
+        MIGRATION_CAPABILITY_CHUNKED_DIRTY_LOG_CLEAR];
+}
+
+#ifdef CONFIG_LINUX
+bool migrate_use_zero_copy_send(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+}
+#endif
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2025,6 +2244,24 @@ int migrate_multifd_page_count(void)
     return s->parameters.x_multifd_page_count;
 }
 
+uint32_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
+MultiFDCompression migrate_multifd_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_compression;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -3132,6 +3369,189 @@ static void *migration_thread(void *opaque)
     return NULL;
 }
 
+/*
+ * Background snapshot: the device state is saved to a buffer while the VM
+ * is briefly stopped and RAM is write protected, then the VM runs again
+ * while RAM is saved, and the device state is appended at the end.
+ */
+static void bg_migration_completion(MigrationState *s, QIOChannelBuffer *bioc)
+{
+    int ret;
+
+    /*
+     * Terminate the iterable sections first, as migration_completion()
+     * does; the buffered device state ends with QEMU_VM_EOF.
+     */
+    qemu_mutex_lock_iothread();
+    ret = qemu_savevm_state_complete_precopy(s->to_dst_file, true, false);
+    qemu_mutex_unlock_iothread();
+
+    /* All of RAM is in the stream, the device state goes after it */
+    if (ret >= 0) {
+        qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+        qemu_fflush(s->to_dst_file);
+    }
+
+    if (ret < 0 || qemu_file_get_error(s->to_dst_file)) {
+        trace_migration_completion_file_err();
+        migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        return;
+    }
+
+    migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_COMPLETED);
+}
+
+static void bg_migration_iteration_finish(MigrationState *s)
+{
+    /* Never leave the guest blocked on a write fault */
+    ram_write_tracking_stop();
+
+    qemu_mutex_lock_iothread();
+    switch (s->state) {
+    case MIGRATION_STATUS_COMPLETED:
+        migration_calculate_complete(s);
+        break;
+
+    case MIGRATION_STATUS_ACTIVE:
+    case MIGRATION_STATUS_FAILED:
+    case MIGRATION_STATUS_CANCELLED:
+    case MIGRATION_STATUS_CANCELLING:
+        break;
+
+    default:
+        /* Should not reach here, but if so, forgive the VM. */
+        error_report("%s: Unknown ending state %d", __func__, s->state);
+        break;
+    }
+    qemu_bh_schedule(s->cleanup_bh);
+    qemu_mutex_unlock_iothread();
+}
+
+/*
+ * The VM is restarted from the main loop: vm_start() notifiers may write
+ * to guest RAM, which blocks until the migration thread saves the page.
+ */
+static void bg_migration_vm_start_bh(void *opaque)
+{
+    MigrationState *s = opaque;
+
+    qemu_bh_delete(s->vm_start_bh);
+    s->vm_start_bh = NULL;
+
+    vm_start();
+    s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - s->downtime_start;
+}
+
+static void *bg_migration_thread(void *opaque)
+{
+    MigrationState *s = opaque;
+    int64_t setup_start = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    bool urgent = false;
+    int ret;
+
+    rcu_register_thread();
+
+    s->iteration_start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    qemu_savevm_state_header(s->to_dst_file);
+    qemu_savevm_state_setup(s->to_dst_file);
+
+    s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
+    migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_ACTIVE);
+
+    trace_migration_thread_setup_complete();
+
+    bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "vmstate-buffer");
+    fb = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+
+    qemu_mutex_lock_iothread();
+    s->downtime_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER, NULL);
+    s->vm_was_running = runstate_is_running();
+
+    ret = global_state_store();
+    if (!ret) {
+        ret = vm_stop_force_state(RUN_STATE_PAUSED);
+    }
+    if (!ret) {
+        cpu_synchronize_all_states();
+        ret = qemu_savevm_state_complete_precopy_non_iterable(fb, false,
+                                                              false);
+    }
+    if (!ret) {
+        /* From here on, a write to guest RAM waits for this thread */
+        ret = ram_write_tracking_start();
+    }
+    if (ret) {
+        if (s->vm_was_running) {
+            vm_start();
+        }
+        qemu_mutex_unlock_iothread();
+        error_report("%s: failed to start the snapshot", __func__);
+        migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        goto out;
+    }
+
+    if (s->vm_was_running) {
+        s->vm_start_bh = qemu_bh_new(bg_migration_vm_start_bh, s);
+        qemu_bh_schedule(s->vm_start_bh);
+    } else {
+        s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                      s->downtime_start;
+    }
+    qemu_mutex_unlock_iothread();
+
+    while (s->state == MIGRATION_STATUS_ACTIVE) {
+        int64_t current_time;
+
+        if (urgent || !qemu_file_rate_limit(s->to_dst_file)) {
+            ret = qemu_savevm_state_iterate(s->to_dst_file, false);
+            if (ret > 0) {
+                bg_migration_completion(s, bioc);
+                break;
+            }
+        }
+
+        if (migration_detect_error(s) == MIG_THR_ERR_FATAL) {
+            break;
+        }
+
+        current_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        migration_update_counters(s, current_time);
+
+        urgent = false;
+        if (qemu_file_rate_limit(s->to_dst_file)) {
+            /*
+             * Wait for the next rate limiting window, unless a vCPU is
+             * blocked on a write fault: then start the window early.
+             */
+            int ms = s->iteration_start_time + BUFFER_DELAY - current_time;
+
+            trace_migration_thread_ratelimit_pre(ms);
+            if (ram_write_tracking_wait(ms)) {
+                qemu_file_reset_rate_limit(s->to_dst_file);
+                urgent = true;
+            }
+            trace_migration_thread_ratelimit_post(urgent);
+        }
+    }
+
+out:
+    trace_migration_thread_after_loop();
+    bg_migration_iteration_finish(s);
+    qemu_fclose(fb);
+    object_unref(OBJECT(bioc));
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void migrate_fd_connect(MigrationState *s, Error *error_in)
 {
     int64_t rate_limit;
@@ -3187,8 +3607,13 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         migrate_fd_cleanup(s);
         return;
     }
-    qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
-                       QEMU_THREAD_JOINABLE);
+    if (migrate_background_snapshot()) {
+        qemu_thread_create(&s->thread, "bg_snapshot", bg_migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
     s->migration_thread_running = true;
 }
 
@@ -3264,6 +3689,11 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("max-cpu-throttle", MigrationState,
                       parameters.max_cpu_throttle,
                       DEFAULT_MIGRATE_MAX_CPU_THROTTLE),
+    DEFINE_PROP_MULTIFD_COMPRESSION("multifd-compression", MigrationState,
+                      parameters.multifd_compression,
+                      MULTIFD_COMPRESSION_NONE),
+    DEFINE_PROP_UINT32("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages, 0),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -3278,6 +3708,15 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_X_MULTIFD),
+#ifdef CONFIG_LINUX
+    DEFINE_PROP_MIG_CAP("x-zero-copy-send",
+                        MIGRATION_CAPABILITY_ZERO_COPY_SEND),
+#endif
+    DEFINE_PROP_MIG_CAP("x-chunked-dirty-log-clear",
+                        MIGRATION_CAPABILITY_CHUNKED_DIRTY_LOG_CLEAR),
+    DEFINE_PROP_MIG_CAP("x-fixed-ram", MIGRATION_CAPABILITY_FIXED_RAM),
+    DEFINE_PROP_MIG_CAP("x-background-snapshot",
+                        MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -3335,6 +3774,8 @@ static void migration_instance_init(Object *obj)
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
+    params->has_multifd_compression = true;
+    params->has_postcopy_prefetch_pages = true;
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
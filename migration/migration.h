@@ -113,6 +113,8 @@ struct MigrationState
     size_t xfer_limit;
     QemuThread thread;
     QEMUBH *cleanup_bh;
+    /* Restarts the VM once a background snapshot protected RAM */
+    QEMUBH *vm_start_bh;
     QEMUFile *to_dst_file;
     /*
      * Protects to_dst_file pointer.  We need to make sure we won't
@@ -258,9 +260,19 @@ bool migrate_dirty_bitmaps(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_chunked_dirty_log_clear(void);
+bool migrate_fixed_ram(void);
+bool migrate_background_snapshot(void);
+#ifdef CONFIG_LINUX
+bool migrate_use_zero_copy_send(void);
+#else
+#define migrate_use_zero_copy_send() (false)
+#endif
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 int migrate_multifd_page_count(void);
+MultiFDCompression migrate_multifd_compression(void);
+uint32_t migrate_postcopy_prefetch_pages(void);
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
@@ -286,6 +298,9 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
                           uint32_t value);
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char* rbname,
                               ram_addr_t start, size_t len);
+int migrate_queue_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
+                               ram_addr_t start, size_t len);
+int migrate_flush_rp(MigrationIncomingState *mis);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set-associative table indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -18,6 +18,8 @@
 #include "qapi/error.h"
 #include "qemu-common.h"
 #include "qemu/host-utils.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
 #include "page_cache.h"
 
 #ifdef DEBUG_CACHE
@@ -31,18 +33,30 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
-typedef struct CacheItem CacheItem;
+/* number of entries a page can be cached in */
+#define PAGE_CACHE_WAYS 8
 
+/*
+ * An entry is claimed by setting it_busy before its address is changed or
+ * its data is accessed.  Claims are never waited for: a thread that finds
+ * the entry busy behaves as if the page was not cached, so there is no
+ * lock for the cache as a whole.
+ */
 struct CacheItem {
-    uint64_t it_addr;
+    uintptr_t it_addr;
     uint64_t it_age;
+    uint32_t it_hits;
+    int it_busy;
     uint8_t *it_data;
 };
 
 struct PageCache {
+    struct rcu_head rcu;
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
+    size_t num_sets;
+    size_t num_ways;
     size_t num_items;
 };
 
@@ -75,8 +89,11 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, PAGE_CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %zu sets of %zu\n",
+            cache->num_sets, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -91,6 +108,8 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
+        cache->page_cache[i].it_hits = 0;
+        cache->page_cache[i].it_busy = 0;
         cache->page_cache[i].it_addr = -1;
     }
 
@@ -113,73 +132,161 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+void cache_fini_rcu(PageCache *cache)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    call_rcu(cache, cache_fini, rcu);
 }
 
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/* Returns the first entry of the set @address belongs to */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
+    size_t set;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
+    set = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[set * cache->num_ways];
+}
 
-    return &cache->page_cache[pos];
+static bool cache_claim(CacheItem *it, uintptr_t addr)
+{
+    if (atomic_cmpxchg(&it->it_busy, 0, 1) != 0) {
+        return false;
+    }
+    /* The entry may have been reused before we got it */
+    if (atomic_read(&it->it_addr) != addr) {
+        atomic_store_release(&it->it_busy, 0);
+        return false;
+    }
+    return true;
 }
 
-uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
+static void cache_touch(CacheItem *it, uint64_t current_age)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    it->it_age = current_age;
+    if (it->it_hits < UINT32_MAX) {
+        it->it_hits++;
+    }
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+/*
+ * Pages that are used often stay longer, but their use count loses half
+ * of its weight for each bitmap generation in which they were not used.
+ */
+static uint32_t cache_item_score(const CacheItem *it, uint64_t current_age)
 {
-    CacheItem *it;
+    uint64_t idle = current_age - it->it_age;
 
-    it = cache_get_by_addr(cache, addr);
+    return idle >= 32 ? 0 : it->it_hits >> idle;
+}
 
-    if (it->it_addr == addr) {
-        /* update the it_age when the cache hit */
-        it->it_age = current_age;
-        return true;
+CacheItem *cache_lookup(PageCache *cache, uint64_t addr, uint64_t current_age)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        CacheItem *it = &set[i];
+
+        if (atomic_read(&it->it_addr) == addr) {
+            if (!cache_claim(it, addr)) {
+                return NULL;
+            }
+            cache_touch(it, current_age);
+            return it;
+        }
     }
-    return false;
+    return NULL;
 }
 
-int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
-                 uint64_t current_age)
+uint8_t *cache_item_data(const CacheItem *it)
 {
+    g_assert(atomic_read(&it->it_busy));
+    return it->it_data;
+}
 
-    CacheItem *it;
+void cache_release(CacheItem *it)
+{
+    g_assert(atomic_read(&it->it_busy));
+    atomic_store_release(&it->it_busy, 0);
+}
 
-    /* actual update of entry */
-    it = cache_get_by_addr(cache, addr);
+int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
+                 uint64_t current_age, CacheItem **item)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    CacheItem *it = NULL;
+    uintptr_t victim_addr = -1;
+    uint32_t score, best_score = UINT32_MAX;
+    size_t i;
+    int ret = 0;
+
+    /*
+     * Pick the entry already holding the page, else a free one, else the
+     * entry with the lowest score among those that are not fresh.  Ways
+     * are filled in order, so the search ends at the first free one.
+     */
+    for (i = 0; i < cache->num_ways; i++) {
+        uintptr_t it_addr = atomic_read(&set[i].it_addr);
+
+        if (it_addr == addr) {
+            it = &set[i];
+            victim_addr = addr;
+            break;
+        }
+        if (atomic_read(&set[i].it_busy)) {
+            continue;
+        }
+        if (it_addr == (uintptr_t)-1) {
+            it = &set[i];
+            victim_addr = -1;
+            break;
+        }
+        if (set[i].it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* the cache page is fresh, don't replace it */
+            continue;
+        }
+        score = cache_item_score(&set[i], current_age);
+        if (!it || score < best_score ||
+            (score == best_score && set[i].it_age < it->it_age)) {
+            it = &set[i];
+            victim_addr = it_addr;
+            best_score = score;
+        }
+    }
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
+    if (!it || !cache_claim(it, victim_addr)) {
         return -1;
     }
+
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
         if (!it->it_data) {
             DPRINTF("Error allocating page\n");
+            atomic_store_release(&it->it_busy, 0);
             return -1;
         }
-        cache->num_items++;
+        atomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
 
-    it->it_age = current_age;
-    it->it_addr = addr;
+    if (victim_addr != addr) {
+        if (victim_addr != (uintptr_t)-1) {
+            ret = 1;
+        }
+        it->it_hits = 0;
+        atomic_set(&it->it_addr, addr);
+    }
+    cache_touch(it, current_age);
+
+    if (item) {
+        *item = it;
+    } else {
+        atomic_store_release(&it->it_busy, 0);
+    }
 
-    return 0;
+    return ret;
 }
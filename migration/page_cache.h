@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set-associative table indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -17,6 +17,8 @@
 
 /* Page cache for storing guest pages */
 typedef struct PageCache PageCache;
+/* A cache entry; it is claimed while its data is in use */
+typedef struct CacheItem CacheItem;
 
 /**
  * cache_init: Initialize the page cache
@@ -36,39 +38,54 @@ PageCache *cache_init(int64_t cache_size, size_t page_size, Error **errp);
 void cache_fini(PageCache *cache);
 
 /**
- * cache_is_cached: Checks to see if the page is cached
+ * cache_fini_rcu: free all cache resources once the current RCU
+ * readers are done with the cache
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
+/**
+ * cache_lookup: look up a page and claim its cache entry
  *
- * Returns %true if page is cached
+ * Returns the claimed entry, or NULL if the page is not cached or its
+ * entry is claimed by another thread.  The entry stays valid until it is
+ * released with cache_release().
  *
  * @cache pointer to the PageCache struct
  * @addr: page addr
  * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+CacheItem *cache_lookup(PageCache *cache, uint64_t addr, uint64_t current_age);
 
 /**
- * get_cached_data: Get the data cached for an addr
+ * cache_item_data: get the cached copy of the page of a claimed entry
  *
- * Returns pointer to the data cached or NULL if not cached
+ * @it: entry claimed by cache_lookup() or cache_insert()
+ */
+uint8_t *cache_item_data(const CacheItem *it);
+
+/**
+ * cache_release: release an entry claimed by cache_lookup() or
+ * cache_insert()
  *
- * @cache pointer to the PageCache struct
- * @addr: page addr
+ * @it: the claimed entry
  */
-uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
+void cache_release(CacheItem *it);
 
 /**
  * cache_insert: insert the page into the cache. the page cache
  * will dup the data on insert. the previous value will be overwritten
  *
- * Returns -1 when the page isn't inserted into cache
+ * Returns -1 when the page isn't inserted into cache, 1 when another
+ * page was evicted to make room for it and 0 otherwise
  *
  * @cache pointer to the PageCache struct
  * @addr: page address
  * @pdata: pointer to the page
  * @current_age: current bitmap generation
+ * @item: if not NULL, the entry is left claimed and *@item is set to it
  */
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
-                 uint64_t current_age);
+                 uint64_t current_age, CacheItem **item);
 
 #endif
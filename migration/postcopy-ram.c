@@ -25,6 +25,7 @@
 #include "ram.h"
 #include "qapi/error.h"
 #include "qemu/notify.h"
+#include "qemu/host-utils.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/balloon.h"
 #include "qemu/error-report.h"
@@ -49,9 +50,30 @@ struct PostcopyDiscardState {
 
 static NotifierWithReturnList postcopy_notifier_list;
 
+/*
+ * Time taken by the source to serve the pages requested by the fault
+ * thread, from the request to the page being placed.  Bucket i of the
+ * histogram counts requests served in [2^i, 2^(i+1)) microseconds,
+ * except for bucket 0 which starts at 0 and the last bucket which has
+ * no upper bound.
+ */
+#define POSTCOPY_FAULT_LATENCY_BUCKETS 24
+
+static struct {
+    QemuMutex lock;
+    /* host page address -> request time in us, for requests in flight */
+    GHashTable *pending;
+    uint64_t requests;
+    uint64_t served;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t histogram[POSTCOPY_FAULT_LATENCY_BUCKETS];
+} fault_latency;
+
 void postcopy_infrastructure_init(void)
 {
     notifier_with_return_list_init(&postcopy_notifier_list);
+    qemu_mutex_init(&fault_latency.lock);
 }
 
 void postcopy_add_notifier(NotifierWithReturn *nn)
@@ -154,10 +176,137 @@ static uint32List *get_vcpu_blocktime_list(PostcopyBlocktimeContext *ctx)
     return list;
 }
 
+static void postcopy_fault_latency_start(void)
+{
+    qemu_mutex_lock(&fault_latency.lock);
+    fault_latency.requests = 0;
+    fault_latency.served = 0;
+    fault_latency.total_us = 0;
+    fault_latency.max_us = 0;
+    memset(fault_latency.histogram, 0, sizeof(fault_latency.histogram));
+    if (!fault_latency.pending) {
+        fault_latency.pending = g_hash_table_new_full(g_direct_hash,
+                                                      g_direct_equal,
+                                                      NULL, g_free);
+    }
+    qemu_mutex_unlock(&fault_latency.lock);
+}
+
+static void postcopy_fault_latency_stop(void)
+{
+    qemu_mutex_lock(&fault_latency.lock);
+    if (fault_latency.pending) {
+        g_hash_table_destroy(fault_latency.pending);
+        fault_latency.pending = NULL;
+    }
+    qemu_mutex_unlock(&fault_latency.lock);
+}
+
+/*
+ * Record a request for the host page at @host of @rb.
+ *
+ * Returns false if the page was already requested and hasn't arrived
+ * yet, or if it has arrived already, in which case there is no need to
+ * ask the source again.
+ */
+static bool postcopy_fault_latency_begin(RAMBlock *rb, void *host)
+{
+    bool new_request = false;
+
+    qemu_mutex_lock(&fault_latency.lock);
+    if (fault_latency.pending &&
+        !g_hash_table_contains(fault_latency.pending, host)) {
+        int64_t *start = g_new(int64_t, 1);
+
+        *start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        g_hash_table_insert(fault_latency.pending, host, start);
+        fault_latency.requests++;
+        new_request = true;
+
+        /*
+         * The page may have been placed after the caller checked the
+         * received bitmap but before the entry was inserted, in which
+         * case postcopy_fault_latency_end() found nothing to remove.
+         */
+        if (ramblock_recv_bitmap_test(rb, host)) {
+            g_hash_table_remove(fault_latency.pending, host);
+            fault_latency.requests--;
+            new_request = false;
+        }
+    }
+    qemu_mutex_unlock(&fault_latency.lock);
+
+    return new_request;
+}
+
+/* The host page at @host was placed, account for it if it was requested */
+static void postcopy_fault_latency_end(void *host)
+{
+    int64_t *start;
+
+    qemu_mutex_lock(&fault_latency.lock);
+    start = fault_latency.pending ?
+            g_hash_table_lookup(fault_latency.pending, host) : NULL;
+    if (start) {
+        int64_t delta = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - *start;
+        uint64_t us = MAX(delta, 0);
+        int bucket = us < 2 ? 0 : 63 - clz64(us);
+
+        bucket = MIN(bucket, POSTCOPY_FAULT_LATENCY_BUCKETS - 1);
+        fault_latency.histogram[bucket]++;
+        fault_latency.served++;
+        fault_latency.total_us += us;
+        fault_latency.max_us = MAX(fault_latency.max_us, us);
+        g_hash_table_remove(fault_latency.pending, host);
+        trace_postcopy_fault_latency(host, us);
+    }
+    qemu_mutex_unlock(&fault_latency.lock);
+}
+
+/* Forget the requests in flight, they must be sent again */
+static void postcopy_fault_latency_reset_pending(void)
+{
+    qemu_mutex_lock(&fault_latency.lock);
+    if (fault_latency.pending) {
+        g_hash_table_remove_all(fault_latency.pending);
+    }
+    qemu_mutex_unlock(&fault_latency.lock);
+}
+
+static PostcopyFaultLatency *get_postcopy_fault_latency(void)
+{
+    PostcopyFaultLatency *lat;
+    uint64List *entry;
+    int i;
+
+    qemu_mutex_lock(&fault_latency.lock);
+    if (!fault_latency.requests) {
+        qemu_mutex_unlock(&fault_latency.lock);
+        return NULL;
+    }
+
+    lat = g_new0(PostcopyFaultLatency, 1);
+    lat->requests = fault_latency.requests;
+    lat->served = fault_latency.served;
+    lat->average = fault_latency.served ?
+                   fault_latency.total_us / fault_latency.served : 0;
+    lat->max = fault_latency.max_us;
+    for (i = POSTCOPY_FAULT_LATENCY_BUCKETS - 1; i >= 0; i--) {
+        entry = g_new0(uint64List, 1);
+        entry->value = fault_latency.histogram[i];
+        entry->next = lat->histogram;
+        lat->histogram = entry;
+    }
+    qemu_mutex_unlock(&fault_latency.lock);
+
+    return lat;
+}
+
 /*
  * This function just populates MigrationInfo from postcopy's
- * blocktime context. It will not populate MigrationInfo,
- * unless postcopy-blocktime capability was set.
+ * blocktime context and fault latency statistics. It will not
+ * populate the blocktime, unless postcopy-blocktime capability
+ * was set.
  *
  * @info: pointer to MigrationInfo to populate
  */
@@ -166,6 +315,9 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyBlocktimeContext *bc = mis->blocktime_ctx;
 
+    info->postcopy_fault_latency = get_postcopy_fault_latency();
+    info->has_postcopy_fault_latency = !!info->postcopy_fault_latency;
+
     if (!bc) {
         return;
     }
@@ -578,6 +730,7 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
     }
     trace_postcopy_ram_incoming_cleanup_blocktime(
             get_postcopy_total_blocktime());
+    postcopy_fault_latency_stop();
 
     trace_postcopy_ram_incoming_cleanup_exit();
     return 0;
@@ -853,9 +1006,75 @@ static bool postcopy_pause_fault_thread(MigrationIncomingState *mis)
 
     trace_postcopy_pause_fault_thread_continued();
 
+    /* Requests sent before the pause may have been lost */
+    postcopy_fault_latency_reset_pending();
+
     return true;
 }
 
+/* Maximum number of faults read from the userfaultfd at once */
+#define POSTCOPY_FAULT_BATCH 16
+
+typedef struct PostcopyFaultRequest {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    /* host page being requested */
+    void *host;
+} PostcopyFaultRequest;
+
+/*
+ * Ask the source for a batch of faulting pages, sending all the
+ * requests in a single write on the return path
+ *
+ * Returns 0 on success, negative on an unrecoverable error
+ */
+static int postcopy_request_pages(MigrationIncomingState *mis,
+                                  PostcopyFaultRequest *reqs, int nreq)
+{
+    int i, ret;
+
+retry:
+    ret = 0;
+    for (i = 0; i < nreq && !ret; i++) {
+        RAMBlock *rb = reqs[i].rb;
+
+        /*
+         * Send the request to the source - we want to request one
+         * of our host page sizes (which is >= TPS)
+         */
+        if (rb != mis->last_rb) {
+            mis->last_rb = rb;
+            ret = migrate_queue_rp_req_pages(mis, qemu_ram_get_idstr(rb),
+                                             reqs[i].offset,
+                                             qemu_ram_pagesize(rb));
+        } else {
+            /* Save some space */
+            ret = migrate_queue_rp_req_pages(mis, NULL, reqs[i].offset,
+                                             qemu_ram_pagesize(rb));
+        }
+    }
+    if (!ret) {
+        ret = migrate_flush_rp(mis);
+    }
+
+    if (ret) {
+        /* May be network failure, try to wait for recovery */
+        if (ret == -EIO && postcopy_pause_fault_thread(mis)) {
+            /* We got reconnected somehow, try to continue */
+            mis->last_rb = NULL;
+            for (i = 0; i < nreq; i++) {
+                postcopy_fault_latency_begin(reqs[i].rb, reqs[i].host);
+            }
+            goto retry;
+        }
+        /* This is a unavoidable fault */
+        error_report("%s: migrate_send_rp_req_pages() get %d",
+                     __func__, ret);
+    }
+    trace_postcopy_request_pages(nreq);
+    return ret;
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
@@ -939,10 +1158,16 @@ static void *postcopy_ram_fault_thread(void *opaque)
         }
 
         if (pfd[0].revents) {
+            PostcopyFaultRequest reqs[POSTCOPY_FAULT_BATCH];
+            struct uffd_msg msgs[POSTCOPY_FAULT_BATCH];
+            int i, nmsg, nreq = 0;
+            bool fatal = false;
+
             poll_result--;
-            ret = read(mis->userfault_fd, &msg, sizeof(msg));
-            if (ret != sizeof(msg)) {
-                if (errno == EAGAIN) {
+            /* Pick up all the faults queued since the last poll */
+            ret = read(mis->userfault_fd, msgs, sizeof(msgs));
+            if (ret <= 0 || ret % sizeof(struct uffd_msg)) {
+                if (ret < 0 && errno == EAGAIN) {
                     /*
                      * if a wake up happens on the other thread just after
                      * the poll, there is nothing to read.
@@ -956,66 +1181,56 @@ static void *postcopy_ram_fault_thread(void *opaque)
                     break;
                 } else {
                     error_report("%s: Read %d bytes from userfaultfd "
-                                 "expected %zd",
-                                 __func__, ret, sizeof(msg));
+                                 "expected a multiple of %zd",
+                                 __func__, ret, sizeof(struct uffd_msg));
                     break; /* Lost alignment, don't know what we'd read next */
                 }
             }
-            if (msg.event != UFFD_EVENT_PAGEFAULT) {
-                error_report("%s: Read unexpected event %ud from userfaultfd",
-                             __func__, msg.event);
-                continue; /* It's not a page fault, shouldn't happen */
-            }
 
-            rb = qemu_ram_block_from_host(
-                     (void *)(uintptr_t)msg.arg.pagefault.address,
-                     true, &rb_offset);
-            if (!rb) {
-                error_report("postcopy_ram_fault_thread: Fault outside guest: %"
-                             PRIx64, (uint64_t)msg.arg.pagefault.address);
-                break;
-            }
+            nmsg = ret / sizeof(struct uffd_msg);
+            for (i = 0; i < nmsg; i++) {
+                uint64_t address = msgs[i].arg.pagefault.address;
 
-            rb_offset &= ~(qemu_ram_pagesize(rb) - 1);
-            trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
-                                                qemu_ram_get_idstr(rb),
-                                                rb_offset,
-                                                msg.arg.pagefault.feat.ptid);
-            mark_postcopy_blocktime_begin(
-                    (uintptr_t)(msg.arg.pagefault.address),
-                                msg.arg.pagefault.feat.ptid, rb);
+                if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+                    error_report("%s: Read unexpected event %ud from "
+                                 "userfaultfd", __func__, msgs[i].event);
+                    continue; /* It's not a page fault, shouldn't happen */
+                }
 
-retry:
-            /*
-             * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
-             */
-            if (rb != mis->last_rb) {
-                mis->last_rb = rb;
-                ret = migrate_send_rp_req_pages(mis,
+                rb = qemu_ram_block_from_host((void *)(uintptr_t)address,
+                                              true, &rb_offset);
+                if (!rb) {
+                    error_report("postcopy_ram_fault_thread: Fault outside "
+                                 "guest: %" PRIx64, address);
+                    fatal = true;
+                    break;
+                }
+
+                rb_offset &= ~(qemu_ram_pagesize(rb) - 1);
+                trace_postcopy_ram_fault_thread_request(address,
                                                 qemu_ram_get_idstr(rb),
                                                 rb_offset,
-                                                qemu_ram_pagesize(rb));
-            } else {
-                /* Save some space */
-                ret = migrate_send_rp_req_pages(mis,
-                                                NULL,
-                                                rb_offset,
-                                                qemu_ram_pagesize(rb));
+                                                msgs[i].arg.pagefault.feat.ptid);
+                mark_postcopy_blocktime_begin((uintptr_t)address,
+                                              msgs[i].arg.pagefault.feat.ptid,
+                                              rb);
+
+                reqs[nreq].rb = rb;
+                reqs[nreq].offset = rb_offset;
+                reqs[nreq].host = (void *)(uintptr_t)
+                    (address & ~(uint64_t)(qemu_ram_pagesize(rb) - 1));
+                /*
+                 * Several vCPUs may be waiting for the same page, and the
+                 * page may have arrived since the fault was queued
+                 */
+                if (!ramblock_recv_bitmap_test(rb, reqs[nreq].host) &&
+                    postcopy_fault_latency_begin(rb, reqs[nreq].host)) {
+                    nreq++;
+                }
             }
 
-            if (ret) {
-                /* May be network failure, try to wait for recovery */
-                if (ret == -EIO && postcopy_pause_fault_thread(mis)) {
-                    /* We got reconnected somehow, try to continue */
-                    mis->last_rb = NULL;
-                    goto retry;
-                } else {
-                    /* This is a unavoidable fault */
-                    error_report("%s: migrate_send_rp_req_pages() get %d",
-                                 __func__, ret);
-                    break;
-                }
+            if (fatal || (nreq && postcopy_request_pages(mis, reqs, nreq))) {
+                break;
             }
         }
 
@@ -1108,6 +1323,8 @@ int postcopy_ram_enable_notify(MigrationIncomingState *mis)
         return -1;
     }
 
+    postcopy_fault_latency_start();
+
     qemu_sem_init(&mis->fault_thread_sem, 0);
     qemu_thread_create(&mis->fault_thread, "postcopy/fault",
                        postcopy_ram_fault_thread, mis, QEMU_THREAD_JOINABLE);
@@ -1153,6 +1370,7 @@ static int qemu_ufd_copy_ioctl(int userfault_fd, void *host_addr,
         ramblock_recv_bitmap_set_range(rb, host_addr,
                                        pagesize / qemu_target_page_size());
         mark_postcopy_blocktime_end((uintptr_t)host_addr);
+        postcopy_fault_latency_end(host_addr);
 
     }
     return ret;
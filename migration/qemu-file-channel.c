@@ -145,6 +145,49 @@ static int channel_set_blocking(void *opaque,
     return 0;
 }
 
+static int64_t channel_seek(void *opaque, int64_t offset, int whence)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    off_t ret;
+
+    ret = qio_channel_io_seek(ioc, offset, whence, NULL);
+    if (ret < 0) {
+        /* XXX handle Error * object */
+        return -EIO;
+    }
+    return ret;
+}
+
+
+static ssize_t channel_pwritev(void *opaque, struct iovec *iov,
+                               int iovcnt, int64_t offset)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    ssize_t ret;
+
+    ret = qio_channel_pwritev(ioc, iov, iovcnt, offset, NULL);
+    if (ret < 0) {
+        /* XXX handle Error * object */
+        return -EIO;
+    }
+    return ret;
+}
+
+
+static ssize_t channel_preadv(void *opaque, struct iovec *iov,
+                              int iovcnt, int64_t offset)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    ssize_t ret;
+
+    ret = qio_channel_preadv(ioc, iov, iovcnt, offset, NULL);
+    if (ret < 0) {
+        /* XXX handle Error * object */
+        return -EIO;
+    }
+    return ret;
+}
+
 static QEMUFile *channel_get_input_return_path(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -165,6 +208,8 @@ static const QEMUFileOps channel_input_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .seek = channel_seek,
+    .preadv = channel_preadv,
 };
 
 
@@ -174,6 +219,8 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .seek = channel_seek,
+    .pwritev = channel_pwritev,
 };
 
 
@@ -590,6 +590,115 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Move the I/O position of the transport underneath the stream, e.g. to
+ * skip over data that was written or will be read with qemu_file_pwrite()
+ * and qemu_file_pread().  Pending output is flushed first and buffered
+ * input is dropped, so the stream continues at the new position.
+ *
+ * The stream position reported by qemu_ftell() is not affected.
+ *
+ * Returns the new offset in the transport, or -err on error.
+ */
+int64_t qemu_file_seek(QEMUFile *f, int64_t offset, int whence)
+{
+    int64_t ret;
+
+    if (!f->ops->seek) {
+        return -ENOTSUP;
+    }
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        if (whence == SEEK_CUR) {
+            /* The transport is ahead of us by what we have buffered */
+            offset -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    ret = f->ops->seek(f->opaque, offset, whence);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+    }
+    return ret;
+}
+
+/*
+ * Write @size bytes of @buf at @offset in the transport, bypassing the
+ * stream buffer.  Safe to call from several threads at once; the caller
+ * is responsible for keeping the regions apart.
+ *
+ * Returns @size on success, or -err on error.
+ */
+ssize_t qemu_file_pwrite(QEMUFile *f, const uint8_t *buf, size_t size,
+                         int64_t offset)
+{
+    size_t done = 0;
+
+    if (!f->ops->pwritev) {
+        return -ENOTSUP;
+    }
+
+    while (done < size) {
+        struct iovec iov = {
+            .iov_base = (uint8_t *)buf + done,
+            .iov_len = size - done,
+        };
+        ssize_t ret = f->ops->pwritev(f->opaque, &iov, 1, offset + done);
+
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            return -EIO;
+        }
+        done += ret;
+    }
+    return size;
+}
+
+/*
+ * Read @size bytes at @offset in the transport into @buf, bypassing the
+ * stream buffer.  Same rules as qemu_file_pwrite().
+ *
+ * Returns @size on success, or -err on error; hitting the end of the
+ * transport before @size bytes counts as an error.
+ */
+ssize_t qemu_file_pread(QEMUFile *f, uint8_t *buf, size_t size,
+                        int64_t offset)
+{
+    size_t done = 0;
+
+    if (!f->ops->preadv) {
+        return -ENOTSUP;
+    }
+
+    while (done < size) {
+        struct iovec iov = {
+            .iov_base = buf + done,
+            .iov_len = size - done,
+        };
+        ssize_t ret = f->ops->preadv(f->opaque, &iov, 1, offset + done);
+
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            return -EIO;
+        }
+        done += ret;
+    }
+    return size;
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (qemu_file_get_error(f)) {
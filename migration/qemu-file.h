@@ -99,6 +99,23 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
  */
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr);
 
+/*
+ * Move the I/O position of the underlying transport.
+ * Returns the resulting offset, or -err on error
+ */
+typedef int64_t (QEMUFileSeekFunc)(void *opaque, int64_t offset, int whence);
+
+/*
+ * Write or read an iovec at a given offset of the underlying
+ * transport, without moving its I/O position.  May be called
+ * from several threads at once.
+ * Returns the number of bytes transferred, or -err on error
+ */
+typedef ssize_t (QEMUFilePwritevFunc)(void *opaque, struct iovec *iov,
+                                      int iovcnt, int64_t offset);
+typedef ssize_t (QEMUFilePreadvFunc)(void *opaque, struct iovec *iov,
+                                     int iovcnt, int64_t offset);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -106,6 +123,9 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileSeekFunc *seek;
+    QEMUFilePwritevFunc *pwritev;
+    QEMUFilePreadvFunc *preadv;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -155,6 +175,11 @@ int qemu_file_shutdown(QEMUFile *f);
 QEMUFile *qemu_file_get_return_path(QEMUFile *f);
 void qemu_fflush(QEMUFile *f);
 void qemu_file_set_blocking(QEMUFile *f, bool block);
+int64_t qemu_file_seek(QEMUFile *f, int64_t offset, int whence);
+ssize_t qemu_file_pwrite(QEMUFile *f, const uint8_t *buf, size_t size,
+                         int64_t offset);
+ssize_t qemu_file_pread(QEMUFile *f, uint8_t *buf, size_t size,
+                        int64_t offset);
 
 size_t qemu_get_counted_string(QEMUFile *f, char buf[256]);
 
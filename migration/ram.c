@@ -30,6 +30,7 @@
 #include "cpu.h"
 #include <zlib.h>
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
@@ -43,6 +44,7 @@
 #include "qemu-file.h"
 #include "postcopy-ram.h"
 #include "page_cache.h"
+#include "dirtyrate.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-migration.h"
@@ -57,6 +59,20 @@
 #include "qemu/uuid.h"
 #include "savevm.h"
 #include "qemu/iov.h"
+#include "qemu/stats64.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_userfaultfd)
+#include <linux/userfaultfd.h>
+#endif
 
 /***********************************************************/
 /* ram save/restore */
@@ -91,7 +107,8 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /* Cache for XBZRLE, replaced under lock and freed after an RCU grace
+     * period.  Sending pages only needs the RCU read lock. */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -118,7 +135,9 @@ static void XBZRLE_cache_unlock(void)
  * This function is called from qmp_migrate_set_cache_size in main
  * thread, possibly while a migration is in progress.  A running
  * migration may be using the cache and might finish during this call,
- * hence changes to the cache are protected by XBZRLE.lock().
+ * hence changes to the cache are protected by XBZRLE.lock().  The
+ * migration thread may still be sending pages from the old cache, so it
+ * is only freed after an RCU grace period.
  *
  * Returns 0 for success or -1 for error
  *
@@ -151,8 +170,8 @@ int xbzrle_cache_resize(int64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        cache_fini_rcu(XBZRLE.cache);
+        atomic_rcu_set(&XBZRLE.cache, new_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -299,8 +318,11 @@ struct RAMState {
     uint64_t bytes_xfer_prev;
     /* number of dirty pages since start_time */
     uint64_t num_dirty_pages_period;
-    /* xbzrle misses since the beginning of the period */
+    /* per-vCPU dirty rates since start_time, with dirty rings */
+    DirtyRateSample dirty_rate_sample;
+    /* xbzrle misses and hits since the beginning of the period */
     uint64_t xbzrle_cache_miss_prev;
+    uint64_t xbzrle_cache_hit_prev;
 
     /* compression statistics since the beginning of the period */
     /* amount of count that no free thread to compress data */
@@ -323,6 +345,13 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /*
+     * Pages following the requested ones, sent once src_page_requests
+     * is empty; also protected by src_page_req_mutex
+     */
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_prefetch_requests;
+    /* userfaultfd write protecting RAM for background snapshots, or -1 */
+    int uffdio_fd;
 };
 typedef struct RAMState RAMState;
 
@@ -516,10 +545,16 @@ exit:
 /* Multiple fd's */
 
 #define MULTIFD_MAGIC 0x11223344U
-#define MULTIFD_VERSION 1
+#define MULTIFD_VERSION 2
 
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
+/* We reserve 3 bits for the compression method */
+#define MULTIFD_FLAG_COMPRESSION_MASK (7 << 1)
+#define MULTIFD_FLAG_NOCOMP (0 << 1)
+#define MULTIFD_FLAG_ZLIB (1 << 1)
+#define MULTIFD_FLAG_ZSTD (2 << 1)
+
 typedef struct {
     uint32_t magic;
     uint32_t version;
@@ -533,6 +568,8 @@ typedef struct {
     uint32_t flags;
     uint32_t size;
     uint32_t used;
+    /* size of the page data that follows the packet */
+    uint32_t next_packet_size;
     uint64_t packet_num;
     char ramblock[256];
     uint64_t offset[];
@@ -552,6 +589,17 @@ typedef struct {
     RAMBlock *block;
 } MultiFDPages_t;
 
+typedef struct {
+    /* packets sent through the channel */
+    Stat64 packets;
+    /* pages sent through the channel */
+    Stat64 pages;
+    /* bytes of page data sent through the channel */
+    Stat64 bytes;
+    /* time spent compressing the pages, in nanoseconds */
+    Stat64 compress_ns;
+} MultiFDSendStats;
+
 typedef struct {
     /* this fields are not changed once the thread is created */
     /* channel number */
@@ -589,6 +637,22 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* syncs at which the kernel copied all the zero copy pages */
+    uint64_t zero_copy_missed;
+    /* statistics of this channel */
+    MultiFDSendStats *stats;
+    /* compression method and stream, owned by the channel thread */
+    MultiFDCompression compression;
+    z_stream zs;
+#ifdef CONFIG_ZSTD
+    ZSTD_CStream *zcs;
+#endif
+    /* copy of the page that is being compressed */
+    uint8_t *originbuf;
+    /* compressed page data of the packet */
+    uint8_t *zbuf;
+    uint32_t zbuf_len;
+    uint32_t zbuf_used;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -622,6 +686,17 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* size of the page data that follows the packet */
+    uint32_t next_packet_size;
+    /* compression method and stream, owned by the channel thread */
+    MultiFDCompression compression;
+    z_stream zs;
+#ifdef CONFIG_ZSTD
+    ZSTD_DStream *zds;
+#endif
+    /* compressed page data of the packet */
+    uint8_t *zbuf;
+    uint32_t zbuf_len;
 } MultiFDRecvParams;
 
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
@@ -710,16 +785,33 @@ static void multifd_pages_clear(MultiFDPages_t *pages)
     g_free(pages);
 }
 
+static uint32_t multifd_compression_flag(MultiFDCompression compression)
+{
+    switch (compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        return MULTIFD_FLAG_ZLIB;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        return MULTIFD_FLAG_ZSTD;
+#endif
+    default:
+        return MULTIFD_FLAG_NOCOMP;
+    }
+}
+
 static void multifd_send_fill_packet(MultiFDSendParams *p)
 {
     MultiFDPacket_t *packet = p->packet;
+    uint32_t flags = p->flags | multifd_compression_flag(p->compression);
     int i;
 
     packet->magic = cpu_to_be32(MULTIFD_MAGIC);
     packet->version = cpu_to_be32(MULTIFD_VERSION);
-    packet->flags = cpu_to_be32(p->flags);
+    packet->flags = cpu_to_be32(flags);
     packet->size = cpu_to_be32(migrate_multifd_page_count());
     packet->used = cpu_to_be32(p->pages->used);
+    /* updated by multifd_send_compress() if the pages are compressed */
+    packet->next_packet_size = cpu_to_be32(p->pages->used * TARGET_PAGE_SIZE);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
     if (p->pages->block) {
@@ -754,6 +846,14 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->flags = be32_to_cpu(packet->flags);
+    if ((p->flags & MULTIFD_FLAG_COMPRESSION_MASK) !=
+        multifd_compression_flag(p->compression)) {
+        error_setg(errp, "multifd: received packet "
+                   "with compression flags 0x%x and expected 0x%x",
+                   p->flags & MULTIFD_FLAG_COMPRESSION_MASK,
+                   multifd_compression_flag(p->compression));
+        return -1;
+    }
 
     packet->size = be32_to_cpu(packet->size);
     if (packet->size > migrate_multifd_page_count()) {
@@ -771,6 +871,16 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->next_packet_size = be32_to_cpu(packet->next_packet_size);
+    if (p->compression == MULTIFD_COMPRESSION_NONE ?
+        p->next_packet_size != p->pages->used * TARGET_PAGE_SIZE :
+        p->next_packet_size > p->zbuf_len) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d pages and %d bytes of page data",
+                   p->pages->used, p->next_packet_size);
+        return -1;
+    }
+
     p->packet_num = be64_to_cpu(packet->packet_num);
 
     if (p->pages->used) {
@@ -800,6 +910,306 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     return 0;
 }
 
+/*
+ * Statistics of the send channels.  They are not freed together with the
+ * channels, so that they can still be queried once migration has completed.
+ */
+static struct {
+    int count;
+    MultiFDSendStats *channels;
+} multifd_send_stats;
+
+/* Room for incompressible pages plus the overhead of the stream */
+static uint32_t multifd_zbuf_len(void)
+{
+    return migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+}
+
+static int multifd_send_compress_setup(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDCompression compression = migrate_multifd_compression();
+    int level = migrate_compress_level();
+
+    switch (compression) {
+    case MULTIFD_COMPRESSION_NONE:
+        return 0;
+    case MULTIFD_COMPRESSION_ZLIB:
+        if (deflateInit(&p->zs, level) != Z_OK) {
+            error_setg(errp, "multifd %d: deflate init failed", p->id);
+            return -1;
+        }
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        p->zcs = ZSTD_createCStream();
+        if (!p->zcs) {
+            error_setg(errp, "multifd %d: zstd init failed", p->id);
+            return -1;
+        }
+        /* level 0 selects the default level of zstd */
+        ZSTD_CCtx_setParameter(p->zcs, ZSTD_c_compressionLevel, level);
+        break;
+#endif
+    default:
+        g_assert_not_reached();
+    }
+
+    p->compression = compression;
+    p->originbuf = g_malloc(TARGET_PAGE_SIZE);
+    p->zbuf_len = multifd_zbuf_len();
+    p->zbuf = g_malloc(p->zbuf_len);
+    return 0;
+}
+
+static void multifd_send_compress_cleanup(MultiFDSendParams *p)
+{
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        deflateEnd(&p->zs);
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        ZSTD_freeCStream(p->zcs);
+        p->zcs = NULL;
+        break;
+#endif
+    default:
+        break;
+    }
+    p->compression = MULTIFD_COMPRESSION_NONE;
+    g_free(p->originbuf);
+    p->originbuf = NULL;
+    g_free(p->zbuf);
+    p->zbuf = NULL;
+    p->zbuf_len = 0;
+}
+
+static int multifd_zlib_compress_page(MultiFDSendParams *p, bool last)
+{
+    z_stream *zs = &p->zs;
+    int ret;
+
+    zs->next_in = p->originbuf;
+    zs->avail_in = TARGET_PAGE_SIZE;
+    zs->next_out = p->zbuf + p->zbuf_used;
+    zs->avail_out = p->zbuf_len - p->zbuf_used;
+    ret = deflate(zs, last ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    p->zbuf_used = p->zbuf_len - zs->avail_out;
+
+    /* with no room left, the flush may not have completed */
+    if (ret != Z_OK || zs->avail_in || !zs->avail_out) {
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef CONFIG_ZSTD
+static int multifd_zstd_compress_page(MultiFDSendParams *p, bool last)
+{
+    ZSTD_inBuffer in = { p->originbuf, TARGET_PAGE_SIZE, 0 };
+    ZSTD_outBuffer out = { p->zbuf, p->zbuf_len, p->zbuf_used };
+    size_t ret;
+
+    ret = ZSTD_compressStream2(p->zcs, &out, &in,
+                               last ? ZSTD_e_flush : ZSTD_e_continue);
+    p->zbuf_used = out.pos;
+
+    /* for ZSTD_e_flush, a non-zero value means that data is still pending */
+    if (ZSTD_isError(ret) || in.pos != in.size || (last && ret)) {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+/**
+ * multifd_send_compress: compress the pages of the packet into zbuf
+ *
+ * The stream is flushed at the end of each packet but is not reset, so
+ * the pages are compressed against the data already sent through the
+ * channel.  Returns 0 for success or -1 for error.
+ *
+ * @p: channel that is sending the packet
+ * @used: number of pages in the packet
+ * @errp: pointer to an error
+ */
+static int multifd_send_compress(MultiFDSendParams *p, uint32_t used,
+                                 Error **errp)
+{
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint32_t i;
+    int ret = 0;
+
+    if (p->compression == MULTIFD_COMPRESSION_NONE) {
+        return 0;
+    }
+
+    p->zbuf_used = 0;
+    if (!used) {
+        return 0;
+    }
+    for (i = 0; i < used && !ret; i++) {
+        bool last = i == used - 1;
+
+        /*
+         * The guest can change the page while it is being compressed,
+         * which may confuse the compressor; work on a copy of it.
+         */
+        memcpy(p->originbuf, p->pages->iov[i].iov_base, TARGET_PAGE_SIZE);
+
+        switch (p->compression) {
+        case MULTIFD_COMPRESSION_ZLIB:
+            ret = multifd_zlib_compress_page(p, last);
+            break;
+#ifdef CONFIG_ZSTD
+        case MULTIFD_COMPRESSION_ZSTD:
+            ret = multifd_zstd_compress_page(p, last);
+            break;
+#endif
+        default:
+            g_assert_not_reached();
+        }
+    }
+    if (ret) {
+        error_setg(errp, "multifd %d: failed to compress packet %" PRIu64,
+                   p->id, be64_to_cpu(p->packet->packet_num));
+        return -1;
+    }
+
+    p->packet->next_packet_size = cpu_to_be32(p->zbuf_used);
+    stat64_add(&p->stats->compress_ns,
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    return 0;
+}
+
+static int multifd_recv_decompress_setup(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDCompression compression = migrate_multifd_compression();
+
+    switch (compression) {
+    case MULTIFD_COMPRESSION_NONE:
+        return 0;
+    case MULTIFD_COMPRESSION_ZLIB:
+        if (inflateInit(&p->zs) != Z_OK) {
+            error_setg(errp, "multifd %d: inflate init failed", p->id);
+            return -1;
+        }
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        p->zds = ZSTD_createDStream();
+        if (!p->zds) {
+            error_setg(errp, "multifd %d: zstd init failed", p->id);
+            return -1;
+        }
+        break;
+#endif
+    default:
+        g_assert_not_reached();
+    }
+
+    p->compression = compression;
+    p->zbuf_len = multifd_zbuf_len();
+    p->zbuf = g_malloc(p->zbuf_len);
+    return 0;
+}
+
+static void multifd_recv_decompress_cleanup(MultiFDRecvParams *p)
+{
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        inflateEnd(&p->zs);
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        ZSTD_freeDStream(p->zds);
+        p->zds = NULL;
+        break;
+#endif
+    default:
+        break;
+    }
+    p->compression = MULTIFD_COMPRESSION_NONE;
+    g_free(p->zbuf);
+    p->zbuf = NULL;
+    p->zbuf_len = 0;
+}
+
+static int multifd_zlib_decompress_page(MultiFDRecvParams *p,
+                                        struct iovec *iov)
+{
+    z_stream *zs = &p->zs;
+    int ret;
+
+    zs->next_out = iov->iov_base;
+    zs->avail_out = iov->iov_len;
+    do {
+        ret = inflate(zs, Z_SYNC_FLUSH);
+    } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+
+    return ret == Z_OK && !zs->avail_out ? 0 : -1;
+}
+
+#ifdef CONFIG_ZSTD
+static int multifd_zstd_decompress_page(MultiFDRecvParams *p,
+                                        ZSTD_inBuffer *in, struct iovec *iov)
+{
+    ZSTD_outBuffer out = { iov->iov_base, iov->iov_len, 0 };
+    size_t ret;
+
+    do {
+        ret = ZSTD_decompressStream(p->zds, &out, in);
+    } while (!ZSTD_isError(ret) && in->pos < in->size && out.pos < out.size);
+
+    return !ZSTD_isError(ret) && out.pos == out.size ? 0 : -1;
+}
+#endif
+
+/**
+ * multifd_recv_decompress: read the compressed page data of the packet
+ * and decompress it into the pages
+ *
+ * Returns 0 for success or -1 for error.
+ *
+ * @p: channel that is receiving the packet
+ * @used: number of pages in the packet
+ * @errp: pointer to an error
+ */
+static int multifd_recv_decompress(MultiFDRecvParams *p, uint32_t used,
+                                   Error **errp)
+{
+    uint32_t i;
+    int ret;
+
+    ret = qio_channel_read_all(p->c, (void *)p->zbuf, p->next_packet_size,
+                               errp);
+    if (ret != 0) {
+        return -1;
+    }
+
+    if (p->compression == MULTIFD_COMPRESSION_ZLIB) {
+        p->zs.next_in = p->zbuf;
+        p->zs.avail_in = p->next_packet_size;
+        for (i = 0; i < used && !ret; i++) {
+            ret = multifd_zlib_decompress_page(p, &p->pages->iov[i]);
+        }
+#ifdef CONFIG_ZSTD
+    } else {
+        ZSTD_inBuffer in = { p->zbuf, p->next_packet_size, 0 };
+
+        for (i = 0; i < used && !ret; i++) {
+            ret = multifd_zstd_decompress_page(p, &in, &p->pages->iov[i]);
+        }
+#endif
+    }
+    if (ret) {
+        error_setg(errp, "multifd %d: failed to decompress packet %" PRIu64,
+                   p->id, p->packet_num);
+        return -1;
+    }
+    return 0;
+}
+
 struct {
     MultiFDSendParams *params;
     /* number of created threads */
@@ -985,6 +1395,14 @@ static void multifd_send_sync_main(void)
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&multifd_send_state->sem_sync);
     }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        ram_counters.dirty_sync_missed_zero_copy += p->zero_copy_missed;
+        p->zero_copy_missed = 0;
+        qemu_mutex_unlock(&p->mutex);
+    }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
@@ -992,17 +1410,30 @@ static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
     Error *local_err = NULL;
+    bool use_zero_copy_send = migrate_use_zero_copy_send();
+    int write_flags = use_zero_copy_send ? QIO_CHANNEL_WRITE_FLAG_ZERO_COPY : 0;
     int ret;
 
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
+    if (use_zero_copy_send &&
+        !qio_channel_has_feature(p->c, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(&local_err, "multifd %d: zero copy send is not "
+                   "supported by the host", p->id);
+        goto out;
+    }
+
     if (multifd_send_initial_packet(p, &local_err) < 0) {
         goto out;
     }
     /* initial packet */
     p->num_packets = 1;
 
+    if (multifd_send_compress_setup(p, &local_err) < 0) {
+        goto out;
+    }
+
     while (true) {
         qemu_sem_wait(&p->sem);
         qemu_mutex_lock(&p->mutex);
@@ -1021,17 +1452,51 @@ static void *multifd_send_thread(void *opaque)
 
             trace_multifd_send(p->id, packet_num, used, flags);
 
+            ret = multifd_send_compress(p, used, &local_err);
+            if (ret != 0) {
+                break;
+            }
+
             ret = qio_channel_write_all(p->c, (void *)p->packet,
                                         p->packet_len, &local_err);
             if (ret != 0) {
                 break;
             }
 
-            ret = qio_channel_writev_all(p->c, p->pages->iov, used, &local_err);
+            if (p->compression != MULTIFD_COMPRESSION_NONE) {
+                ret = qio_channel_write_all(p->c, (void *)p->zbuf,
+                                            p->zbuf_used, &local_err);
+            } else {
+                /* the header above is reused, so it is always copied */
+                ret = qio_channel_writev_full_all(p->c, p->pages->iov, used,
+                                                  NULL, 0, write_flags,
+                                                  &local_err);
+            }
             if (ret != 0) {
                 break;
             }
 
+            if ((flags & MULTIFD_FLAG_SYNC) && use_zero_copy_send) {
+                /*
+                 * Pages dirtied after the sync are sent again; wait for
+                 * the kernel to be done with the ones sent so far.
+                 */
+                ret = qio_channel_flush(p->c, &local_err);
+                if (ret < 0) {
+                    break;
+                }
+                if (ret == 1) {
+                    qemu_mutex_lock(&p->mutex);
+                    p->zero_copy_missed++;
+                    qemu_mutex_unlock(&p->mutex);
+                }
+            }
+
+            stat64_add(&p->stats->packets, 1);
+            stat64_add(&p->stats->pages, used);
+            stat64_add(&p->stats->bytes,
+                       be32_to_cpu(p->packet->next_packet_size));
+
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
             qemu_mutex_unlock(&p->mutex);
@@ -1053,6 +1518,7 @@ out:
     if (local_err) {
         multifd_send_terminate_threads(local_err);
     }
+    multifd_send_compress_cleanup(p);
 
     qemu_mutex_lock(&p->mutex);
     p->running = false;
@@ -1102,6 +1568,10 @@ int multifd_save_setup(void)
     qemu_sem_init(&multifd_send_state->sem_sync, 0);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
 
+    g_free(multifd_send_stats.channels);
+    multifd_send_stats.channels = g_new0(MultiFDSendStats, thread_count);
+    multifd_send_stats.count = thread_count;
+
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
@@ -1111,6 +1581,7 @@ int multifd_save_setup(void)
         p->quit = false;
         p->pending_job = 0;
         p->id = i;
+        p->stats = &multifd_send_stats.channels[i];
         p->pages = multifd_pages_init(page_count);
         p->packet_len = sizeof(MultiFDPacket_t)
                       + sizeof(ram_addr_t) * page_count;
@@ -1230,6 +1701,10 @@ static void *multifd_recv_thread(void *opaque)
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    if (multifd_recv_decompress_setup(p, &local_err) < 0) {
+        goto out;
+    }
+
     while (true) {
         uint32_t used;
         uint32_t flags;
@@ -1257,7 +1732,12 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        ret = qio_channel_readv_all(p->c, p->pages->iov, used, &local_err);
+        if (p->compression != MULTIFD_COMPRESSION_NONE) {
+            ret = multifd_recv_decompress(p, used, &local_err);
+        } else {
+            ret = qio_channel_readv_all(p->c, p->pages->iov, used,
+                                        &local_err);
+        }
         if (ret != 0) {
             break;
         }
@@ -1268,9 +1748,11 @@ static void *multifd_recv_thread(void *opaque)
         }
     }
 
+out:
     if (local_err) {
         multifd_recv_terminate_threads(local_err);
     }
+    multifd_recv_decompress_cleanup(p);
     qemu_mutex_lock(&p->mutex);
     p->running = false;
     qemu_mutex_unlock(&p->mutex);
@@ -1354,6 +1836,38 @@ bool multifd_recv_new_channel(QIOChannel *ioc)
     return multifd_recv_state->count == migrate_multifd_channels();
 }
 
+MultiFDChannelStatsList *multifd_query_channel_stats(void)
+{
+    MultiFDChannelStatsList *head = NULL;
+    int i;
+
+    for (i = multifd_send_stats.count - 1; i >= 0; i--) {
+        MultiFDSendStats *stats = &multifd_send_stats.channels[i];
+        MultiFDChannelStatsList *entry = g_new0(MultiFDChannelStatsList, 1);
+        MultiFDChannelStats *info = g_new0(MultiFDChannelStats, 1);
+        uint64_t compress_ns = stat64_get(&stats->compress_ns);
+        double page_bytes;
+
+        info->id = i;
+        info->packets = stat64_get(&stats->packets);
+        info->pages = stat64_get(&stats->pages);
+        info->bytes = stat64_get(&stats->bytes);
+        page_bytes = (double)info->pages * TARGET_PAGE_SIZE;
+        if (info->bytes) {
+            info->compression_rate = page_bytes / info->bytes;
+        }
+        if (compress_ns) {
+            /* bits per microsecond is Mbps */
+            info->compression_mbps = page_bytes * 8 * 1000 / compress_ns;
+        }
+
+        entry->value = info;
+        entry->next = head;
+        head = entry;
+    }
+    return head;
+}
+
 /**
  * save_page_header: write page header to wire
  *
@@ -1387,6 +1901,86 @@ static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
     return size;
 }
 
+/**
+ * mig_throttle_vcpus_down: throttle down the vCPUs that dirty memory
+ *
+ * Split the dirty rate quota evenly between the vCPUs, handing out the
+ * share left unused by light writers to the others until the share is
+ * stable.  The vCPUs that dirty memory faster than their share are
+ * throttled, assuming that their dirty rate scales with the time they
+ * run; idle vCPUs are left alone.  Throttled vCPUs that are now below
+ * their share get one increment back, if that keeps them below it.
+ *
+ * @rs: current RAM state
+ * @quota: target dirty rate of the guest, in bytes per second
+ */
+static void mig_throttle_vcpus_down(RAMState *rs, uint64_t quota)
+{
+    MigrationState *s = migrate_get_current();
+    DirtyRateSample *sample = &rs->dirty_rate_sample;
+    int pct_initial = s->parameters.cpu_throttle_initial;
+    int pct_icrement = s->parameters.cpu_throttle_increment;
+    int pct_max = s->parameters.max_cpu_throttle;
+    uint64_t share, new_share, light_total, rate;
+    int nr_vcpus = 0, nr_heavy, pct, old_pct;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        nr_vcpus++;
+    }
+    share = quota / MAX(nr_vcpus, 1);
+
+    for (;;) {
+        light_total = 0;
+        nr_heavy = 0;
+        CPU_FOREACH(cpu) {
+            rate = dirtyrate_sample_vcpu(sample, cpu);
+            if (rate <= share) {
+                light_total += rate;
+            } else {
+                nr_heavy++;
+            }
+        }
+        if (!nr_heavy || light_total >= quota) {
+            break;
+        }
+        new_share = (quota - light_total) / nr_heavy;
+        if (new_share <= share) {
+            break;
+        }
+        share = new_share;
+    }
+
+    CPU_FOREACH(cpu) {
+        rate = dirtyrate_sample_vcpu(sample, cpu);
+        old_pct = cpu_throttle_get_vcpu_percentage(cpu);
+
+        if (rate <= share) {
+            if (!old_pct) {
+                continue;
+            }
+            pct = old_pct - pct_icrement;
+            if (pct < pct_initial) {
+                pct = 0;
+            }
+            /* The rate grows with the time the vCPU runs */
+            if (rate * (100 - pct) > share * (100 - old_pct)) {
+                continue;
+            }
+        } else {
+            /* Scale the time the vCPU runs down to its share, but never
+             * make less progress than the uniform throttle would.
+             */
+            pct = 100 - (100 - old_pct) * share / rate;
+            pct = MAX(pct, old_pct ? old_pct + pct_icrement : pct_initial);
+            pct = MIN(pct, pct_max);
+        }
+
+        trace_migration_throttle_vcpu(cpu->cpu_index, rate, share, pct);
+        cpu_throttle_set_vcpu(cpu, pct);
+    }
+}
+
 /**
  * mig_throttle_guest_down: throotle down the guest
  *
@@ -1395,14 +1989,25 @@ static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
  * which we can transfer pages to the destination then we should be
  * able to complete migration. Some workloads dirty memory way too
  * fast and will not effectively converge, even with auto-converge.
+ *
+ * When the dirty rate of each vCPU is known, only the vCPUs that dirty
+ * memory too fast are throttled.
+ *
+ * @rs: current RAM state
+ * @quota: target dirty rate of the guest, in bytes per second
  */
-static void mig_throttle_guest_down(void)
+static void mig_throttle_guest_down(RAMState *rs, uint64_t quota)
 {
     MigrationState *s = migrate_get_current();
     uint64_t pct_initial = s->parameters.cpu_throttle_initial;
     uint64_t pct_icrement = s->parameters.cpu_throttle_increment;
     int pct_max = s->parameters.max_cpu_throttle;
 
+    if (dirtyrate_vcpu_supported()) {
+        mig_throttle_vcpus_down(rs, quota);
+        return;
+    }
+
     /* We have not started throttling yet. Let's start it. */
     if (!cpu_throttle_active()) {
         cpu_throttle_set(pct_initial);
@@ -1427,14 +2032,19 @@ static void mig_throttle_guest_down(void)
  */
 static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 {
+    PageCache *cache;
+
     if (rs->ram_bulk_stage || !migrate_use_xbzrle()) {
         return;
     }
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 ram_counters.dirty_sync_count);
+    cache = atomic_rcu_read(&XBZRLE.cache);
+    if (cache_insert(cache, current_addr, XBZRLE.zero_target_page,
+                     ram_counters.dirty_sync_count, NULL) == 1) {
+        xbzrle_counters.cache_eviction++;
+    }
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -1446,37 +2056,50 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
  *          0 means that page is identical to the one already sent
  *          -1 means that xbzrle would be longer than normal
  *
+ * When -1 is returned, *@current_data may have been changed to point to
+ * the cached copy of the page; its cache entry is then left claimed and
+ * stored in *@claimed, so that it does not change until the caller has
+ * sent it.
+ *
  * @rs: current RAM state
+ * @cache: the XBZRLE cache
  * @current_data: pointer to the address of the page contents
+ * @claimed: set to the cache entry that the caller must release
  * @current_addr: addr of the page
  * @block: block that contains the page we want to send
  * @offset: offset inside the block for the page
  * @last_stage: if we are at the completion stage
  */
-static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
+static int save_xbzrle_page(RAMState *rs, PageCache *cache,
+                            uint8_t **current_data, CacheItem **claimed,
                             ram_addr_t current_addr, RAMBlock *block,
                             ram_addr_t offset, bool last_stage)
 {
     int encoded_len = 0, bytes_xbzrle;
+    CacheItem *item;
     uint8_t *prev_cached_page;
+    int ret;
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr,
-                         ram_counters.dirty_sync_count)) {
+    item = cache_lookup(cache, current_addr, ram_counters.dirty_sync_count);
+    if (!item) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
-                return -1;
-            } else {
-                /* update *current_data when the page has been
-                   inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
+            /* update *current_data when the page has been
+               inserted into cache */
+            ret = cache_insert(cache, current_addr, *current_data,
+                               ram_counters.dirty_sync_count, &item);
+            if (ret == 1) {
+                xbzrle_counters.cache_eviction++;
+            }
+            if (ret >= 0) {
+                *current_data = cache_item_data(item);
+                *claimed = item;
             }
         }
         return -1;
     }
-
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    xbzrle_counters.cache_hit++;
+    prev_cached_page = cache_item_data(item);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -1487,6 +2110,7 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
                                        TARGET_PAGE_SIZE);
     if (encoded_len == 0) {
         trace_save_xbzrle_page_skipping();
+        cache_release(item);
         return 0;
     } else if (encoded_len == -1) {
         trace_save_xbzrle_page_overflow();
@@ -1495,6 +2119,9 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
         if (!last_stage) {
             memcpy(prev_cached_page, *current_data, TARGET_PAGE_SIZE);
             *current_data = prev_cached_page;
+            *claimed = item;
+        } else {
+            cache_release(item);
         }
         return -1;
     }
@@ -1503,6 +2130,7 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
     if (!last_stage) {
         memcpy(prev_cached_page, XBZRLE.current_buf, TARGET_PAGE_SIZE);
     }
+    cache_release(item);
 
     /* Send XBZRLE based compressed page */
     bytes_xbzrle = save_page_header(rs, rs->f, block,
@@ -1550,12 +2178,47 @@ unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     return next;
 }
 
+/* Granularity of the dirty log clears done with chunked-dirty-log-clear */
+#define DIRTY_LOG_CLEAR_CHUNK_SIZE  (256 * KiB)
+
+static void migration_clear_dirty_log(RAMBlock *rb, ram_addr_t start,
+                                      ram_addr_t length)
+{
+    int64_t start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+    trace_migration_bitmap_clear_dirty_log(rb->idstr, start, length);
+    memory_region_clear_dirty_bitmap(rb->mr, start, length);
+
+    ram_counters.dirty_log_clear_count++;
+    ram_counters.dirty_log_clear_time +=
+        qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_time;
+}
+
 static inline bool migration_bitmap_clear_dirty(RAMState *rs,
                                                 RAMBlock *rb,
                                                 unsigned long page)
 {
     bool ret;
 
+    /*
+     * Re-protect the chunk containing this page before it is sent, so that
+     * guest writes from now on are caught by the next sync.  This is done
+     * even if the page turns out to be clean, since the whole chunk is
+     * cleared at once.
+     */
+    if (rb->clear_bmap) {
+        unsigned long chunk = page >> rb->clear_bmap_shift;
+
+        if (test_and_clear_bit(chunk, rb->clear_bmap)) {
+            ram_addr_t size = 1ULL << (rb->clear_bmap_shift +
+                                       TARGET_PAGE_BITS);
+            ram_addr_t start = (ram_addr_t)chunk * size;
+
+            migration_clear_dirty_log(rb, start,
+                                      MIN(size, rb->used_length - start));
+        }
+    }
+
     ret = test_and_clear_bit(page, rb->bmap);
 
     if (ret) {
@@ -1570,6 +2233,22 @@ static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
     rs->migration_dirty_pages +=
         cpu_physical_memory_sync_dirty_bitmap(rb, start, length,
                                               &rs->num_dirty_pages_period);
+
+    /*
+     * With manual dirty log protection the pages just fetched are still
+     * writable in the guest.  Either remember which chunks need clearing
+     * before they are sent, or clear the whole range right away.
+     */
+    if (rb->clear_bmap) {
+        unsigned long first = (start >> TARGET_PAGE_BITS) >>
+                              rb->clear_bmap_shift;
+        unsigned long last = ((start + length - 1) >> TARGET_PAGE_BITS) >>
+                             rb->clear_bmap_shift;
+
+        bitmap_set(rb->clear_bmap, first, last - first + 1);
+    } else if (memory_global_dirty_log_clear_supported()) {
+        migration_clear_dirty_log(rb, start, length);
+    }
 }
 
 /**
@@ -1607,9 +2286,15 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 
     if (migrate_use_xbzrle()) {
-        xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
-            rs->xbzrle_cache_miss_prev) / page_count;
+        uint64_t misses = xbzrle_counters.cache_miss -
+                          rs->xbzrle_cache_miss_prev;
+        uint64_t hits = xbzrle_counters.cache_hit - rs->xbzrle_cache_hit_prev;
+
+        xbzrle_counters.cache_miss_rate = (double)misses / page_count;
+        xbzrle_counters.cache_hit_rate = hits + misses ?
+                                         (double)hits / (hits + misses) : 0;
         rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
+        rs->xbzrle_cache_hit_prev = xbzrle_counters.cache_hit;
     }
 
     if (migrate_use_compression()) {
@@ -1648,6 +2333,10 @@ static void migration_bitmap_sync(RAMState *rs)
     trace_migration_bitmap_sync_start();
     memory_global_dirty_log_sync();
 
+    if (dirtyrate_vcpu_supported() && !rs->dirty_rate_sample.start_ms) {
+        dirtyrate_sample_start(&rs->dirty_rate_sample);
+    }
+
     qemu_mutex_lock(&rs->bitmap_mutex);
     rcu_read_lock();
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
@@ -1665,6 +2354,10 @@ static void migration_bitmap_sync(RAMState *rs)
     if (end_time > rs->time_last_bitmap_sync + 1000) {
         bytes_xfer_now = ram_counters.transferred;
 
+        if (dirtyrate_vcpu_supported()) {
+            dirtyrate_sample_end(&rs->dirty_rate_sample);
+        }
+
         /* During block migration the auto-converge logic incorrectly detects
          * that ram migration makes no progress. Avoid this by disabling the
          * throttling logic during the bulk phase of block migration. */
@@ -1675,12 +2368,18 @@ static void migration_bitmap_sync(RAMState *rs)
                were in this routine. If that happens twice, start or increase
                throttling */
 
+            uint64_t quota = (bytes_xfer_now - rs->bytes_xfer_prev) / 2 *
+                             1000 / (end_time - rs->time_last_bitmap_sync);
+
             if ((rs->num_dirty_pages_period * TARGET_PAGE_SIZE >
                    (bytes_xfer_now - rs->bytes_xfer_prev) / 2) &&
                 (++rs->dirty_rate_high_cnt >= 2)) {
                     trace_migration_throttle();
                     rs->dirty_rate_high_cnt = 0;
-                    mig_throttle_guest_down();
+                    mig_throttle_guest_down(rs, quota);
+            } else if (dirtyrate_vcpu_supported() && cpu_throttle_active()) {
+                /* Let the vCPUs that slowed down run faster again */
+                mig_throttle_vcpus_down(rs, quota);
             }
         }
 
@@ -1836,19 +2535,24 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
 {
     int pages = -1;
     uint8_t *p;
-    bool send_async = true;
+    /*
+     * A background snapshot lets the guest write to the page as soon as
+     * it is saved, so it must be copied to the stream buffer.
+     */
+    bool send_async = !migrate_background_snapshot();
     RAMBlock *block = pss->block;
     ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
     ram_addr_t current_addr = block->offset + offset;
+    CacheItem *claimed = NULL;
 
     p = block->host + offset;
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
-    XBZRLE_cache_lock();
     if (!rs->ram_bulk_stage && !migration_in_postcopy() &&
         migrate_use_xbzrle()) {
-        pages = save_xbzrle_page(rs, &p, current_addr, block,
-                                 offset, last_stage);
+        pages = save_xbzrle_page(rs, atomic_rcu_read(&XBZRLE.cache), &p,
+                                 &claimed, current_addr, block, offset,
+                                 last_stage);
         if (!last_stage) {
             /* Can't send this cached data async, since the cache page
              * might get updated before it gets to the wire
@@ -1862,7 +2566,10 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
         pages = save_normal_page(rs, block, offset, p, send_async);
     }
 
-    XBZRLE_cache_unlock();
+    /* The page was sent from the cache, let others update it again */
+    if (claimed) {
+        cache_release(claimed);
+    }
 
     return pages;
 }
@@ -2001,94 +2708,467 @@ retry:
     return pages;
 }
 
-/**
- * find_dirty_block: find the next dirty page and update any state
- * associated with the search process.
- *
- * Returns if a page is found
- *
- * @rs: current RAM state
- * @pss: data about the state of the current dirty page scan
- * @again: set to false if the search has scanned the whole of RAM
- */
-static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
+/**
+ * find_dirty_block: find the next dirty page and update any state
+ * associated with the search process.
+ *
+ * Returns if a page is found
+ *
+ * @rs: current RAM state
+ * @pss: data about the state of the current dirty page scan
+ * @again: set to false if the search has scanned the whole of RAM
+ */
+static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
+{
+    pss->page = migration_bitmap_find_dirty(rs, pss->block, pss->page);
+    if (pss->complete_round && pss->block == rs->last_seen_block &&
+        pss->page >= rs->last_page) {
+        /*
+         * We've been once around the RAM and haven't found anything.
+         * Give up.
+         */
+        *again = false;
+        return false;
+    }
+    if ((pss->page << TARGET_PAGE_BITS) >= pss->block->used_length) {
+        /* Didn't find anything in this RAM Block */
+        pss->page = 0;
+        pss->block = QLIST_NEXT_RCU(pss->block, next);
+        if (!pss->block) {
+            /*
+             * If memory migration starts over, we will meet a dirtied page
+             * which may still exists in compression threads's ring, so we
+             * should flush the compressed data to make sure the new page
+             * is not overwritten by the old one in the destination.
+             *
+             * Also If xbzrle is on, stop using the data compression at this
+             * point. In theory, xbzrle can do better than compression.
+             */
+            flush_compressed_data(rs);
+
+            /* Hit the end of the list */
+            pss->block = QLIST_FIRST_RCU(&ram_list.blocks);
+            /* Flag that we've looped */
+            pss->complete_round = true;
+            rs->ram_bulk_stage = false;
+        }
+        /* Didn't find anything this time, but try again on the new block */
+        *again = true;
+        return false;
+    } else {
+        /* Can go around again, but... */
+        *again = true;
+        /* We've found something so probably don't need to */
+        return true;
+    }
+}
+
+/*
+ * Background snapshots write protect guest RAM with userfaultfd while the
+ * VM is stopped, then save the pages while it runs again.  A page that the
+ * guest writes to is saved first and only then unprotected, so that the
+ * snapshot holds RAM as it was when the VM stopped and each page is saved
+ * exactly once.
+ */
+#if defined(__linux__) && defined(__NR_userfaultfd)
+
+static int uffd_open(uint64_t features)
+{
+    struct uffdio_api api_struct = { 0 };
+    int ufd;
+
+    ufd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (ufd == -1) {
+        error_report("%s: syscall __NR_userfaultfd failed: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+
+    api_struct.api = UFFD_API;
+    api_struct.features = features;
+    if (ioctl(ufd, UFFDIO_API, &api_struct)) {
+        error_report("%s: UFFDIO_API failed: %s", __func__, strerror(errno));
+        close(ufd);
+        return -1;
+    }
+
+    return ufd;
+}
+
+static int uffd_register_wp(int ufd, void *addr, uint64_t length,
+                            uint64_t *ioctls)
+{
+    struct uffdio_register reg_struct = { 0 };
+
+    reg_struct.range.start = (uintptr_t)addr;
+    reg_struct.range.len = length;
+    reg_struct.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(ufd, UFFDIO_REGISTER, &reg_struct)) {
+        return -errno;
+    }
+
+    *ioctls = reg_struct.ioctls;
+    return 0;
+}
+
+static int uffd_unregister(int ufd, void *addr, uint64_t length)
+{
+    struct uffdio_range range_struct = {
+        .start = (uintptr_t)addr,
+        .len = length,
+    };
+
+    if (ioctl(ufd, UFFDIO_UNREGISTER, &range_struct)) {
+        return -errno;
+    }
+    return 0;
+}
+
+/* Removing the protection also wakes up the threads faulting on it */
+static int uffd_change_protection(int ufd, void *addr, uint64_t length,
+                                  bool wp)
+{
+    struct uffdio_writeprotect wp_struct = { 0 };
+
+    wp_struct.range.start = (uintptr_t)addr;
+    wp_struct.range.len = length;
+    wp_struct.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    if (ioctl(ufd, UFFDIO_WRITEPROTECT, &wp_struct)) {
+        int ret = -errno;
+
+        error_report("%s: UFFDIO_WRITEPROTECT failed: %s", __func__,
+                     strerror(-ret));
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * ram_write_tracking_available: check if the host can write protect RAM
+ *
+ * Returns true if userfaultfd supports write protection faults
+ */
+bool ram_write_tracking_available(void)
+{
+    struct uffdio_api api_struct = { 0 };
+    int ufd;
+    bool ret;
+
+    ufd = syscall(__NR_userfaultfd, O_CLOEXEC);
+    if (ufd == -1) {
+        return false;
+    }
+
+    api_struct.api = UFFD_API;
+    ret = !ioctl(ufd, UFFDIO_API, &api_struct) &&
+          (api_struct.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP);
+    close(ufd);
+    return ret;
+}
+
+/**
+ * ram_write_tracking_compatible: check if all of guest RAM can be write
+ *   protected
+ *
+ * Write protection is not available for every kind of memory backend
+ * (e.g. hugetlbfs and shared memory on older kernels).
+ */
+bool ram_write_tracking_compatible(void)
+{
+    const uint64_t ioctl_mask = (uint64_t)1 << _UFFDIO_WRITEPROTECT;
+    RAMBlock *block;
+    uint64_t ioctls;
+    bool ret = true;
+    int ufd;
+
+    ufd = uffd_open(UFFD_FEATURE_PAGEFAULT_FLAG_WP);
+    if (ufd < 0) {
+        return false;
+    }
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        if (block->mr->readonly) {
+            continue;
+        }
+        if (uffd_register_wp(ufd, block->host, block->max_length, &ioctls)) {
+            ret = false;
+            break;
+        }
+        uffd_unregister(ufd, block->host, block->max_length);
+        if ((ioctls & ioctl_mask) != ioctl_mask) {
+            ret = false;
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    close(ufd);
+    return ret;
+}
+
+static void ram_write_tracking_release_all(int ufd)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        if (!(block->flags & RAM_UF_WRITEPROTECT)) {
+            continue;
+        }
+        uffd_change_protection(ufd, block->host, block->max_length, false);
+        uffd_unregister(ufd, block->host, block->max_length);
+        block->flags &= ~RAM_UF_WRITEPROTECT;
+        memory_region_unref(block->mr);
+    }
+}
+
+/**
+ * ram_write_tracking_start: write protect guest RAM
+ *
+ * Must be called with the VM stopped, after ram_save_setup.
+ *
+ * Returns 0 for success or -1 for error
+ */
+int ram_write_tracking_start(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+    uint64_t ioctls;
+    int ufd, ret;
+
+    ufd = uffd_open(UFFD_FEATURE_PAGEFAULT_FLAG_WP);
+    if (ufd < 0) {
+        return -1;
+    }
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        /* The guest cannot write to ROM, nothing to track */
+        if (block->mr->readonly) {
+            continue;
+        }
+
+        ret = uffd_register_wp(ufd, block->host, block->max_length, &ioctls);
+        if (ret) {
+            error_report("%s: cannot register block %s: %s", __func__,
+                         block->idstr, strerror(-ret));
+            goto fail;
+        }
+        block->flags |= RAM_UF_WRITEPROTECT;
+        memory_region_ref(block->mr);
+
+        if (uffd_change_protection(ufd, block->host, block->used_length,
+                                   true)) {
+            goto fail;
+        }
+        trace_ram_write_tracking_ramblock_start(block->idstr,
+                                                block->host,
+                                                block->used_length);
+    }
+    rcu_read_unlock();
+
+    rs->uffdio_fd = ufd;
+    return 0;
+
+fail:
+    ram_write_tracking_release_all(ufd);
+    rcu_read_unlock();
+    close(ufd);
+    return -1;
+}
+
+/**
+ * ram_write_tracking_stop: remove the write protection of guest RAM
+ *
+ * Wakes up any thread still blocked on a write fault.
+ */
+void ram_write_tracking_stop(void)
+{
+    RAMState *rs = ram_state;
+
+    if (!rs || rs->uffdio_fd < 0) {
+        return;
+    }
+
+    rcu_read_lock();
+    ram_write_tracking_release_all(rs->uffdio_fd);
+    rcu_read_unlock();
+
+    close(rs->uffdio_fd);
+    rs->uffdio_fd = -1;
+}
+
+/**
+ * ram_write_tracking_wait: wait for a write fault
+ *
+ * Returns true if a write fault is pending
+ *
+ * @timeout_ms: how long to wait, 0 to only check
+ */
+bool ram_write_tracking_wait(int timeout_ms)
+{
+    RAMState *rs = ram_state;
+    struct pollfd pfd;
+
+    if (!rs || rs->uffdio_fd < 0) {
+        return false;
+    }
+
+    pfd.fd = rs->uffdio_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, MAX(timeout_ms, 0)) > 0 && (pfd.revents & POLLIN);
+}
+
+/**
+ * poll_fault_page: get the page of the next write fault
+ *
+ * Returns the block of the page, or NULL if no write fault is pending
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset of the host page within the block
+ */
+static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
+{
+    struct uffd_msg msg;
+    RAMBlock *block;
+    void *host;
+
+    if (rs->uffdio_fd < 0) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (read(rs->uffdio_fd, &msg, sizeof(msg)) != sizeof(msg)) {
+            /* EAGAIN: nothing pending */
+            return NULL;
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT ||
+            !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+            continue;
+        }
+
+        host = (void *)(uintptr_t)msg.arg.pagefault.address;
+        block = qemu_ram_block_from_host(host, false, offset);
+        assert(block && (block->flags & RAM_UF_WRITEPROTECT));
+        *offset = QEMU_ALIGN_DOWN(*offset, qemu_ram_pagesize(block));
+        trace_poll_fault_page(block->idstr, *offset);
+        return block;
+    }
+}
+
+/**
+ * ram_save_release_protection: let the guest write to the pages just saved
+ *
+ * The pages were copied to the stream buffer, so they can be written to
+ * again; this also wakes up the vCPUs that faulted on them.
+ *
+ * Returns 0 for success or negative value on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the last page saved
+ * @start_page: first page of the host page that was saved
+ */
+static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
+                                       unsigned long start_page)
+{
+    size_t pagesize_bits = qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long first = QEMU_ALIGN_DOWN(start_page, pagesize_bits);
+    void *host = pss->block->host + (first << TARGET_PAGE_BITS);
+
+    if (!(pss->block->flags & RAM_UF_WRITEPROTECT)) {
+        return 0;
+    }
+
+    return uffd_change_protection(rs->uffdio_fd, host,
+                                  (pss->page + 1 - first) << TARGET_PAGE_BITS,
+                                  false);
+}
+
+#else
+
+bool ram_write_tracking_available(void)
+{
+    return false;
+}
+
+bool ram_write_tracking_compatible(void)
+{
+    return false;
+}
+
+int ram_write_tracking_start(void)
+{
+    error_report("%s: userfaultfd write protection is not supported on "
+                 "this host", __func__);
+    return -1;
+}
+
+void ram_write_tracking_stop(void)
+{
+}
+
+bool ram_write_tracking_wait(int timeout_ms)
+{
+    return false;
+}
+
+static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
 {
-    pss->page = migration_bitmap_find_dirty(rs, pss->block, pss->page);
-    if (pss->complete_round && pss->block == rs->last_seen_block &&
-        pss->page >= rs->last_page) {
-        /*
-         * We've been once around the RAM and haven't found anything.
-         * Give up.
-         */
-        *again = false;
-        return false;
-    }
-    if ((pss->page << TARGET_PAGE_BITS) >= pss->block->used_length) {
-        /* Didn't find anything in this RAM Block */
-        pss->page = 0;
-        pss->block = QLIST_NEXT_RCU(pss->block, next);
-        if (!pss->block) {
-            /*
-             * If memory migration starts over, we will meet a dirtied page
-             * which may still exists in compression threads's ring, so we
-             * should flush the compressed data to make sure the new page
-             * is not overwritten by the old one in the destination.
-             *
-             * Also If xbzrle is on, stop using the data compression at this
-             * point. In theory, xbzrle can do better than compression.
-             */
-            flush_compressed_data(rs);
+    return NULL;
+}
 
-            /* Hit the end of the list */
-            pss->block = QLIST_FIRST_RCU(&ram_list.blocks);
-            /* Flag that we've looped */
-            pss->complete_round = true;
-            rs->ram_bulk_stage = false;
-        }
-        /* Didn't find anything this time, but try again on the new block */
-        *again = true;
-        return false;
-    } else {
-        /* Can go around again, but... */
-        *again = true;
-        /* We've found something so probably don't need to */
-        return true;
-    }
+static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
+                                       unsigned long start_page)
+{
+    return 0;
 }
 
+#endif /* defined(__linux__) && defined(__NR_userfaultfd) */
+
 /**
  * unqueue_page: gets a page of the queue
  *
- * Helper for 'get_queued_page' - gets a page off the queue
+ * Helper for 'get_queued_page' - gets a page off the queue.  Pages
+ * requested by the destination come before prefetched ones.
  *
  * Returns the block of the page (or NULL if none available)
  *
  * @rs: current RAM state
  * @offset: used to return the offset within the RAMBlock
+ * @urgent: set if the page was requested by the destination
  */
-static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
+static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset, bool *urgent)
 {
     RAMBlock *block = NULL;
 
-    if (QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests)) {
+    *urgent = false;
+    if (QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests) &&
+        QSIMPLEQ_EMPTY_ATOMIC(&rs->src_prefetch_requests)) {
         return NULL;
     }
 
     qemu_mutex_lock(&rs->src_page_req_mutex);
-    if (!QSIMPLEQ_EMPTY(&rs->src_page_requests)) {
-        struct RAMSrcPageRequest *entry =
-                                QSIMPLEQ_FIRST(&rs->src_page_requests);
+    *urgent = !QSIMPLEQ_EMPTY(&rs->src_page_requests);
+    if (*urgent || !QSIMPLEQ_EMPTY(&rs->src_prefetch_requests)) {
+        struct RAMSrcPageRequest *entry = *urgent ?
+                                QSIMPLEQ_FIRST(&rs->src_page_requests) :
+                                QSIMPLEQ_FIRST(&rs->src_prefetch_requests);
         block = entry->rb;
         *offset = entry->offset;
 
         if (entry->len > TARGET_PAGE_SIZE) {
             entry->len -= TARGET_PAGE_SIZE;
             entry->offset += TARGET_PAGE_SIZE;
-        } else {
+        } else if (*urgent) {
             memory_region_unref(block->mr);
             QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
             g_free(entry);
             migration_consume_urgent_request();
+        } else {
+            memory_region_unref(block->mr);
+            QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+            g_free(entry);
         }
     }
     qemu_mutex_unlock(&rs->src_page_req_mutex);
@@ -2105,15 +3185,16 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
  *
  * @rs: current RAM state
  * @pss: data about the state of the current dirty page scan
+ * @urgent: set if the page was requested by the destination
  */
-static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
+static bool get_queued_page(RAMState *rs, PageSearchStatus *pss, bool *urgent)
 {
     RAMBlock  *block;
     ram_addr_t offset;
     bool dirty;
 
     do {
-        block = unqueue_page(rs, &offset);
+        block = unqueue_page(rs, &offset, urgent);
         /*
          * We're sending this page, and since it's postcopy nothing else
          * will dirty it, and we must make sure it doesn't get sent again
@@ -2135,6 +3216,22 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     } while (block && !dirty);
 
+    /*
+     * With background snapshots, a vCPU that faulted on a write protected
+     * page is blocked until the page is saved, so serve it like a request.
+     */
+    while (!block) {
+        block = poll_fault_page(rs, &offset);
+        if (!block) {
+            break;
+        }
+        dirty = test_bit(offset >> TARGET_PAGE_BITS, block->bmap);
+        if (!dirty) {
+            /* Already saved, the protection was removed meanwhile */
+            block = NULL;
+        }
+    }
+
     if (block) {
         /*
          * As soon as we start servicing pages out of order, then we have
@@ -2176,6 +3273,12 @@ static void migration_page_queue_free(RAMState *rs)
         QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
         g_free(mspr);
     }
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_prefetch_requests, next_req,
+                          next_mspr) {
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+        g_free(mspr);
+    }
     rcu_read_unlock();
 }
 
@@ -2186,6 +3289,9 @@ static void migration_page_queue_free(RAMState *rs)
  *
  * Returns zero on success or negative on error
  *
+ * The postcopy-prefetch-pages pages after the requested range are
+ * queued as well, behind any other request.
+ *
  * @rbname: Name of the RAMBLock of the request. NULL means the
  *          same that last one.
  * @start: starting address from the start of the RAMBlock
@@ -2195,6 +3301,7 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
 {
     RAMBlock *ramblock;
     RAMState *rs = ram_state;
+    ram_addr_t prefetch_len;
 
     ram_counters.postcopy_requests++;
     rcu_read_lock();
@@ -2238,6 +3345,22 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
     qemu_mutex_lock(&rs->src_page_req_mutex);
     QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
     migration_make_urgent_request();
+
+    prefetch_len = MIN((ram_addr_t)migrate_postcopy_prefetch_pages() *
+                       qemu_ram_pagesize(ramblock),
+                       ramblock->used_length - (start + len));
+    if (prefetch_len) {
+        struct RAMSrcPageRequest *prefetch =
+            g_malloc0(sizeof(struct RAMSrcPageRequest));
+        prefetch->rb = ramblock;
+        prefetch->offset = start + len;
+        prefetch->len = prefetch_len;
+
+        memory_region_ref(ramblock->mr);
+        QSIMPLEQ_INSERT_TAIL(&rs->src_prefetch_requests, prefetch, next_req);
+        trace_ram_save_queue_pages_prefetch(ramblock->idstr, start + len,
+                                            prefetch_len);
+    }
     qemu_mutex_unlock(&rs->src_page_req_mutex);
     rcu_read_unlock();
 
@@ -2300,6 +3423,284 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
     return false;
 }
 
+/* Fixed-ram: pages are written to and read from their own place in a file */
+
+#define FIXED_RAM_HDR_VERSION 1
+/* The pages region of each block starts on this boundary in the file */
+#define FIXED_RAM_FILE_ALIGN (1 * MiB)
+/* Largest run of contiguous pages handed to a thread in one go */
+#define FIXED_RAM_EXTENT_MAX (1 * MiB)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t offset;
+    size_t len;
+} FixedRamExtent;
+
+static struct {
+    QemuThread *threads;
+    int thread_count;
+    QEMUFile *file;
+    /* true on the destination, threads read pages instead of writing */
+    bool load;
+    QemuMutex mutex;
+    /* signalled when a request is queued or the threads should quit */
+    QemuCond work_cond;
+    /* signalled when a request is taken or completed */
+    QemuCond done_cond;
+    /* protected by mutex; req.block is NULL when no request is queued */
+    FixedRamExtent req;
+    int busy;
+    int error;
+    bool quit;
+    /* run of pages being built up by the migration thread */
+    FixedRamExtent pending;
+} fixed_ram;
+
+static void *fixed_ram_thread(void *opaque)
+{
+    qemu_mutex_lock(&fixed_ram.mutex);
+    while (true) {
+        FixedRamExtent req = fixed_ram.req;
+        uint8_t *host;
+        uint64_t pos;
+        ssize_t ret;
+
+        if (!req.block) {
+            if (fixed_ram.quit) {
+                break;
+            }
+            qemu_cond_wait(&fixed_ram.work_cond, &fixed_ram.mutex);
+            continue;
+        }
+
+        fixed_ram.req.block = NULL;
+        fixed_ram.busy++;
+        qemu_cond_broadcast(&fixed_ram.done_cond);
+        qemu_mutex_unlock(&fixed_ram.mutex);
+
+        host = req.block->host + req.offset;
+        pos = req.block->pages_offset + req.offset;
+        if (fixed_ram.load) {
+            ret = qemu_file_pread(fixed_ram.file, host, req.len, pos);
+        } else {
+            ret = qemu_file_pwrite(fixed_ram.file, host, req.len, pos);
+        }
+
+        qemu_mutex_lock(&fixed_ram.mutex);
+        if (ret < 0 && !fixed_ram.error) {
+            fixed_ram.error = ret;
+        }
+        fixed_ram.busy--;
+        qemu_cond_broadcast(&fixed_ram.done_cond);
+    }
+    qemu_mutex_unlock(&fixed_ram.mutex);
+
+    return NULL;
+}
+
+static void fixed_ram_threads_create(QEMUFile *f, bool load)
+{
+    int i;
+
+    fixed_ram.thread_count = migrate_multifd_channels();
+    fixed_ram.threads = g_new0(QemuThread, fixed_ram.thread_count);
+    fixed_ram.file = f;
+    fixed_ram.load = load;
+    fixed_ram.req.block = NULL;
+    fixed_ram.pending.len = 0;
+    fixed_ram.busy = 0;
+    fixed_ram.error = 0;
+    fixed_ram.quit = false;
+    qemu_mutex_init(&fixed_ram.mutex);
+    qemu_cond_init(&fixed_ram.work_cond);
+    qemu_cond_init(&fixed_ram.done_cond);
+    for (i = 0; i < fixed_ram.thread_count; i++) {
+        qemu_thread_create(fixed_ram.threads + i,
+                           load ? "fixed-ram-load" : "fixed-ram-save",
+                           fixed_ram_thread, NULL, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void fixed_ram_threads_join(void)
+{
+    int i;
+
+    if (!fixed_ram.threads) {
+        return;
+    }
+
+    qemu_mutex_lock(&fixed_ram.mutex);
+    fixed_ram.quit = true;
+    qemu_cond_broadcast(&fixed_ram.work_cond);
+    qemu_mutex_unlock(&fixed_ram.mutex);
+
+    for (i = 0; i < fixed_ram.thread_count; i++) {
+        qemu_thread_join(fixed_ram.threads + i);
+    }
+    qemu_mutex_destroy(&fixed_ram.mutex);
+    qemu_cond_destroy(&fixed_ram.work_cond);
+    qemu_cond_destroy(&fixed_ram.done_cond);
+    g_free(fixed_ram.threads);
+    fixed_ram.threads = NULL;
+    fixed_ram.file = NULL;
+}
+
+/* Hand a run of pages to the first free thread */
+static void fixed_ram_queue(RAMBlock *block, ram_addr_t offset, size_t len)
+{
+    qemu_mutex_lock(&fixed_ram.mutex);
+    while (fixed_ram.req.block) {
+        qemu_cond_wait(&fixed_ram.done_cond, &fixed_ram.mutex);
+    }
+    fixed_ram.req.block = block;
+    fixed_ram.req.offset = offset;
+    fixed_ram.req.len = len;
+    qemu_cond_signal(&fixed_ram.work_cond);
+    qemu_mutex_unlock(&fixed_ram.mutex);
+}
+
+/**
+ * fixed_ram_flush: wait until all queued pages are in the file or in RAM
+ *
+ * Returns zero on success or the first error hit by a thread
+ */
+static int fixed_ram_flush(void)
+{
+    int ret;
+
+    if (!fixed_ram.threads) {
+        return 0;
+    }
+
+    if (fixed_ram.pending.len) {
+        fixed_ram_queue(fixed_ram.pending.block, fixed_ram.pending.offset,
+                        fixed_ram.pending.len);
+        fixed_ram.pending.len = 0;
+    }
+
+    qemu_mutex_lock(&fixed_ram.mutex);
+    while (fixed_ram.req.block || fixed_ram.busy) {
+        qemu_cond_wait(&fixed_ram.done_cond, &fixed_ram.mutex);
+    }
+    ret = fixed_ram.error;
+    qemu_mutex_unlock(&fixed_ram.mutex);
+
+    return ret;
+}
+
+/* Add a page to the current run, queueing the run if the page doesn't fit */
+static void fixed_ram_add_page(RAMBlock *block, ram_addr_t offset)
+{
+    FixedRamExtent *ext = &fixed_ram.pending;
+
+    if (ext->len && (ext->block != block ||
+                     ext->offset + ext->len != offset ||
+                     ext->len >= FIXED_RAM_EXTENT_MAX)) {
+        fixed_ram_queue(ext->block, ext->offset, ext->len);
+        ext->len = 0;
+    }
+    if (!ext->len) {
+        ext->block = block;
+        ext->offset = offset;
+    }
+    ext->len += TARGET_PAGE_SIZE;
+}
+
+/**
+ * ram_save_fixed_ram_page: save a page at its place in the file
+ *
+ * Zero pages are only recorded in the block's file bitmap, other pages
+ * are written by the fixed-ram threads.  Nothing goes into the stream.
+ *
+ * Returns the number of pages written
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_fixed_ram_page(RAMState *rs, RAMBlock *block,
+                                   ram_addr_t offset)
+{
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+
+    if (is_zero_range(block->host + offset, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    set_bit(page, block->file_bmap);
+    fixed_ram_add_page(block, offset);
+
+    ram_counters.normal++;
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    qemu_update_position(rs->f, TARGET_PAGE_SIZE);
+    return 1;
+}
+
+/* Size of a block's bitmap in the file, independent of the host's long */
+static size_t fixed_ram_bitmap_size(RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+
+    return ROUND_UP(pages, 64) / BITS_PER_BYTE;
+}
+
+/*
+ * Write the fixed-ram header of a block in the stream and skip the
+ * regions of the file that will hold its bitmap and pages.
+ */
+static int fixed_ram_save_block_header(QEMUFile *f, RAMBlock *block)
+{
+    int64_t pos = qemu_file_seek(f, 0, SEEK_CUR);
+
+    if (pos < 0) {
+        return pos;
+    }
+
+    /* version, page size and two offsets */
+    block->bitmap_offset = pos + 4 + 3 * 8;
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   fixed_ram_bitmap_size(block),
+                                   FIXED_RAM_FILE_ALIGN);
+    qemu_put_be32(f, FIXED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    pos = qemu_file_seek(f, block->pages_offset + block->used_length,
+                         SEEK_SET);
+    return pos < 0 ? pos : 0;
+}
+
+/* Write the file bitmap of every block, once all pages are in the file */
+static int fixed_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+    int ret;
+
+    ret = fixed_ram_flush();
+    if (ret) {
+        return ret;
+    }
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t size = fixed_ram_bitmap_size(block);
+        unsigned long *le_bmap = g_malloc0(size);
+
+        bitmap_to_le(le_bmap, block->file_bmap, pages);
+        ret = qemu_file_pwrite(f, (uint8_t *)le_bmap, size,
+                               block->bitmap_offset);
+        g_free(le_bmap);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -2316,6 +3717,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
     ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
     int res;
 
+    if (migrate_fixed_ram()) {
+        return ram_save_fixed_ram_page(rs, block, offset);
+    }
+
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
@@ -2330,9 +3735,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
          * page would be stale
          */
         if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
             xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
         }
         ram_release_pages(block->idstr, offset, res);
         return res;
@@ -2370,9 +3773,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
                               bool last_stage)
 {
-    int tmppages, pages = 0;
+    int tmppages, pages = 0, ret;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = pss->page;
 
     if (!qemu_ram_is_migratable(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
@@ -2402,7 +3806,9 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
 
     /* The offset we leave with is the last one we looked at */
     pss->page--;
-    return pages;
+
+    ret = ram_save_release_protection(rs, pss, start_page);
+    return ret < 0 ? ret : pages;
 }
 
 /**
@@ -2424,7 +3830,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 {
     PageSearchStatus pss;
     int pages = 0;
-    bool again, found;
+    bool again, found, urgent = false;
 
     /* No dirty page as there is zero RAM */
     if (!ram_bytes_total()) {
@@ -2441,7 +3847,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 
     do {
         again = true;
-        found = get_queued_page(rs, &pss);
+        found = get_queued_page(rs, &pss, &urgent);
 
         if (!found) {
             /* priority queue empty, so just search for something dirty */
@@ -2453,6 +3859,15 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         }
     } while (!pages && again);
 
+    /*
+     * Don't let requested pages sit in the buffer behind background
+     * pages: push them out as soon as all pending requests are served.
+     */
+    if (urgent && pages > 0 &&
+        QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests)) {
+        qemu_fflush(rs->f);
+    }
+
     rs->last_seen_block = pss.block;
     rs->last_page = pss.page;
 
@@ -2500,6 +3915,7 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        dirtyrate_sample_destroy(&(*rsp)->dirty_rate_sample);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -2531,15 +3947,24 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against this migration_bitmap
      */
-    memory_global_dirty_log_stop();
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_stop();
+    } else {
+        memory_global_dirty_log_stop();
+    }
 
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
         g_free(block->bmap);
         block->bmap = NULL;
         g_free(block->unsentmap);
         block->unsentmap = NULL;
+        g_free(block->clear_bmap);
+        block->clear_bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
+    fixed_ram_threads_join();
     xbzrle_cleanup();
     compress_threads_save_cleanup();
     ram_state_cleanup(rsp);
@@ -3029,6 +4454,8 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->src_prefetch_requests);
+    (*rsp)->uffdio_fd = -1;
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -3056,6 +4483,14 @@ static void ram_list_init_bitmaps(void)
                 block->unsentmap = bitmap_new(pages);
                 bitmap_set(block->unsentmap, 0, pages);
             }
+            if (migrate_chunked_dirty_log_clear()) {
+                unsigned long chunk = DIRTY_LOG_CLEAR_CHUNK_SIZE;
+
+                block->clear_bmap_shift =
+                    MAX(ctzl(chunk) - TARGET_PAGE_BITS, 0);
+                block->clear_bmap = bitmap_new(DIV_ROUND_UP(pages,
+                                               1UL << block->clear_bmap_shift));
+            }
         }
     }
 }
@@ -3068,8 +4503,12 @@ static void ram_init_bitmaps(RAMState *rs)
     rcu_read_lock();
 
     ram_list_init_bitmaps();
-    memory_global_dirty_log_start();
-    migration_bitmap_sync(rs);
+    /* Background snapshots save each page once, starting from a full bitmap */
+    if (!migrate_background_snapshot()) {
+        dirtyrate_dirty_log_handover();
+        memory_global_dirty_log_start();
+        migration_bitmap_sync(rs);
+    }
 
     rcu_read_unlock();
     qemu_mutex_unlock_ramlist();
@@ -3171,10 +4610,26 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         if (migrate_postcopy_ram() && block->page_size != qemu_host_page_size) {
             qemu_put_be64(f, block->page_size);
         }
+        if (migrate_fixed_ram()) {
+            int ret;
+
+            block->file_bmap =
+                bitmap_new(block->used_length >> TARGET_PAGE_BITS);
+            ret = fixed_ram_save_block_header(f, block);
+            if (ret < 0) {
+                error_report("Migration file is not seekable");
+                rcu_read_unlock();
+                return ret;
+            }
+        }
     }
 
     rcu_read_unlock();
 
+    if (migrate_fixed_ram()) {
+        fixed_ram_threads_create(f, false);
+    }
+
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
 
@@ -3257,6 +4712,14 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         }
         i++;
     }
+
+    if (migrate_fixed_ram()) {
+        /* The threads must be done with the blocks before we leave RCU */
+        ret = fixed_ram_flush();
+        if (ret < 0) {
+            qemu_file_set_error(f, ret);
+        }
+    }
     rcu_read_unlock();
 
     /*
@@ -3297,7 +4760,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     rcu_read_lock();
 
-    if (!migration_in_postcopy()) {
+    /*
+     * A background snapshot saves RAM as it was when the snapshot started;
+     * pages written since then must not be picked up again.
+     */
+    if (!migration_in_postcopy() && !migrate_background_snapshot()) {
         migration_bitmap_sync(rs);
     }
 
@@ -3320,6 +4787,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         }
     }
 
+    if (!ret && migrate_fixed_ram()) {
+        ret = fixed_ram_save_bitmaps(f);
+    }
+
     flush_compressed_data(rs);
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
@@ -3714,6 +5185,7 @@ int colo_init_ram_cache(void)
     }
     ram_state = g_new0(RAMState, 1);
     ram_state->migration_dirty_pages = 0;
+    dirtyrate_dirty_log_handover();
     memory_global_dirty_log_start();
 
     return 0;
@@ -3773,6 +5245,10 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
     xbzrle_load_setup();
     ramblock_recv_map_init();
 
+    if (migrate_fixed_ram()) {
+        fixed_ram_threads_create(f, true);
+    }
+
     return 0;
 }
 
@@ -3788,10 +5264,13 @@ static int ram_load_cleanup(void *opaque)
 
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
+    fixed_ram_threads_join();
 
     RAMBLOCK_FOREACH_MIGRATABLE(rb) {
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
+        g_free(rb->file_bmap);
+        rb->file_bmap = NULL;
     }
 
     return 0;
@@ -4016,6 +5495,79 @@ static void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/**
+ * ram_load_fixed_ram_block: load the pages of a block from the file
+ *
+ * Reads the fixed-ram header of @block from the stream, then reads its
+ * pages from the file in parallel and moves the stream past them.
+ *
+ * Returns zero on success or negative on error
+ *
+ * @f: QEMUFile where the stream comes from
+ * @block: RAM block to load
+ */
+static int ram_load_fixed_ram_block(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    unsigned long extent = FIXED_RAM_EXTENT_MAX >> TARGET_PAGE_BITS;
+    size_t size = fixed_ram_bitmap_size(block);
+    unsigned long run_start, run_end, page;
+    unsigned long *le_bmap;
+    uint32_t version;
+    uint64_t page_size;
+    int64_t pos;
+    int ret;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+    if (version != FIXED_RAM_HDR_VERSION) {
+        error_report("Unsupported fixed-ram version %u for block %s",
+                     version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched fixed-ram page size %s "
+                     "(local) %" PRIu64 " != %" PRIu64,
+                     block->idstr, (uint64_t)TARGET_PAGE_SIZE, page_size);
+        return -EINVAL;
+    }
+
+    le_bmap = g_malloc0(size);
+    ret = qemu_file_pread(f, (uint8_t *)le_bmap, size, block->bitmap_offset);
+    if (ret < 0) {
+        error_report("Failed to read the page bitmap of block %s",
+                     block->idstr);
+        g_free(le_bmap);
+        return ret;
+    }
+    block->file_bmap = bitmap_new(pages);
+    bitmap_from_le(block->file_bmap, le_bmap, pages);
+    g_free(le_bmap);
+
+    run_end = 0;
+    while ((run_start = find_next_bit(block->file_bmap, pages,
+                                      run_end)) < pages) {
+        run_end = find_next_zero_bit(block->file_bmap, pages, run_start);
+        for (page = run_start; page < run_end; page += extent) {
+            fixed_ram_queue(block, (ram_addr_t)page << TARGET_PAGE_BITS,
+                            (size_t)MIN(run_end - page, extent)
+                            << TARGET_PAGE_BITS);
+        }
+    }
+
+    ret = fixed_ram_flush();
+    if (ret < 0) {
+        error_report("Failed to read the pages of block %s", block->idstr);
+        return ret;
+    }
+
+    pos = qemu_file_seek(f, block->pages_offset + block->used_length,
+                         SEEK_SET);
+    return pos < 0 ? pos : 0;
+}
+
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     int flags = 0, ret = 0, invalid_flags = 0;
@@ -4132,6 +5684,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_fixed_ram()) {
+                        ret = ram_load_fixed_ram_block(f, block);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
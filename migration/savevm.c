@@ -1176,8 +1176,6 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
                                        bool inactivate_disks)
 {
-    QJSON *vmdesc;
-    int vmdesc_len;
     SaveStateEntry *se;
     int ret;
     bool in_postcopy = migration_in_postcopy();
@@ -1217,6 +1215,24 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
         return 0;
     }
 
+    return qemu_savevm_state_complete_precopy_non_iterable(f, in_postcopy,
+                                                           inactivate_disks);
+}
+
+/*
+ * Saves the state of the devices that are not iterable, followed by the
+ * end of the stream.  Background snapshots save it into a buffer while
+ * the VM is stopped, ahead of RAM.
+ */
+int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
+                                                    bool in_postcopy,
+                                                    bool inactivate_disks)
+{
+    QJSON *vmdesc;
+    int vmdesc_len;
+    SaveStateEntry *se;
+    int ret;
+
     vmdesc = qjson_new();
     json_prop_int(vmdesc, "page_size", qemu_target_page_size());
     json_start_array(vmdesc, "devices");
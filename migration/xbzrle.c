@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -23,109 +24,399 @@
   nzrun = length byte...
 
   length = uleb128 encoded integer
+
+  Runs are always maximal, so for given buffers there is only one valid
+  encoding and all implementations below must produce the same bytes.
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+
+/* Return the index of the first byte at or after @i where @old_buf and
+ * @new_buf differ, or @slen if there is none.
+ */
+static inline int xbzrle_zrun_end_int(const uint8_t *old_buf,
+                                      const uint8_t *new_buf,
+                                      int i, int slen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    /* not aligned to sizeof(long) */
+    while (i < slen && (i % sizeof(long))) {
+        if (old_buf[i] != new_buf[i]) {
+            return i;
+        }
+        i++;
+    }
 
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
+    /* word at a time for speed */
+    while (i < slen &&
+           (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
+        i += sizeof(long);
+    }
 
-    while (i < slen) {
-        /* overflow */
-        if (d + 2 > dlen) {
-            return -1;
-        }
+    /* go over the rest */
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
+/* Return the index of the first byte at or after @i where @old_buf and
+ * @new_buf are equal, or @slen if there is none.
+ */
+static inline int xbzrle_nzrun_end_int(const uint8_t *old_buf,
+                                       const uint8_t *new_buf,
+                                       int i, int slen)
+{
+    /* truncation to 32-bit long okay */
+    unsigned long mask = (unsigned long)0x0101010101010101ULL;
 
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
+    /* not aligned to sizeof(long) */
+    while (i < slen && (i % sizeof(long))) {
+        if (old_buf[i] == new_buf[i]) {
+            return i;
+        }
+        i++;
+    }
 
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
+    /* word at a time for speed, use of 32-bit long okay */
+    while (i < slen) {
+        unsigned long xor;
+        xor = *(unsigned long *)(old_buf + i)
+            ^ *(unsigned long *)(new_buf + i);
+        if ((xor - mask) & ~xor & (mask << 7)) {
+            /* found the end of an nzrun within the current long */
+            while (old_buf[i] != new_buf[i]) {
                 i++;
             }
+            break;
         }
+        i += sizeof(long);
+    }
+    return i;
+}
+
+/* The encoder proper, with the run detection left to the callers.  This
+ * is inlined into each implementation so that the run detection functions,
+ * which may use instructions that need a particular target, are inlined
+ * as well.
+ */
+static inline __attribute__((always_inline)) int
+xbzrle_encode_common(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                     uint8_t *dst, int dlen,
+                     int (*zrun_end)(const uint8_t *, const uint8_t *,
+                                     int, int),
+                     int (*nzrun_end)(const uint8_t *, const uint8_t *,
+                                      int, int))
+{
+    int d = 0, i = 0, end;
 
-        /* buffer unchanged */
-        if (zrun_len == slen) {
-            return 0;
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
         }
 
-        /* skip last zero run */
-        if (i == slen) {
+        end = zrun_end(old_buf, new_buf, i, slen);
+
+        /* buffer unchanged, or skip last zero run */
+        if (end == slen) {
             return d;
         }
 
-        d += uleb128_encode_small(dst + d, zrun_len);
-
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
+        d += uleb128_encode_small(dst + d, end - i);
+        i = end;
 
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
 
-        d += uleb128_encode_small(dst + d, nzrun_len);
+        end = nzrun_end(old_buf, new_buf, i, slen);
+
+        d += uleb128_encode_small(dst + d, end - i);
         /* overflow */
-        if (d + nzrun_len > dlen) {
+        if (d + (end - i) > dlen) {
             return -1;
         }
-        memcpy(dst + d, nzrun_start, nzrun_len);
-        d += nzrun_len;
-        nzrun_len = 0;
+        memcpy(dst + d, new_buf + i, end - i);
+        d += end - i;
+        i = end;
     }
 
     return d;
 }
 
+static int xbzrle_encode_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_zrun_end_int, xbzrle_nzrun_end_int);
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+/* Note that, as in util/bufferiszero.c, the includes have to be within
+ * the corresponding push_options region, and the regions have to be
+ * ordered with increasing ISA.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static inline int xbzrle_zrun_end_avx2(const uint8_t *old_buf,
+                                       const uint8_t *new_buf,
+                                       int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (ne) {
+            return i + ctz32(ne);
+        }
+    }
+    return xbzrle_zrun_end_int(old_buf, new_buf, i, slen);
+}
+
+static inline int xbzrle_nzrun_end_avx2(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+    }
+    return xbzrle_nzrun_end_int(old_buf, new_buf, i, slen);
+}
+
+static int xbzrle_encode_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_zrun_end_avx2, xbzrle_nzrun_end_avx2);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+/* Masked loads do not fault on the bytes that are masked out, so the
+ * tail of the buffer needs no scalar loop.
+ */
+static inline __mmask64 xbzrle_avx512_valid(int i, int slen)
+{
+    return slen - i >= 64 ? -1ULL : (1ULL << (slen - i)) - 1;
+}
+
+static inline int xbzrle_zrun_end_avx512(const uint8_t *old_buf,
+                                         const uint8_t *new_buf,
+                                         int i, int slen)
+{
+    for (; i < slen; i += 64) {
+        __mmask64 valid = xbzrle_avx512_valid(i, slen);
+        __m512i a = _mm512_maskz_loadu_epi8(valid, old_buf + i);
+        __m512i b = _mm512_maskz_loadu_epi8(valid, new_buf + i);
+        uint64_t ne = _mm512_mask_cmpneq_epi8_mask(valid, a, b);
+
+        if (ne) {
+            return i + ctz64(ne);
+        }
+    }
+    return slen;
+}
+
+static inline int xbzrle_nzrun_end_avx512(const uint8_t *old_buf,
+                                          const uint8_t *new_buf,
+                                          int i, int slen)
+{
+    for (; i < slen; i += 64) {
+        __mmask64 valid = xbzrle_avx512_valid(i, slen);
+        __m512i a = _mm512_maskz_loadu_epi8(valid, old_buf + i);
+        __m512i b = _mm512_maskz_loadu_epi8(valid, new_buf + i);
+        uint64_t eq = _mm512_mask_cmpeq_epi8_mask(valid, a, b);
+
+        if (eq) {
+            return i + ctz64(eq);
+        }
+    }
+    return slen;
+}
+
+static int xbzrle_encode_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                                uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_zrun_end_avx512,
+                                xbzrle_nzrun_end_avx512);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+#include "qemu/cpuid.h"
+
+/* Note that for test_xbzrle_next_accel, the most preferred ISA must have
+ * the least significant bit.
+ */
+#define XBZRLE_ACCEL_AVX512  1
+#define XBZRLE_ACCEL_AVX2    2
+
+static void xbzrle_init_accel(unsigned cache);
+
+static void __attribute__((constructor)) xbzrle_init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= XBZRLE_ACCEL_AVX2;
+            }
+            /* AVX-512 additionally needs the opmask and ZMM state.  */
+            if ((bv & 0xe6) == 0xe6 &&
+                (b & bit_AVX512F) && (b & bit_AVX512BW)) {
+                cache |= XBZRLE_ACCEL_AVX512;
+            }
+        }
+    }
+    xbzrle_init_accel(cache);
+}
+
+#define XBZRLE_ACCEL_OPT
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+/* There is no movemask on AArch64; narrowing each 16-bit lane by 4 bits
+ * turns a byte-wise comparison result into a nibble per byte.
+ */
+static inline uint64_t xbzrle_neon_mask(uint8x16_t cmp)
+{
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+
+static inline int xbzrle_zrun_end_neon(const uint8_t *old_buf,
+                                       const uint8_t *new_buf,
+                                       int i, int slen)
+{
+    for (; i + 16 <= slen; i += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf + i), vld1q_u8(new_buf + i));
+        uint64_t ne = ~xbzrle_neon_mask(eq);
+
+        if (ne) {
+            return i + ctz64(ne) / 4;
+        }
+    }
+    return xbzrle_zrun_end_int(old_buf, new_buf, i, slen);
+}
+
+static inline int xbzrle_nzrun_end_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    for (; i + 16 <= slen; i += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf + i), vld1q_u8(new_buf + i));
+        uint64_t m = xbzrle_neon_mask(eq);
+
+        if (m) {
+            return i + ctz64(m) / 4;
+        }
+    }
+    return xbzrle_nzrun_end_int(old_buf, new_buf, i, slen);
+}
+
+static int xbzrle_encode_neon(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_common(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_zrun_end_neon, xbzrle_nzrun_end_neon);
+}
+
+/* Advanced SIMD is mandatory on AArch64, so there is nothing to probe. */
+#define XBZRLE_ACCEL_NEON    1
+
+static void xbzrle_init_accel(unsigned cache);
+
+static void __attribute__((constructor)) xbzrle_init_hwcap_cache(void)
+{
+    xbzrle_init_accel(XBZRLE_ACCEL_NEON);
+}
+
+#define XBZRLE_ACCEL_OPT
+#endif
+
+#ifdef XBZRLE_ACCEL_OPT
+static unsigned xbzrle_cache;
+static int (*xbzrle_encode_accel)(uint8_t *, uint8_t *, int,
+                                  uint8_t *, int) = xbzrle_encode_int;
+
+static void xbzrle_init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) = xbzrle_encode_int;
+
+#ifdef __aarch64__
+    if (cache & XBZRLE_ACCEL_NEON) {
+        fn = xbzrle_encode_neon;
+    }
+#else
+#ifdef CONFIG_AVX2_OPT
+    if (cache & XBZRLE_ACCEL_AVX2) {
+        fn = xbzrle_encode_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & XBZRLE_ACCEL_AVX512) {
+        fn = xbzrle_encode_avx512;
+    }
+#endif
+#endif
+    xbzrle_cache = cache;
+    xbzrle_encode_accel = fn;
+}
+
+bool test_xbzrle_next_accel(void)
+{
+    /* If no bits set, we just tested xbzrle_encode_int, and there
+       are no more acceleration options to test.  */
+    if (xbzrle_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    xbzrle_init_accel(xbzrle_cache & (xbzrle_cache - 1));
+    return true;
+}
+#else
+#define xbzrle_encode_accel  xbzrle_encode_int
+bool test_xbzrle_next_accel(void)
+{
+    return false;
+}
+#endif
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    return xbzrle_encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -37,6 +37,7 @@
 #include "qemu/option.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/units.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
@@ -66,6 +67,7 @@ enum {
     OPTION_SIZE = 264,
     OPTION_PREALLOCATION = 265,
     OPTION_SHRINK = 266,
+    OPTION_RANDOM = 267,
 };
 
 typedef enum OutputFormat {
@@ -3965,6 +3967,7 @@ typedef struct BenchData {
     int n;
     int flush_interval;
     bool drain_on_flush;
+    bool random;
     uint8_t *buf;
     QEMUIOVector *qiov;
 
@@ -4032,8 +4035,15 @@ static void bench_cb(void *opaque, int ret)
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
+        if (b->random) {
+            uint64_t nr_blocks = b->image_size / b->bufsize;
+            uint64_t r = ((uint64_t)g_random_int() << 32) | g_random_int();
+
+            offset = (r % nr_blocks) * b->bufsize;
+        } else {
+            b->offset += b->step;
+            b->offset %= b->image_size;
+        }
         if (b->write) {
             acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
         } else {
@@ -4061,12 +4071,14 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    bool random = false;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double elapsed;
     int i;
     bool force_share = false;
     size_t buf_size;
@@ -4078,10 +4090,11 @@ static int img_bench(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
+            {"random", no_argument, 0, OPTION_RANDOM},
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hc:d:f:no:qs:S:t:wU", long_options, NULL);
+        c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options, NULL);
         if (c == -1) {
             break;
         }
@@ -4124,6 +4137,12 @@ static int img_bench(int argc, char **argv)
         case 'n':
             flags |= BDRV_O_NATIVE_AIO;
             break;
+        case 'i':
+            if (bdrv_parse_aio(optarg, &flags) < 0) {
+                error_report("Invalid aio option: %s", optarg);
+                return 1;
+            }
+            break;
         case 'o':
         {
             offset = cvtnum(optarg);
@@ -4203,6 +4222,9 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_RANDOM:
+            random = true;
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4237,6 +4259,11 @@ static int img_bench(int argc, char **argv)
         ret = image_size;
         goto out;
     }
+    if (random && image_size < bufsize) {
+        error_report("Image is smaller than the buffer size");
+        ret = -1;
+        goto out;
+    }
 
     data = (BenchData) {
         .blk            = blk,
@@ -4249,11 +4276,17 @@ static int img_bench(int argc, char **argv)
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .random         = random,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
+    if (random) {
+        printf("Sending %d random %s requests, %d bytes each, %d in parallel\n",
+               data.n, data.write ? "write" : "read", data.bufsize, data.nrreq);
+    } else {
+        printf("Sending %d %s requests, %d bytes each, %d in parallel "
+               "(starting at offset %" PRId64 ", step size %d)\n",
+               data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
+               data.offset, data.step);
+    }
     if (flush_interval) {
         printf("Sending flush every %d requests\n", flush_interval);
     }
@@ -4279,9 +4312,13 @@ static int img_bench(int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    elapsed = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    printf("Run completed in %3.3f seconds.\n", elapsed);
+    if (elapsed > 0) {
+        printf("%.0f IOPS, %.2f MiB/s\n", count / elapsed,
+               (double)count * bufsize / elapsed / MiB);
+    }
 
 out:
     if (data.buf) {
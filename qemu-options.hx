@@ -35,6 +35,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                dirty-ring-size=n track dirty pages with per-vCPU rings of n entries (default=0)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
@@ -79,6 +80,12 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item dirty-ring-size=@var{n}
+Collect dirty pages through per-vCPU rings of @var{n} entries instead of
+fetching a dirty bitmap for every memory slot on each sync.  @var{n} must
+be a power of two; the default of 0 disables the rings.  With KVM this
+requires a host kernel with dirty ring support; with TCG the rings are
+simulated in software.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
@@ -118,9 +125,12 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,tlb-min-bits=n][,tlb-max-bits=n]\n"
+    "                [,tiered=on|off]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                tlb-min-bits=n,tlb-max-bits=n (bounds of the TCG TLB size, log2)\n"
+    "                tiered=on|off (retranslate hot TCG blocks as traces)\n", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -134,6 +144,21 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item tlb-min-bits=@var{n},tlb-max-bits=@var{n}
+Bounds of the size of the softmmu TLB of each MMU mode, as log2 of the
+number of entries.  The TLB grows when most of its entries are in use
+between two flushes and shrinks when few are.  The default is to let it
+range from 64 entries to what covers 16 GiB of guest address space; not
+all TCG host back-ends support resizing the TLB.
+@item tiered=on|off
+Count how many times each translated block is executed, and retranslate
+the blocks that become hot together with the blocks that follow them,
+so that the TCG optimizer and register allocator see the whole trace.
+Conditional branches are profiled while a block is counted, and the
+trace follows the direction they took more often; the other direction
+leaves the trace.  The statistics are shown by the @code{info jit}
+monitor command.  It is only available for x86 guests, and it is not
+compatible with icount.
 @end table
 ETEXI
 
@@ -680,7 +705,7 @@ This is the protocol-level block driver for accessing regular files.
 @item filename
 The path to the image file in the local filesystem
 @item aio
-Specifies the AIO backend (threads/native, default: threads)
+Specifies the AIO backend (threads/native/io_uring, default: threads)
 @item locking
 Specifies whether the image file is protected with Linux OFD / POSIX locks. The
 default is to use the Linux Open File Descriptor API if available, otherwise no
@@ -750,6 +775,18 @@ Clean unused entries in the L2 and refcount caches. The interval is in seconds.
 The default value is 600 on supporting platforms, and 0 on other platforms.
 Setting it to 0 disables this feature.
 
+@item compress-threads
+The maximum number of clusters that are compressed or decompressed in parallel
+in the thread pool (1 to 64; default: 4). Reads of consecutive compressed
+clusters decompress them in parallel up to this limit.
+
+@item l2-prefetch
+Read all L2 tables referenced by the active L1 table into the L2 cache in the
+background after opening the image, in large sequential batches (on/off;
+default: off). Prefetching only fills unused cache entries, so l2-cache-size
+is its memory budget. Progress is reported in the qcow2 statistics of
+query-blockstats.
+
 @item pass-discard-request
 Whether discard requests to the qcow2 device should be forwarded to the data
 source (on/off; default: on if discard=unmap is specified, off otherwise)
@@ -790,7 +827,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,snapshot=on|off][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -858,7 +896,8 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native", or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO, or Linux io_uring API.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -3663,6 +3702,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3681,6 +3722,10 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{filename}
+Accept incoming migration from a file previously written by migrating
+to @code{file:@var{filename}}.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
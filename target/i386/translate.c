@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -116,6 +117,13 @@ typedef struct DisasContext {
     int tf;     /* TF cpu flag */
     int jmp_opt; /* use direct block chaining for direct jumps */
     int repz_opt; /* optimize jumps within repz instructions */
+    bool trace_exit_chained; /* goto_tb slot 1 taken by a trace side exit */
+    int nb_trace_exits;
+    struct {
+        TCGLabel *label;
+        target_ulong eip;
+        bool chained;
+    } trace_exits[TB_TRACE_MAX_BLOCKS]; /* emitted after the last block */
     int mem_index; /* select memory access functions */
     uint64_t flags; /* all execution flags */
     int popl_esp_hack; /* for correct popl with esp base handling */
@@ -2220,7 +2228,7 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
 {
     target_ulong pc = s->cs_base + eip;
 
-    if (use_goto_tb(s, pc))  {
+    if (use_goto_tb(s, pc) && !(tb_num == 1 && s->trace_exit_chained))  {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
         gen_jmp_im(s, eip);
@@ -2233,11 +2241,99 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
     }
 }
 
-static inline void gen_jcc(DisasContext *s, int b,
+/* In a trace, go on translating at EIP instead of ending the block */
+static bool gen_trace_follow(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (!s->jmp_opt || (s->base.tb->flags & HF_RF_MASK) || pc < s->pc
+        || !translator_trace_follow(&s->base, pc)) {
+        return false;
+    }
+    s->pc = pc;
+    return true;
+}
+
+/* In a trace, a branch back to EIP may loop inside the TB */
+static bool use_trace_loop(DisasContext *s, target_ulong eip)
+{
+    return s->jmp_opt && !(s->base.tb->flags & HF_RF_MASK)
+           && translator_trace_loop(&s->base, s->cs_base + eip);
+}
+
+/* Branch back to the start of a trace, which assumes a dynamic cc_op */
+static void gen_trace_loop(DisasContext *s)
+{
+    gen_update_cc_op(s);
+    set_cc_op(s, CC_OP_DYNAMIC);
+    tcg_gen_br(tcg_ctx->trace_loop_label);
+    s->base.is_jmp = DISAS_NORETURN;
+}
+
+/* Leave a trace at EIP if condition B is true.  The exit itself is emitted
+   by gen_trace_side_exits(), so that the followed path falls through the
+   branch with the globals still in host registers.  The first side exit
+   is chained through slot 1.  */
+static void gen_trace_side_exit(DisasContext *s, int b, target_ulong eip)
+{
+    int n = s->nb_trace_exits++;
+
+    tcg_debug_assert(n < TB_TRACE_MAX_BLOCKS);
+    s->trace_exits[n].label = gen_new_label();
+    s->trace_exits[n].eip = eip;
+    s->trace_exits[n].chained = !s->trace_exit_chained &&
+                                use_goto_tb(s, s->cs_base + eip);
+    if (s->trace_exits[n].chained) {
+        s->trace_exit_chained = true;
+    }
+    gen_jcc1(s, b, s->trace_exits[n].label);
+}
+
+/* Emit the side exits of a trace after the code of its last block */
+static void gen_trace_side_exits(DisasContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_trace_exits; i++) {
+        gen_set_label(s->trace_exits[i].label);
+        translator_trace_exit(&s->base);
+        if (s->trace_exits[i].chained) {
+            tcg_gen_goto_tb(1);
+            gen_jmp_im(s, s->trace_exits[i].eip);
+            tcg_gen_exit_tb(s->base.tb, 1);
+        } else {
+            gen_jmp_im(s, s->trace_exits[i].eip);
+            tcg_gen_lookup_and_goto_ptr();
+        }
+    }
+}
+
+static inline void gen_jcc(DisasContext *s, CPUState *cpu, int b,
                            target_ulong val, target_ulong next_eip)
 {
     TCGLabel *l1, *l2;
 
+    /* A loop back-edge stays in the trace, which ends at the loop exit */
+    if (use_trace_loop(s, val)) {
+        gen_jcc1(s, b, tcg_ctx->trace_loop_label);
+        gen_goto_tb(s, 0, next_eip);
+        return;
+    }
+
+    /* Traces follow the direction that the branch took more often while
+       it was profiled, and leave the TB through a side exit otherwise.  */
+    if (tb_cflags(s->base.tb) & CF_TRACE) {
+        bool taken = val > next_eip &&
+                     translator_trace_branch_taken(&s->base, cpu);
+        target_ulong follow = taken ? val : next_eip;
+        target_ulong exit = taken ? next_eip : val;
+
+        if (gen_trace_follow(s, follow)) {
+            gen_trace_side_exit(s, taken ? b ^ 1 : b, exit);
+            return;
+        }
+    }
+
     if (s->jmp_opt) {
         l1 = gen_new_label();
         gen_jcc1(s, b, l1);
@@ -2245,6 +2341,7 @@ static inline void gen_jcc(DisasContext *s, int b,
         gen_goto_tb(s, 0, next_eip);
 
         gen_set_label(l1);
+        translator_profile_branch(&s->base);
         gen_goto_tb(s, 1, val);
     } else {
         l1 = gen_new_label();
@@ -2255,6 +2352,7 @@ static inline void gen_jcc(DisasContext *s, int b,
         tcg_gen_br(l2);
 
         gen_set_label(l1);
+        translator_profile_branch(&s->base);
         gen_jmp_im(s, val);
         gen_set_label(l2);
         gen_eob(s);
@@ -3031,6 +3129,161 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Expand the integer and logic operations of the 0x0f opcode space
+   that have a generic vector equivalent, so that they can use the host
+   vector registers.  Returns false if the helper must be called.  */
+static bool gen_sse_gvec(int b, uint32_t dofs, uint32_t aofs, uint32_t sz)
+{
+    switch (b) {
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(MO_64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(MO_64, dofs, aofs, dofs, sz, sz);
+        break;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(MO_64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(MO_64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddl */
+        tcg_gen_gvec_add(b - 0xfc, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_gvec_add(MO_64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubl */
+    case 0xfb: /* psubq */
+        tcg_gen_gvec_sub(b - 0xf8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xec: /* paddsb */
+    case 0xed: /* paddsw */
+        tcg_gen_gvec_ssadd(b - 0xec, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xe8: /* psubsb */
+    case 0xe9: /* psubsw */
+        tcg_gen_gvec_sssub(b - 0xe8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xdc: /* paddusb */
+    case 0xdd: /* paddusw */
+        tcg_gen_gvec_usadd(b - 0xdc, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xd8: /* psubusb */
+    case 0xd9: /* psubusw */
+        tcg_gen_gvec_ussub(b - 0xd8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x74: /* pcmpeqb */
+    case 0x75: /* pcmpeqw */
+    case 0x76: /* pcmpeql */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, b - 0x74, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x64: /* pcmpgtb */
+    case 0x65: /* pcmpgtw */
+    case 0x66: /* pcmpgtl */
+        tcg_gen_gvec_cmp(TCG_COND_GT, b - 0x64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xd5: /* pmullw */
+        tcg_gen_gvec_mul(MO_16, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xda: /* pminub */
+        tcg_gen_gvec_umin(MO_8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xde: /* pmaxub */
+        tcg_gen_gvec_umax(MO_8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xea: /* pminsw */
+        tcg_gen_gvec_smin(MO_16, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0xee: /* pmaxsw */
+        tcg_gen_gvec_smax(MO_16, dofs, dofs, aofs, sz, sz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Likewise for the 0x0f 0x38 opcode space.  */
+static bool gen_sse_gvec_0f38(int b, uint32_t dofs, uint32_t aofs,
+                              uint32_t sz)
+{
+    switch (b) {
+    case 0x29: /* pcmpeqq */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, MO_64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x37: /* pcmpgtq */
+        tcg_gen_gvec_cmp(TCG_COND_GT, MO_64, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x38: /* pminsb */
+        tcg_gen_gvec_smin(MO_8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x39: /* pminsd */
+        tcg_gen_gvec_smin(MO_32, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x3a: /* pminuw */
+        tcg_gen_gvec_umin(MO_16, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x3b: /* pminud */
+        tcg_gen_gvec_umin(MO_32, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x3c: /* pmaxsb */
+        tcg_gen_gvec_smax(MO_8, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x3d: /* pmaxsd */
+        tcg_gen_gvec_smax(MO_32, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x3e: /* pmaxuw */
+        tcg_gen_gvec_umax(MO_16, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x3f: /* pmaxud */
+        tcg_gen_gvec_umax(MO_32, dofs, dofs, aofs, sz, sz);
+        break;
+    case 0x40: /* pmulld */
+        tcg_gen_gvec_mul(MO_32, dofs, dofs, aofs, sz, sz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Shifts by an immediate, opcodes 0x71 to 0x73.  Counts larger than the
+   element size clear the element, or fill it with the sign bit.  */
+static bool gen_sse_shifti_gvec(int b, int op, int val, uint32_t ofs,
+                                uint32_t sz)
+{
+    unsigned vece = b & 3;
+    int bits = 8 << vece;
+
+    switch (op) {
+    case 2: /* psrl */
+    case 6: /* psll */
+        if (val >= bits) {
+            tcg_gen_gvec_dup8i(ofs, sz, sz, 0);
+        } else if (op == 2) {
+            tcg_gen_gvec_shri(vece, ofs, ofs, val, sz, sz);
+        } else {
+            tcg_gen_gvec_shli(vece, ofs, ofs, val, sz, sz);
+        }
+        return true;
+    case 4: /* psra */
+        tcg_gen_gvec_sari(vece, ofs, ofs, MIN(val, bits - 1), sz, sz);
+        return true;
+    default:
+        /* psrldq and pslldq shift the whole register.  */
+        return false;
+    }
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3448,6 +3701,22 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 goto unknown_op;
             }
             val = x86_ldub_code(env, s);
+            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)][b1];
+            if (!sse_fn_epp) {
+                goto unknown_op;
+            }
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+            if (gen_sse_shifti_gvec(b, (modrm >> 3) & 7, val, op2_offset,
+                                    is_xmm ? 16 : 8)) {
+                break;
+            }
             if (is_xmm) {
                 tcg_gen_movi_tl(s->T0, val);
                 tcg_gen_st32_tl(s->T0, cpu_env,
@@ -3465,18 +3734,6 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                                 offsetof(CPUX86State, mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
-                                       (((modrm >> 3)) & 7)][b1];
-            if (!sse_fn_epp) {
-                goto unknown_op;
-            }
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -3753,6 +4010,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             if (sse_fn_epp == SSE_SPECIAL) {
                 goto unknown_op;
             }
+            if (gen_sse_gvec_0f38(b, op1_offset, op2_offset, b1 ? 16 : 8)) {
+                break;
+            }
 
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
@@ -4465,6 +4725,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, s->ptr0, s->ptr1, s->A0);
             break;
         default:
+            if (gen_sse_gvec(b, op1_offset, op2_offset, is_xmm ? 16 : 8)) {
+                break;
+            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -6553,7 +6816,9 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
             gen_bnd_jmp(s);
-            gen_jmp(s, tval);
+            if (!gen_trace_follow(s, tval)) {
+                gen_jmp(s, tval);
+            }
         }
         break;
     case 0x9a: /* lcall im */
@@ -6583,7 +6848,11 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        if (use_trace_loop(s, tval)) {
+            gen_trace_loop(s);
+        } else if (!gen_trace_follow(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0xea: /* ljmp im */
         {
@@ -6605,7 +6874,11 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        if (use_trace_loop(s, tval)) {
+            gen_trace_loop(s);
+        } else if (!gen_trace_follow(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -6623,7 +6896,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffff;
         }
         gen_bnd_jmp(s);
-        gen_jcc(s, b, tval, next_eip);
+        gen_jcc(s, cpu, b, tval, next_eip);
         break;
 
     case 0x190 ... 0x19f: /* setcc Gv */
@@ -8473,6 +8746,8 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
        additional step for ecx=0 when icount is enabled.
      */
     dc->repz_opt = !dc->jmp_opt && !(tb_cflags(dc->base.tb) & CF_USE_ICOUNT);
+    dc->trace_exit_chained = false;
+    dc->nb_trace_exits = 0;
 #if 0
     /* check addseg logic */
     if (!dc->addseg && (dc->vm86 || !dc->pe || !dc->code32))
@@ -8563,6 +8838,7 @@ static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
         gen_jmp_im(dc, dc->base.pc_next - dc->cs_base);
         gen_eob(dc);
     }
+    gen_trace_side_exits(dc);
 }
 
 static void i386_tr_disas_log(const DisasContextBase *dcbase,
@@ -1459,8 +1459,17 @@ void tcg_optimize(TCGContext *s)
                to compute the operation result) so no propagation is done.
                We trash everything if the operation is the end of a basic
                block, otherwise we only trash the output args.  "mask" is
-               the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+               the non-zero bits mask for the first output arg.  A
+               conditional branch only kills the normal temps: globals and
+               local temps keep their value on the fall-through path.  */
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                for (i = nb_globals; i < nb_temps; i++) {
+                    if (test_bit(i, temps_used.l)
+                        && !s->temps[i].temp_local) {
+                        reset_ts(&s->temps[i]);
+                    }
+                }
+            } else if (def->flags & TCG_OPF_BB_END) {
                 bitmap_zero(temps_used.l, nb_temps);
             } else {
         do_reset_output:
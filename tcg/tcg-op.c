@@ -2586,8 +2586,8 @@ void tcg_gen_exit_tb(TranslationBlock *tb, unsigned idx)
             val = 0;
         }
     } else {
-        /* This is an exit via the exitreq label.  */
-        tcg_debug_assert(idx == TB_EXIT_REQUESTED);
+        /* This is an exit via the exitreq or hot label.  */
+        tcg_debug_assert(idx == TB_EXIT_REQUESTED || idx == TB_EXIT_HOT);
     }
 
     tcg_gen_op1i(INDEX_op_exit_tb, val);
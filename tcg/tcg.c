@@ -147,6 +147,10 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once all regions have been handed out, the oldest region that is no longer
+ * used by any TCG thread can be evicted and then allocated again; see
+ * tcg_region_evict().
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -162,6 +166,10 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    size_t *full; /* full regions, oldest first */
+    size_t n_full;
+    size_t *free; /* evicted regions, ready to be allocated again */
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
@@ -375,22 +383,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
     if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
     }
-    return region_trees + region_idx * tree_size;
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -525,11 +534,16 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_free) {
+        curr_region = region.free[--region.n_free];
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
     return false;
 }
 
@@ -540,13 +554,15 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 static bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full_region = tc_ptr_to_region_idx(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[region.n_full++] = full_region;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -570,6 +586,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_full = 0;
+    region.n_free = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = atomic_read(&tcg_ctxs[i]);
@@ -582,10 +600,78 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Evict the oldest full region, so that a context that ran out of space can
+ * allocate it again. @func is called on each TB of the region, and must
+ * unlink the TB from everything that might still point to it.
+ *
+ * Call from a safe-work context.
+ * Returns 1 if a region was evicted, 0 if there is no need to evict one,
+ * or -1 if all regions are in use and a full flush is needed instead.
+ */
+int tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt;
+    size_t curr_region;
+    void *start, *end;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.current < region.n || region.n_free) {
+        qemu_mutex_unlock(&region.lock);
+        return 0;
+    }
+    if (region.n_full == 0) {
+        qemu_mutex_unlock(&region.lock);
+        return -1;
+    }
+    curr_region = region.full[0];
+    region.n_full--;
+    memmove(region.full, region.full + 1, region.n_full * sizeof(size_t));
+
+    tcg_region_bounds(curr_region, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    qemu_mutex_unlock(&region.lock);
+
+    /*
+     * No TBs can be added to or removed from the region at this point, and
+     * @func may need to take page locks, which nest outside rt->lock.
+     */
+    rt = region_trees + curr_region * tree_size;
+    g_tree_foreach(rt->tree, func, user_data);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    qemu_mutex_lock(&region.lock);
+    region.free[region.n_free++] = curr_region;
+    qemu_mutex_unlock(&region.lock);
+    return 1;
+}
+
+/*
+ * With a single TCG context we still split the buffer into a few regions,
+ * each of them >= 2 MB, so that filling up the buffer only evicts the
+ * oldest region instead of flushing all the translated code.
+ */
+static size_t tcg_n_regions_single(void)
+{
+    size_t i;
+
+    for (i = 8; i > 1; i--) {
+        if (tcg_init_ctx.code_gen_buffer_size / i >= 2 * 1024u * 1024) {
+            return i;
+        }
+    }
+    return 1;
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
-    return 1;
+    return tcg_n_regions_single();
 }
 #else
 /*
@@ -598,9 +684,9 @@ static size_t tcg_n_regions(void)
 {
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
+    /* Use a single context if all we have is one vCPU thread */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return tcg_n_regions_single();
     }
 
     /* Try to have more regions than max_cpus, with each region being >= 2 MB */
@@ -631,12 +717,14 @@ static size_t tcg_n_regions(void)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG the only TCG thread uses a few
+ * regions in turn, so that only the oldest one is evicted when they fill up.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
  *
- * In user-mode we use a single region.  Having multiple regions in user-mode
+ * In user-mode we use a single context, which like in !MTTCG goes through a
+ * few regions in turn.  Having one region per thread in user-mode
  * is not supported, because the number of vCPU threads (recall that each thread
  * spawned by the guest corresponds to a vCPU thread) is only bounded by the
  * OS, and usually this number is huge (tens of thousands is not uncommon).
@@ -681,6 +769,8 @@ void tcg_region_init(void)
     region.stride = region_size;
     region.start = buf;
     region.start_aligned = aligned;
+    region.full = g_new(size_t, n_regions);
+    region.free = g_new(size_t, n_regions);
     /* page-align the end, since its last page will be a guard page */
     region.end = QEMU_ALIGN_PTR_DOWN(buf + size, page_size);
     /* account for that last guard page */
@@ -1595,6 +1685,11 @@ bool tcg_op_supported(TCGOpcode op)
         return have_vec && TCG_TARGET_HAS_orc_vec;
     case INDEX_op_mul_vec:
         return have_vec && TCG_TARGET_HAS_mul_vec;
+    case INDEX_op_smin_vec:
+    case INDEX_op_umin_vec:
+    case INDEX_op_smax_vec:
+    case INDEX_op_umax_vec:
+        return have_vec && TCG_TARGET_HAS_minmax_vec;
     case INDEX_op_shli_vec:
     case INDEX_op_shri_vec:
     case INDEX_op_sari_vec:
@@ -2429,6 +2524,29 @@ static void la_global_sync(TCGContext *s, int ng)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced to memory but stay live on the
+   fall-through path. */
+static void la_bb_sync(TCGContext *s, int ng, int nt)
+{
+    int i;
+
+    la_global_sync(s, ng);
+
+    for (i = ng; i < nt; ++i) {
+        if (s->temps[i].temp_local) {
+            int state = s->temps[i].state;
+            s->temps[i].state = state | TS_MEM;
+            if (state != TS_DEAD) {
+                continue;
+            }
+        } else {
+            s->temps[i].state = TS_DEAD;
+        }
+        la_reset_pref(&s->temps[i]);
+    }
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -2705,6 +2823,8 @@ static void liveness_pass_1(TCGContext *s)
             /* If end of basic block, update.  */
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
+            } else if (def->flags & TCG_OPF_COND_BRANCH) {
+                la_bb_sync(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2817,7 +2937,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2890,6 +3013,17 @@ static bool liveness_pass_2(TCGContext *s)
             }
         }
 
+        /* The direct temps are normal temps, which die at a conditional
+           branch: reload indirect globals on the fall-through path.  */
+        if (def->flags & TCG_OPF_COND_BRANCH) {
+            for (i = 0; i < nb_globals; ++i) {
+                arg_ts = &s->temps[i];
+                if (arg_ts->state_ptr) {
+                    arg_ts->state = TS_DEAD;
+                }
+            }
+        }
+
         /* Outputs become available.  */
         for (i = 0; i < nb_oargs; i++) {
             arg_ts = arg_temp(op->args[i]);
@@ -3255,6 +3389,27 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* at a conditional branch, we assume all temporaries are dead and
+   all globals and local temps are synced to their location. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /* The liveness analysis already ensures that temps are dead and
+           local temps are synced.  Keep tcg_debug_asserts for safety. */
+        if (ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->mem_coherent);
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 static void tcg_reg_alloc_do_movi(TCGContext *s, TCGTemp *ots,
                                   tcg_target_ulong val, TCGLifeData arg_life,
                                   TCGRegSet preferred_regs)
@@ -3466,7 +3621,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
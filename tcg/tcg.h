@@ -183,6 +183,7 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_shs_vec          0
 #define TCG_TARGET_HAS_shv_vec          0
 #define TCG_TARGET_HAS_mul_vec          0
+#define TCG_TARGET_HAS_minmax_vec       0
 #else
 #define TCG_TARGET_MAYBE_vec            1
 #endif
@@ -715,6 +716,12 @@ struct TCGContext {
 #endif
 
     TCGLabel *exitreq_label;
+    TCGLabel *hot_label;
+    /* Start of a trace, for the branches that loop inside it */
+    TCGLabel *trace_loop_label;
+    /* Branch profile of the counted TB that is promoted to a trace */
+    uint32_t trace_exec_count;
+    uint32_t trace_taken_count;
 
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
@@ -872,6 +879,7 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+int tcg_region_evict(GTraverseFunc func, gpointer user_data);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -1046,6 +1054,9 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x20,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x40,
+    /* Instruction is a conditional branch: it ends the basic block, but
+       globals and local temps stay live on the fall-through path.  */
+    TCG_OPF_COND_BRANCH  = 0x80,
 };
 
 typedef struct TCGOpDef {
@@ -1233,15 +1244,15 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
  *        TB index (0 or 1). That is, we left the TB via (the equivalent
  *        of) "goto_tb <index>". The main loop uses this to determine
  *        how to link the TB just executed to the next.
- *  2:    we are using instruction counting code generation, and we
- *        did not start executing this TB because the instruction counter
- *        would hit zero midway through it. In this case the pointer
- *        returned is the TB we were about to execute, and the caller must
- *        arrange to execute the remaining count of instructions.
+ *  2:    the TB was translated with CF_TIERED and its execution counter
+ *        just reached TB_TRACE_THRESHOLD. We did not start executing it;
+ *        the pointer returned is the TB to be retranslated as a trace.
  *  3:    we stopped because the CPU's exit_request flag was set
  *        (usually meaning that there is an interrupt that needs to be
- *        handled). The pointer returned is the TB we were about to execute
- *        when we noticed the pending exit request.
+ *        handled), or because we are using instruction counting code
+ *        generation and the instruction counter would hit zero midway
+ *        through this TB. The pointer returned is the TB we were about
+ *        to execute when we noticed the pending exit request.
  *
  * If the bottom two bits indicate an exit-via-index then the CPU
  * state is correctly synchronised and ready for execution of the next
@@ -1260,6 +1271,7 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
 #define TB_EXIT_IDX0      0
 #define TB_EXIT_IDX1      1
 #define TB_EXIT_IDXMAX    1
+#define TB_EXIT_HOT       2
 #define TB_EXIT_REQUESTED 3
 
 #ifdef HAVE_TCG_QEMU_TB_EXEC
@@ -0,0 +1,59 @@
+/*
+ * QEMU CRC32C speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/crc32c.h"
+
+static void test_crc32c_speed_chunk(unsigned accel, const uint8_t *in,
+                                    size_t chunk_size)
+{
+    double total = 0.0;
+    uint32_t crc = 0;
+
+    g_test_timer_start();
+    do {
+        crc ^= crc32c(0xffffffff, in, chunk_size);
+        total += chunk_size;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    total /= MiB;
+    g_print("crc32c (accel %u): ", accel);
+    g_print("Testing chunk_size %zu bytes ", chunk_size);
+    g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
+    g_print("%.2f MB/sec (crc %08" PRIx32 ")\n", total / g_test_timer_last(),
+            crc);
+}
+
+static void test_crc32c_speed(void)
+{
+    uint8_t *in;
+    unsigned accel = 0;
+    size_t i;
+
+    in = g_new(uint8_t, 64 * KiB);
+    memset(in, g_test_rand_int(), 64 * KiB);
+
+    /* Starts with the fastest implementation supported by the host and
+     * ends with the generic table-driven one. */
+    do {
+        for (i = 64; i <= 64 * KiB; i *= 4) {
+            test_crc32c_speed_chunk(accel, in, i);
+        }
+        accel++;
+    } while (test_crc32c_next_accel());
+
+    g_free(in);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/crc32c/speed", test_crc32c_speed);
+
+    return g_test_run();
+}
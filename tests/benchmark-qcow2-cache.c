@@ -0,0 +1,122 @@
+/*
+ * qcow2 metadata cache lookup speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "block/block.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "../block/qcow2.h"
+
+#define TABLE_SIZE   (64 * KiB)
+#define TABLE_BASE   (16 * MiB)
+#define NR_LOOKUPS   4096
+
+/* Gets and releases @n tables, all of them hits or all of them misses */
+static void bench_lookups(BlockDriverState *bs, Qcow2Cache *c,
+                          const uint64_t *offsets, int n)
+{
+    void *table;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (qcow2_cache_get_empty(bs, c, offsets[i], &table) < 0) {
+            g_assert_not_reached();
+        }
+        qcow2_cache_put(c, &table);
+    }
+}
+
+static void test_qcow2_cache_speed_size(BlockDriverState *bs, size_t size)
+{
+    int num_tables = size / TABLE_SIZE;
+    uint64_t *offsets = g_new(uint64_t, NR_LOOKUPS);
+    double hits = 0.0, misses = 0.0;
+    double hit_secs, miss_secs;
+    uint64_t next_miss;
+    Qcow2Cache *c;
+    int i;
+
+    /* The tables are never read, so most of the cache stays unallocated */
+    c = qcow2_cache_create(bs, num_tables, TABLE_SIZE);
+    g_assert(c);
+
+    for (i = 0; i < num_tables; i++) {
+        offsets[0] = TABLE_BASE + (uint64_t) i * TABLE_SIZE;
+        bench_lookups(bs, c, offsets, 1);
+    }
+
+    /* Hits: random tables out of the ones that are cached */
+    for (i = 0; i < NR_LOOKUPS; i++) {
+        offsets[i] = TABLE_BASE +
+            (uint64_t) g_test_rand_int_range(0, num_tables) * TABLE_SIZE;
+    }
+    g_test_timer_start();
+    do {
+        bench_lookups(bs, c, offsets, NR_LOOKUPS);
+        hits += NR_LOOKUPS;
+    } while (g_test_timer_elapsed() < 1.0);
+    hit_secs = g_test_timer_last();
+
+    /* Misses: every lookup evicts the least recently used table */
+    next_miss = TABLE_BASE + (uint64_t) num_tables * TABLE_SIZE;
+    g_test_timer_start();
+    do {
+        for (i = 0; i < NR_LOOKUPS; i++) {
+            offsets[i] = next_miss;
+            next_miss += TABLE_SIZE;
+        }
+        bench_lookups(bs, c, offsets, NR_LOOKUPS);
+        misses += NR_LOOKUPS;
+    } while (g_test_timer_elapsed() < 1.0);
+    miss_secs = g_test_timer_last();
+
+    g_print("qcow2-cache %5zu MB (%6d tables): ", size / MiB, num_tables);
+    g_print("hit %.2f M lookups/sec, ", hits / hit_secs / 1000000);
+    g_print("miss %.2f M lookups/sec\n", misses / miss_secs / 1000000);
+
+    g_assert_cmpint(qcow2_cache_destroy(c), ==, 0);
+    g_free(offsets);
+}
+
+static void test_qcow2_cache_speed(void)
+{
+    char path[] = "/tmp/qcow2-cache.XXXXXX";
+    QDict *options = qdict_new();
+    BlockBackend *blk;
+    size_t size;
+    int fd;
+
+    fd = mkstemp(path);
+    g_assert(fd >= 0);
+    close(fd);
+
+    bdrv_img_create(path, "qcow2", NULL, NULL, NULL, 64 * MiB, 0, true,
+                    &error_abort);
+    qdict_put_str(options, "driver", "qcow2");
+    blk = blk_new_open(path, NULL, options, BDRV_O_RDWR, &error_abort);
+
+    for (size = 1 * MiB; size <= 1 * GiB; size *= 4) {
+        test_qcow2_cache_speed_size(blk_bs(blk), size);
+    }
+
+    blk_unref(blk);
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/qcow2-cache/speed", test_qcow2_cache_speed);
+
+    return g_test_run();
+}
@@ -0,0 +1,121 @@
+/*
+ * QEMU XBZRLE encoder speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE 4096
+#define NR_PAGES  256
+
+typedef struct XbzrlePattern {
+    const char *name;
+    /* Returns true if byte @i of a page has to be modified */
+    bool (*dirty)(int i);
+} XbzrlePattern;
+
+static bool pattern_unchanged(int i)
+{
+    return false;
+}
+
+static bool pattern_one_byte(int i)
+{
+    return i == PAGE_SIZE / 2;
+}
+
+static bool pattern_sparse(int i)
+{
+    return i % 256 == 0;
+}
+
+static bool pattern_words(int i)
+{
+    return i % 64 < 8;
+}
+
+static bool pattern_random(int i)
+{
+    return g_test_rand_int_range(0, 100) < 10;
+}
+
+static bool pattern_half(int i)
+{
+    return i < PAGE_SIZE / 2;
+}
+
+static const XbzrlePattern patterns[] = {
+    { "unchanged", pattern_unchanged },
+    { "one-byte", pattern_one_byte },
+    { "sparse", pattern_sparse },
+    { "words", pattern_words },
+    { "random-10%", pattern_random },
+    { "half", pattern_half },
+};
+
+static void test_xbzrle_speed_pattern(unsigned accel,
+                                      const XbzrlePattern *pattern,
+                                      uint8_t *old, uint8_t *new,
+                                      uint8_t *out)
+{
+    double total = 0.0;
+    int i, len = 0;
+
+    for (i = 0; i < NR_PAGES * PAGE_SIZE; i++) {
+        old[i] = g_test_rand_int();
+        new[i] = pattern->dirty(i % PAGE_SIZE) ? ~old[i] : old[i];
+    }
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < NR_PAGES; i++) {
+            len = xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                       new + i * PAGE_SIZE, PAGE_SIZE,
+                                       out, PAGE_SIZE);
+        }
+        total += NR_PAGES * PAGE_SIZE;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    total /= MiB;
+    g_print("xbzrle (accel %u): ", accel);
+    g_print("Testing pattern %-10s ", pattern->name);
+    g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
+    g_print("%.2f MB/sec (encoded %d bytes)\n", total / g_test_timer_last(),
+            len);
+}
+
+static void test_xbzrle_speed(void)
+{
+    uint8_t *old, *new, *out;
+    unsigned accel = 0;
+    size_t i;
+
+    old = g_malloc(NR_PAGES * PAGE_SIZE);
+    new = g_malloc(NR_PAGES * PAGE_SIZE);
+    out = g_malloc(PAGE_SIZE);
+
+    /* Starts with the fastest implementation supported by the host and
+     * ends with the generic word-at-a-time one. */
+    do {
+        for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+            test_xbzrle_speed_pattern(accel, &patterns[i], old, new, out);
+        }
+        accel++;
+    } while (test_xbzrle_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(out);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/xbzrle/speed", test_xbzrle_speed);
+
+    return g_test_run();
+}
@@ -14,6 +14,8 @@
 
 #include "libqtest.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qapi/qmp/qjson.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
@@ -357,6 +359,23 @@ static void migrate_set_parameter(QTestState *who, const char *parameter,
     migrate_check_parameter(who, parameter, value);
 }
 
+static void migrate_set_parameter_str(QTestState *who, const char *parameter,
+                                      const char *value)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-parameters',"
+                    "'arguments': { %s: %s } }",
+                    parameter, value);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+
+    rsp = wait_command(who, "{ 'execute': 'query-migrate-parameters' }");
+    g_assert_cmpstr(qdict_get_str(rsp, parameter), ==, value);
+    qobject_unref(rsp);
+}
+
 static void migrate_pause(QTestState *who)
 {
     QDict *rsp;
@@ -377,6 +396,17 @@ static void migrate_recover(QTestState *who, const char *uri)
     qobject_unref(rsp);
 }
 
+static void migrate_incoming(QTestState *who, const char *uri)
+{
+    QDict *rsp;
+
+    rsp = wait_command(who,
+                       "{ 'execute': 'migrate-incoming', "
+                       "  'arguments': { 'uri': %s } }",
+                       uri);
+    qobject_unref(rsp);
+}
+
 static void migrate_set_capability(QTestState *who, const char *capability,
                                    bool value)
 {
@@ -430,7 +460,8 @@ static void migrate_postcopy_start(QTestState *from, QTestState *to)
 }
 
 static int test_migrate_start(QTestState **from, QTestState **to,
-                               const char *uri, bool hide_stderr)
+                               const char *uri, const char *opts,
+                               bool hide_stderr)
 {
     gchar *cmd_src, *cmd_dst;
     char *bootpath = g_strdup_printf("%s/bootsect", tmpfs);
@@ -508,6 +539,17 @@ static int test_migrate_start(QTestState **from, QTestState **to,
 
     g_free(bootpath);
 
+    if (opts) {
+        gchar *tmp;
+        tmp = g_strdup_printf("%s %s", cmd_src, opts);
+        g_free(cmd_src);
+        cmd_src = tmp;
+
+        tmp = g_strdup_printf("%s %s", cmd_dst, opts);
+        g_free(cmd_dst);
+        cmd_dst = tmp;
+    }
+
     if (hide_stderr) {
         gchar *tmp;
         tmp = g_strdup_printf("%s 2>/dev/null", cmd_src);
@@ -603,7 +645,7 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
     char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     QTestState *from, *to;
 
-    if (test_migrate_start(&from, &to, uri, hide_error)) {
+    if (test_migrate_start(&from, &to, uri, NULL, hide_error)) {
         return -1;
     }
 
@@ -657,6 +699,51 @@ static void test_postcopy(void)
     migrate_postcopy_complete(from, to);
 }
 
+static void read_fault_latency(QTestState *who)
+{
+    QDict *rsp_return, *latency;
+    QListEntry *entry;
+    uint64_t requests, served, total = 0;
+
+    rsp_return = migrate_query(who);
+    g_assert(qdict_haskey(rsp_return, "postcopy-fault-latency"));
+    latency = qdict_get_qdict(rsp_return, "postcopy-fault-latency");
+
+    requests = qdict_get_int(latency, "requests");
+    served = qdict_get_int(latency, "served");
+    g_assert_cmpint(requests, >, 0);
+    /* Every requested page has arrived, none is left pending */
+    g_assert_cmpint(served, ==, requests);
+    g_assert_cmpint(qdict_get_int(latency, "average"), <=,
+                    qdict_get_int(latency, "max"));
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(latency, "histogram"), entry) {
+        total += qnum_get_uint(qobject_to(QNum, qlist_entry_obj(entry)));
+    }
+    g_assert_cmpint(total, ==, served);
+
+    qobject_unref(rsp_return);
+}
+
+static void test_postcopy_prefetch(void)
+{
+    QTestState *from, *to;
+
+    if (migrate_postcopy_prepare(&from, &to, false)) {
+        return;
+    }
+    migrate_set_parameter(from, "postcopy-prefetch-pages", 16);
+
+    migrate_postcopy_start(from, to);
+    wait_for_migration_complete(from);
+    wait_for_migration_status(to, "completed");
+
+    wait_for_serial("dest_serial");
+    read_fault_latency(to);
+
+    test_migrate_end(from, to, true);
+}
+
 static void test_postcopy_recovery(void)
 {
     QTestState *from, *to;
@@ -720,7 +807,7 @@ static void test_baddest(void)
     char *status;
     bool failed;
 
-    if (test_migrate_start(&from, &to, "tcp:0:0", true)) {
+    if (test_migrate_start(&from, &to, "tcp:0:0", NULL, true)) {
         return;
     }
     migrate(from, "tcp:0:0", "{}");
@@ -740,12 +827,12 @@ static void test_baddest(void)
     test_migrate_end(from, to, false);
 }
 
-static void test_precopy_unix(void)
+static void test_precopy_unix_common(const char *opts)
 {
     char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     QTestState *from, *to;
 
-    if (test_migrate_start(&from, &to, uri, false)) {
+    if (test_migrate_start(&from, &to, uri, opts, false)) {
         return;
     }
 
@@ -781,6 +868,301 @@ static void test_precopy_unix(void)
     g_free(uri);
 }
 
+static void test_precopy_unix(void)
+{
+    test_precopy_unix_common(NULL);
+}
+
+static void test_precopy_unix_dirty_ring(void)
+{
+    /* Uses the KVM rings if the host has them, the simulated ones else */
+    test_precopy_unix_common("-machine dirty-ring-size=4096");
+}
+
+static void test_precopy_unix_dirty_log_clear(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp, *rsp_return;
+
+    if (test_migrate_start(&from, &to, uri, NULL, false)) {
+        return;
+    }
+
+    /* Only accepted when KVM runs with manual dirty log protection */
+    rsp = qtest_qmp(from,
+                    "{ 'execute': 'migrate-set-capabilities',"
+                    "'arguments': { "
+                    "'capabilities': [ { "
+                    "'capability': 'chunked-dirty-log-clear', "
+                    "'state': true } ] } }");
+    if (!qdict_haskey(rsp, "return")) {
+        g_test_message("Skipping test: manual dirty log protection "
+                       "not available");
+        qobject_unref(rsp);
+        test_migrate_end(from, to, false);
+        g_free(uri);
+        return;
+    }
+    qobject_unref(rsp);
+
+    /* 1 ms should make it not converge */
+    migrate_set_parameter(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    /* 300 ms should converge */
+    migrate_set_parameter(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* The dirty log was cleared chunk by chunk while sending */
+    rsp_return = migrate_query(from);
+    g_assert_cmpint(qdict_get_int(qdict_get_qdict(rsp_return, "ram"),
+                                  "dirty-log-clear-count"), >, 0);
+    qobject_unref(rsp_return);
+
+    /* Pages written after a sync must not have been lost */
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
+static gchar *query_dirty_rate_status(QTestState *who)
+{
+    QDict *rsp_return = wait_command(who, "{ 'execute': 'query-dirty-rate' }");
+    gchar *status = g_strdup(qdict_get_str(rsp_return, "status"));
+
+    qobject_unref(rsp_return);
+    return status;
+}
+
+static void test_dirty_rate(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp, *rsp_return, *vcpu;
+    QList *vcpus;
+    gchar *status;
+
+    if (test_migrate_start(&from, &to, uri, "-machine dirty-ring-size=4096",
+                           false)) {
+        return;
+    }
+
+    status = query_dirty_rate_status(from);
+    g_assert_cmpstr(status, ==, "unstarted");
+    g_free(status);
+
+    rsp = qtest_qmp(from, "{ 'execute': 'calc-dirty-rate',"
+                          "  'arguments': { 'calc-time': 0 } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    /* Wait for the guest to start dirtying memory */
+    wait_for_serial("src_serial");
+
+    rsp_return = wait_command(from, "{ 'execute': 'calc-dirty-rate',"
+                                    "  'arguments': { 'calc-time': 1 } }");
+    qobject_unref(rsp_return);
+
+    /* Only one measurement at a time */
+    rsp = qtest_qmp(from, "{ 'execute': 'calc-dirty-rate',"
+                          "  'arguments': { 'calc-time': 1 } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    for (;;) {
+        status = query_dirty_rate_status(from);
+        if (strcmp(status, "measured") == 0) {
+            break;
+        }
+        g_assert_cmpstr(status, ==, "measuring");
+        g_free(status);
+        usleep(100 * 1000);
+    }
+    g_free(status);
+
+    rsp_return = wait_command(from, "{ 'execute': 'query-dirty-rate' }");
+    g_assert_cmpint(qdict_get_int(rsp_return, "calc-time"), ==, 1);
+    g_assert_cmpint(qdict_get_int(rsp_return, "dirty-rate"), >, 0);
+
+    /* The single vCPU does all of the writing */
+    vcpus = qdict_get_qlist(rsp_return, "vcpu-dirty-rate");
+    g_assert_cmpint(qlist_size(vcpus), ==, 1);
+    vcpu = qobject_to(QDict, qlist_peek(vcpus));
+    g_assert_cmpint(qdict_get_int(vcpu, "id"), ==, 0);
+    g_assert_cmpint(qdict_get_int(vcpu, "dirty-rate"), ==,
+                    qdict_get_int(rsp_return, "dirty-rate"));
+    g_assert_cmpint(qdict_get_int(vcpu, "throttle-percentage"), ==, 0);
+    qobject_unref(rsp_return);
+
+    test_migrate_end(from, to, false);
+    g_free(uri);
+}
+
+static void test_multifd_unix_zlib(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp_return;
+    QListEntry *entry;
+    int64_t pages = 0;
+
+    if (test_migrate_start(&from, &to, uri, NULL, false)) {
+        return;
+    }
+
+    /* 1 ms should make it not converge*/
+    migrate_set_parameter(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+
+    migrate_set_capability(from, "x-multifd", true);
+    migrate_set_capability(to, "x-multifd", true);
+    migrate_set_parameter_str(from, "multifd-compression", "zlib");
+    migrate_set_parameter_str(to, "multifd-compression", "zlib");
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    /* 300 ms should converge */
+    migrate_set_parameter(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* The test pattern leaves most of each page untouched */
+    rsp_return = wait_command(from, "{ 'execute': 'query-migrate' }");
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp_return, "multifd-channels"),
+                        entry) {
+        QDict *channel = qobject_to(QDict, qlist_entry_obj(entry));
+
+        if (qdict_get_int(channel, "pages")) {
+            g_assert_cmpfloat(qdict_get_double(channel, "compression-rate"),
+                              >, 1);
+        }
+        pages += qdict_get_int(channel, "pages");
+    }
+    g_assert_cmpint(pages, >, 0);
+    qobject_unref(rsp_return);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
+static void test_precopy_file_fixed_ram(void)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+
+    /* The destination only loads the file once it has been written */
+    if (test_migrate_start(&from, &to, "defer", NULL, false)) {
+        return;
+    }
+
+    migrate_set_capability(from, "fixed-ram", true);
+    migrate_set_capability(to, "fixed-ram", true);
+    /* 1GB/s */
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    migrate_incoming(to, uri);
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_background_snapshot(void)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+
+    /* The destination only loads the snapshot once it has been written */
+    if (test_migrate_start(&from, &to, "defer", NULL, false)) {
+        return;
+    }
+
+    rsp = qtest_qmp(from,
+                    "{ 'execute': 'migrate-set-capabilities',"
+                    "'arguments': { "
+                    "'capabilities': [ { "
+                    "'capability': 'background-snapshot', 'state': true } ] } }");
+    if (!qdict_haskey(rsp, "return")) {
+        g_test_message("Skipping test: userfaultfd write protection "
+                       "not available");
+        qobject_unref(rsp);
+        test_migrate_end(from, to, false);
+        g_free(uri);
+        return;
+    }
+    qobject_unref(rsp);
+
+    /* Dirty bitmaps would have to be tracked while the guest runs */
+    rsp = qtest_qmp(from,
+                    "{ 'execute': 'migrate-set-capabilities',"
+                    "'arguments': { "
+                    "'capabilities': [ { "
+                    "'capability': 'dirty-bitmaps', 'state': true } ] } }");
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    /* The source is only paused while its device state is saved */
+    rsp = wait_command(from, "{ 'execute': 'query-status' }");
+    g_assert(qdict_get_bool(rsp, "running"));
+    qobject_unref(rsp);
+
+    migrate_incoming(to, uri);
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
 int main(int argc, char **argv)
 {
     char template[] = "/tmp/migration-test-XXXXXX";
@@ -829,9 +1211,20 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/postcopy/unix", test_postcopy);
     qtest_add_func("/migration/postcopy/recovery", test_postcopy_recovery);
+    qtest_add_func("/migration/postcopy/prefetch", test_postcopy_prefetch);
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
+    qtest_add_func("/migration/precopy/unix/dirty-ring",
+                   test_precopy_unix_dirty_ring);
+    qtest_add_func("/migration/precopy/unix/dirty-log-clear",
+                   test_precopy_unix_dirty_log_clear);
+    qtest_add_func("/migration/dirty-rate", test_dirty_rate);
+    qtest_add_func("/migration/multifd/unix/zlib", test_multifd_unix_zlib);
+    qtest_add_func("/migration/precopy/file/fixed-ram",
+                   test_precopy_file_fixed_ram);
+    qtest_add_func("/migration/background-snapshot/file",
+                   test_background_snapshot);
 
     ret = g_test_run();
 
@@ -0,0 +1,178 @@
+/*
+ * QTest testcase for TCG code region eviction
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define LOW(x) ((x) & 0xff)
+#define HIGH(x) (((x) >> 8) & 0xff)
+
+#define PATCH_ADDR 0x7c2e
+
+/* x86 boot sector code: keep patching the immediate of "mov $imm,%al" in a
+ * subroutine and calling it, so that every iteration retranslates the
+ * subroutine and the code buffer fills up quickly.  Prints 'A' once, then a
+ * 'B' every 65536 iterations, or 'E' and halts if the subroutine returns a
+ * stale immediate.
+ */
+static uint8_t x86_bootsect[512] = {
+    /* 7c00: cli */
+    [0x00] = 0xfa,
+    /* 7c01: xor %ax,%ax */
+    [0x01] = 0x31, [0x02] = 0xc0,
+    /* 7c03: mov %ax,%ds */
+    [0x03] = 0x8e, [0x04] = 0xd8,
+    /* 7c05: mov %ax,%ss */
+    [0x05] = 0x8e, [0x06] = 0xd0,
+    /* 7c07: mov $0x7c00,%sp */
+    [0x07] = 0xbc, [0x08] = 0x00, [0x09] = 0x7c,
+    /* 7c0a: mov $0x3f8,%dx */
+    [0x0a] = 0xba, [0x0b] = 0xf8, [0x0c] = 0x03,
+    /* 7c0d: mov $'A',%al */
+    [0x0d] = 0xb0, [0x0e] = 'A',
+    /* 7c0f: out %al,(%dx) */
+    [0x0f] = 0xee,
+    /* 7c10: xor %bx,%bx */
+    [0x10] = 0x31, [0x11] = 0xdb,
+
+    /* 7c12: incb PATCH_ADDR */
+    [0x12] = 0xfe, [0x13] = 0x06,
+    [0x14] = LOW(PATCH_ADDR), [0x15] = HIGH(PATCH_ADDR),
+    /* 7c16: call 0x7c2d=0x7c19+0x14 */
+    [0x16] = 0xe8, [0x17] = 0x14, [0x18] = 0x00,
+    /* 7c19: cmp PATCH_ADDR,%al */
+    [0x19] = 0x3a, [0x1a] = 0x06,
+    [0x1b] = LOW(PATCH_ADDR), [0x1c] = HIGH(PATCH_ADDR),
+    /* 7c1d: jne 0x7c27=0x7c1f+8 */
+    [0x1d] = 0x75, [0x1e] = 0x08,
+    /* 7c1f: inc %bx */
+    [0x1f] = 0x43,
+    /* 7c20: jnz 0x7c12=0x7c22-16 */
+    [0x20] = 0x75, [0x21] = LOW(-16),
+    /* 7c22: mov $'B',%al */
+    [0x22] = 0xb0, [0x23] = 'B',
+    /* 7c24: out %al,(%dx) */
+    [0x24] = 0xee,
+    /* 7c25: jmp 0x7c12=0x7c27-21 */
+    [0x25] = 0xeb, [0x26] = LOW(-21),
+
+    /* 7c27: mov $'E',%al */
+    [0x27] = 0xb0, [0x28] = 'E',
+    /* 7c29: out %al,(%dx) */
+    [0x29] = 0xee,
+    /* 7c2a: hlt */
+    [0x2a] = 0xf4,
+    /* 7c2b: jmp 0x7c2a=0x7c2d-3 */
+    [0x2b] = 0xeb, [0x2c] = LOW(-3),
+
+    /* 7c2d: mov $imm,%al, the immediate is at PATCH_ADDR */
+    [0x2d] = 0xb0, [0x2e] = 0x00,
+    /* 7c2f: ret */
+    [0x2f] = 0xc3,
+
+    /* End of boot sector marker */
+    [0x1fe] = 0x55,
+    [0x1ff] = 0xaa,
+};
+
+static char *bootpath;
+static char *serialpath;
+
+static unsigned long get_jit_stat(QTestState *qts, const char *name)
+{
+    char *info = qtest_hmp(qts, "info jit");
+    char *p = strstr(info, name);
+    unsigned long val;
+
+    g_assert(p);
+    val = strtoul(p + strlen(name), NULL, 10);
+    g_free(info);
+    return val;
+}
+
+/* Returns the number of 'B's the guest printed so far, checking that the
+ * output is otherwise what the boot sector prints when it runs correctly */
+static size_t check_serial(void)
+{
+    char *output;
+    size_t len, i;
+
+    g_assert(g_file_get_contents(serialpath, &output, &len, NULL));
+    if (len) {
+        g_assert_cmpint(output[0], ==, 'A');
+    }
+    for (i = 1; i < len; i++) {
+        g_assert_cmpint(output[i], ==, 'B');
+    }
+    g_free(output);
+    return len ? len - 1 : 0;
+}
+
+static void test_tcg_evict(void)
+{
+    QTestState *qts;
+    unsigned long evictions;
+    size_t b_count;
+    int i;
+
+    /* 8 MB give a single TCG context four 2 MB regions */
+    qts = qtest_initf("-machine accel=tcg -tb-size 8 -m 32M "
+                      "-serial file:%s -drive file=%s,format=raw",
+                      serialpath, bootpath);
+
+    /* Wait until the oldest region was evicted twice */
+    for (i = 0; i < 600; i++) {
+        if (get_jit_stat(qts, "TB eviction count") >= 2) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    evictions = get_jit_stat(qts, "TB eviction count");
+    g_assert_cmpuint(evictions, >=, 2);
+
+    /* The guest keeps running correctly on the regions that were reused */
+    b_count = check_serial();
+    for (i = 0; i < 600; i++) {
+        if (check_serial() >= b_count + 2) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmpuint(check_serial(), >=, b_count + 2);
+    g_assert_cmpuint(get_jit_stat(qts, "TB eviction count"), >, evictions);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    char boot_template[] = "/tmp/tcg-evict-test-XXXXXX";
+    char serial_template[] = "/tmp/tcg-evict-serial-XXXXXX";
+    int fd, ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    fd = mkstemp(boot_template);
+    g_assert(fd >= 0);
+    g_assert_cmpint(write(fd, x86_bootsect, sizeof(x86_bootsect)), ==,
+                    sizeof(x86_bootsect));
+    close(fd);
+    bootpath = boot_template;
+
+    fd = mkstemp(serial_template);
+    g_assert(fd >= 0);
+    close(fd);
+    serialpath = serial_template;
+
+    qtest_add_func("/tcg/evict", test_tcg_evict);
+
+    ret = g_test_run();
+
+    unlink(serial_template);
+    unlink(boot_template);
+    return ret;
+}
@@ -0,0 +1,155 @@
+/*
+ * QTest testcase for tiered TCG translation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+/* The boot sector keeps modifying memory in loops; see migration-test.c */
+#include "tests/migration/i386/a-b-bootblock.h"
+
+#define TEST_MEM_START      (1 * 1024 * 1024)
+#define TEST_MEM_END        (100 * 1024 * 1024)
+#define TEST_MEM_PAGE_SIZE  4096
+
+static char *bootpath;
+static char *serialpath;
+
+static unsigned long get_promotions(QTestState *qts)
+{
+    char *info = qtest_hmp(qts, "info jit");
+    char *p = strstr(info, "TB promotions");
+    unsigned long promotions;
+
+    g_assert(p);
+    promotions = strtoul(p + strlen("TB promotions"), NULL, 10);
+    g_free(info);
+    return promotions;
+}
+
+/* Returns the number of 'B's the guest printed so far, checking that the
+ * output is otherwise what the boot sector prints when it runs correctly */
+static size_t check_serial(void)
+{
+    char *output;
+    size_t len, i;
+
+    g_assert(g_file_get_contents(serialpath, &output, &len, NULL));
+    if (len) {
+        g_assert_cmpint(output[0], ==, 'A');
+    }
+    for (i = 1; i < len; i++) {
+        g_assert_cmpint(output[i], ==, 'B');
+    }
+    g_free(output);
+    return len ? len - 1 : 0;
+}
+
+/* The boot sector increments the first byte of each page in turn, so with
+ * the guest stopped all of them are equal except for one step down, where
+ * the incrementer was; see check_guests_ram() in migration-test.c */
+static void check_guest_ram(QTestState *qts)
+{
+    unsigned address;
+    uint8_t last_byte, b;
+    bool hit_edge = false;
+
+    qtest_memread(qts, TEST_MEM_START, &last_byte, 1);
+    for (address = TEST_MEM_START + TEST_MEM_PAGE_SIZE; address < TEST_MEM_END;
+         address += TEST_MEM_PAGE_SIZE) {
+        qtest_memread(qts, address, &b, 1);
+        if (b != last_byte) {
+            g_assert_cmpint((uint8_t)(b + 1), ==, last_byte);
+            g_assert_false(hit_edge);
+            hit_edge = true;
+            last_byte = b;
+        }
+    }
+}
+
+static void test_tiered_promotions(void)
+{
+    QTestState *qts;
+    size_t b_count;
+    char *info;
+    int i;
+
+    qts = qtest_initf("-machine accel=tcg -accel tcg,tiered=on -m 150M "
+                      "-serial file:%s -drive file=%s,format=raw",
+                      serialpath, bootpath);
+
+    /* The loops of the boot sector become hot quickly */
+    for (i = 0; i < 100 && !get_promotions(qts); i++) {
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmpuint(get_promotions(qts), >, 0);
+
+    info = qtest_hmp(qts, "info jit");
+    g_assert(strstr(info, "trace count"));
+    g_assert(strstr(info, "trace hit rate"));
+    g_free(info);
+
+    /* The guest keeps running correctly on the traces */
+    b_count = check_serial();
+    for (i = 0; i < 600; i++) {
+        if (check_serial() >= b_count + 2) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmpuint(check_serial(), >=, b_count + 2);
+
+    qobject_unref(qtest_qmp(qts, "{ 'execute': 'stop' }"));
+    check_guest_ram(qts);
+
+    qtest_quit(qts);
+}
+
+static void test_tiered_off(void)
+{
+    QTestState *qts;
+    char *info;
+
+    qts = qtest_initf("-machine accel=tcg -m 150M "
+                      "-drive file=%s,format=raw", bootpath);
+
+    info = qtest_hmp(qts, "info jit");
+    g_assert(!strstr(info, "TB promotions"));
+    g_free(info);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    char template[] = "/tmp/tcg-tiered-test-XXXXXX";
+    char serial_template[] = "/tmp/tcg-tiered-serial-XXXXXX";
+    int fd, ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    fd = mkstemp(template);
+    g_assert(fd >= 0);
+    g_assert_cmpint(write(fd, x86_bootsect, sizeof(x86_bootsect)), ==,
+                    sizeof(x86_bootsect));
+    close(fd);
+    bootpath = template;
+
+    fd = mkstemp(serial_template);
+    g_assert(fd >= 0);
+    close(fd);
+    serialpath = serial_template;
+
+    qtest_add_func("/tcg/tiered/promotions", test_tiered_promotions);
+    qtest_add_func("/tcg/tiered/off", test_tiered_off);
+
+    ret = g_test_run();
+
+    unlink(serial_template);
+    unlink(template);
+    return ret;
+}
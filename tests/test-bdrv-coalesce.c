@@ -0,0 +1,244 @@
+/*
+ * Discard and write zeroes coalescing tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+
+#define TEST_IMAGE_SIZE (64 * 1024 * 1024)
+#define TEST_MAX_CALLS  16
+
+typedef struct TestCall {
+    int64_t offset;
+    int bytes;
+    int flags;
+} TestCall;
+
+typedef struct BDRVTestState {
+    int nb_discards;
+    TestCall discards[TEST_MAX_CALLS];
+    int nb_zero_writes;
+    TestCall zero_writes[TEST_MAX_CALLS];
+} BDRVTestState;
+
+/* Keep the request in flight for one iteration of the event loop, so that
+ * requests submitted after it have to wait for other requests to join them */
+static void coroutine_fn test_yield(void)
+{
+    aio_co_schedule(qemu_get_current_aio_context(), qemu_coroutine_self());
+    qemu_coroutine_yield();
+}
+
+static int coroutine_fn bdrv_test_co_pdiscard(BlockDriverState *bs,
+                                              int64_t offset, int bytes)
+{
+    BDRVTestState *s = bs->opaque;
+
+    g_assert_cmpint(s->nb_discards, <, TEST_MAX_CALLS);
+    s->discards[s->nb_discards++] = (TestCall) { offset, bytes, 0 };
+    test_yield();
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwrite_zeroes(BlockDriverState *bs,
+                                                   int64_t offset, int bytes,
+                                                   BdrvRequestFlags flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    g_assert_cmpint(s->nb_zero_writes, <, TEST_MAX_CALLS);
+    s->zero_writes[s->nb_zero_writes++] = (TestCall) { offset, bytes, flags };
+    test_yield();
+    return 0;
+}
+
+static int64_t bdrv_test_getlength(BlockDriverState *bs)
+{
+    return TEST_IMAGE_SIZE;
+}
+
+static BlockDriver bdrv_test = {
+    .format_name            = "test",
+    .instance_size          = sizeof(BDRVTestState),
+
+    .bdrv_co_pdiscard       = bdrv_test_co_pdiscard,
+    .bdrv_co_pwrite_zeroes  = bdrv_test_co_pwrite_zeroes,
+    .bdrv_getlength         = bdrv_test_getlength,
+};
+
+static void aio_ret_cb(void *opaque, int ret)
+{
+    int *aio_ret = opaque;
+    *aio_ret = ret;
+}
+
+static BlockBackend *test_setup(BlockDriverState **pbs)
+{
+    BlockBackend *blk = blk_new(BLK_PERM_ALL, BLK_PERM_ALL);
+    BlockDriverState *bs;
+
+    bs = bdrv_new_open_driver(&bdrv_test, "test-node",
+                              BDRV_O_RDWR | BDRV_O_UNMAP, &error_abort);
+    bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
+    blk_insert_bs(blk, bs, &error_abort);
+
+    *pbs = bs;
+    return blk;
+}
+
+static void test_teardown(BlockBackend *blk, BlockDriverState *bs)
+{
+    g_assert(QLIST_EMPTY(&bs->coalesced_reqs));
+    g_assert_cmpint(bs->coalesce_in_flight, ==, 0);
+
+    bdrv_unref(bs);
+    blk_unref(blk);
+}
+
+static void wait_for_requests(int *ret, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        while (ret[i] == -EINPROGRESS) {
+            aio_poll(qemu_get_aio_context(), true);
+        }
+        g_assert_cmpint(ret[i], ==, 0);
+    }
+}
+
+static void test_discard_adjacent(void)
+{
+    BlockDriverState *bs;
+    BlockBackend *blk = test_setup(&bs);
+    BDRVTestState *s = bs->opaque;
+    int ret[8];
+    int i;
+
+    /* The first request is dispatched immediately, the others are merged
+     * while it is in flight */
+    for (i = 0; i < ARRAY_SIZE(ret); i++) {
+        ret[i] = -EINPROGRESS;
+        blk_aio_pdiscard(blk, i * 4096, 4096, aio_ret_cb, &ret[i]);
+    }
+    wait_for_requests(ret, ARRAY_SIZE(ret));
+
+    g_assert_cmpint(s->nb_discards, ==, 2);
+    g_assert_cmpint(s->discards[0].offset, ==, 0);
+    g_assert_cmpint(s->discards[0].bytes, ==, 4096);
+    g_assert_cmpint(s->discards[1].offset, ==, 4096);
+    g_assert_cmpint(s->discards[1].bytes, ==, 7 * 4096);
+
+    g_assert_cmpint(stat64_get(&bs->discard_requests), ==, 8);
+    g_assert_cmpint(stat64_get(&bs->discard_merged), ==, 6);
+
+    test_teardown(blk, bs);
+}
+
+static void test_discard_overlapping(void)
+{
+    BlockDriverState *bs;
+    BlockBackend *blk = test_setup(&bs);
+    BDRVTestState *s = bs->opaque;
+    int ret[4];
+    int i;
+
+    /* Out of order and overlapping requests are merged as well, requests
+     * with a gap between them are not */
+    const TestCall reqs[] = {
+        { 0, 4096 }, { 8192, 8192 }, { 4096, 8192 }, { 65536, 4096 },
+    };
+
+    for (i = 0; i < ARRAY_SIZE(ret); i++) {
+        ret[i] = -EINPROGRESS;
+        blk_aio_pdiscard(blk, reqs[i].offset, reqs[i].bytes,
+                         aio_ret_cb, &ret[i]);
+    }
+    wait_for_requests(ret, ARRAY_SIZE(ret));
+
+    g_assert_cmpint(s->nb_discards, ==, 3);
+    g_assert_cmpint(s->discards[0].offset, ==, 0);
+    g_assert_cmpint(s->discards[0].bytes, ==, 4096);
+    g_assert_cmpint(s->discards[1].offset, ==, 4096);
+    g_assert_cmpint(s->discards[1].bytes, ==, 12288);
+    g_assert_cmpint(s->discards[2].offset, ==, 65536);
+    g_assert_cmpint(s->discards[2].bytes, ==, 4096);
+
+    g_assert_cmpint(stat64_get(&bs->discard_merged), ==, 1);
+
+    test_teardown(blk, bs);
+}
+
+static void test_write_zeroes_flags(void)
+{
+    BlockDriverState *bs;
+    BlockBackend *blk = test_setup(&bs);
+    BDRVTestState *s = bs->opaque;
+    int ret[4];
+    int i;
+
+    /* Only requests with the same flags are merged */
+    const TestCall reqs[] = {
+        { 0, 4096, 0 },
+        { 4096, 4096, BDRV_REQ_MAY_UNMAP },
+        { 8192, 4096, BDRV_REQ_MAY_UNMAP },
+        { 12288, 4096, 0 },
+    };
+
+    for (i = 0; i < ARRAY_SIZE(ret); i++) {
+        ret[i] = -EINPROGRESS;
+        blk_aio_pwrite_zeroes(blk, reqs[i].offset, reqs[i].bytes,
+                              reqs[i].flags, aio_ret_cb, &ret[i]);
+    }
+    wait_for_requests(ret, ARRAY_SIZE(ret));
+
+    g_assert_cmpint(s->nb_zero_writes, ==, 3);
+    g_assert_cmpint(s->zero_writes[1].offset, ==, 4096);
+    g_assert_cmpint(s->zero_writes[1].bytes, ==, 8192);
+    g_assert_cmpint(s->zero_writes[1].flags, ==, BDRV_REQ_MAY_UNMAP);
+    g_assert_cmpint(s->zero_writes[2].offset, ==, 12288);
+    g_assert_cmpint(s->zero_writes[2].bytes, ==, 4096);
+
+    g_assert_cmpint(stat64_get(&bs->zero_requests), ==, 4);
+    g_assert_cmpint(stat64_get(&bs->zero_merged), ==, 1);
+    g_assert_cmpint(s->nb_discards, ==, 0);
+
+    test_teardown(blk, bs);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bdrv-coalesce/discard/adjacent", test_discard_adjacent);
+    g_test_add_func("/bdrv-coalesce/discard/overlapping",
+                    test_discard_overlapping);
+    g_test_add_func("/bdrv-coalesce/write-zeroes/flags",
+                    test_write_zeroes_flags);
+
+    return g_test_run();
+}
@@ -26,6 +26,9 @@
 #include "block/block.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "block/aio-wait.h"
+#include "iothread.h"
 
 static void test_drain_aio_error_flush_cb(void *opaque, int ret)
 {
@@ -67,6 +70,143 @@ static void test_drain_all_aio_error(void)
     blk_unref(blk);
 }
 
+typedef struct {
+    BlockBackend *blk;
+    AioContext *completion_ctx;
+    bool completed;
+} MultiqueueTestData;
+
+static void test_multiqueue_flush_cb(void *opaque, int ret)
+{
+    MultiqueueTestData *data = opaque;
+
+    g_assert(ret == -ENOMEDIUM);
+    data->completion_ctx = qemu_get_current_aio_context();
+    atomic_mb_set(&data->completed, true);
+}
+
+static void test_multiqueue_submit_bh(void *opaque)
+{
+    MultiqueueTestData *data = opaque;
+
+    blk_aio_flush(data->blk, test_multiqueue_flush_cb, data);
+}
+
+/* Requests submitted from an iothread run and complete in that iothread */
+static void test_multiqueue_completion(void)
+{
+    IOThread *iothread = iothread_new();
+    AioContext *ctx = iothread_get_aio_context(iothread);
+    MultiqueueTestData data = {
+        .blk = blk_new(BLK_PERM_ALL, BLK_PERM_ALL),
+    };
+
+    blk_set_multiqueue(data.blk, true, &error_abort);
+    aio_bh_schedule_oneshot(ctx, test_multiqueue_submit_bh, &data);
+    AIO_WAIT_WHILE(NULL, !atomic_mb_read(&data.completed));
+    g_assert(data.completion_ctx == ctx);
+
+    blk_drain(data.blk);
+    blk_unref(data.blk);
+    iothread_join(iothread);
+}
+
+static BlockBackend *test_multiqueue_open(const char *filename,
+                                          const char *driver)
+{
+    QDict *options = qdict_new();
+
+    qdict_put_str(options, "driver", driver);
+    return blk_new_open(filename, NULL, options, BDRV_O_RDWR, &error_abort);
+}
+
+static char *test_multiqueue_create(const char *fmt)
+{
+    char *filename;
+    int fd;
+
+    fd = g_file_open_tmp("qemu-test-block-backend-XXXXXX", &filename, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+
+    bdrv_img_create(filename, fmt, NULL, NULL, NULL, 64 * 1024 * 1024,
+                    BDRV_O_RDWR, true, &error_abort);
+    return filename;
+}
+
+/* Only nodes that are safe for concurrent submitters allow multiqueue */
+static void test_multiqueue_graph(void)
+{
+    BlockBackend *blk;
+    Error *local_err = NULL;
+    char *filename = test_multiqueue_create("qcow2");
+
+    /* qcow2 over file is rejected, and the BlockBackend is left alone */
+    blk = test_multiqueue_open(filename, "qcow2");
+    g_assert_cmpint(blk_set_multiqueue(blk, true, &local_err), ==, -ENOTSUP);
+    g_assert(local_err);
+    error_free(local_err);
+    g_assert(!blk_get_multiqueue(blk));
+    blk_unref(blk);
+
+    /* raw over file and file alone are fine */
+    blk = test_multiqueue_open(filename, "raw");
+    g_assert_cmpint(blk_set_multiqueue(blk, true, &error_abort), ==, 0);
+    g_assert(blk_get_multiqueue(blk));
+    blk_unref(blk);
+
+    blk = test_multiqueue_open(filename, "file");
+    g_assert_cmpint(blk_set_multiqueue(blk, true, &error_abort), ==, 0);
+    blk_unref(blk);
+
+    unlink(filename);
+    g_free(filename);
+}
+
+/* Nodes that don't allow multiqueue can't be inserted later either */
+static void test_multiqueue_insert(void)
+{
+    char *filename = test_multiqueue_create("raw");
+    char *overlay_filename = test_multiqueue_create("qcow2");
+    BlockBackend *blk = test_multiqueue_open(filename, "raw");
+    BlockDriverState *bs = blk_bs(blk);
+    BlockDriverState *overlay;
+    Error *local_err = NULL;
+    QDict *options;
+
+    g_assert_cmpint(blk_set_multiqueue(blk, true, &error_abort), ==, 0);
+
+    /* A snapshot overlay, as blockdev-snapshot would add it */
+    options = qdict_new();
+    qdict_put_str(options, "driver", "qcow2");
+    overlay = bdrv_open(overlay_filename, NULL, options, BDRV_O_RDWR,
+                        &error_abort);
+    bdrv_ref(overlay);
+    bdrv_append(overlay, bs, &local_err);
+    g_assert(local_err);
+    error_free(local_err);
+    local_err = NULL;
+    g_assert(blk_bs(blk) == bs);
+
+    /* A new medium */
+    bdrv_ref(bs);
+    blk_remove_bs(blk);
+    g_assert_cmpint(blk_insert_bs(blk, overlay, &local_err), ==, -ENOTSUP);
+    g_assert(local_err);
+    error_free(local_err);
+    g_assert(!blk_bs(blk));
+
+    g_assert_cmpint(blk_insert_bs(blk, bs, &error_abort), ==, 0);
+    bdrv_unref(bs);
+    bdrv_unref(overlay);
+    blk_unref(blk);
+
+    unlink(overlay_filename);
+    g_free(overlay_filename);
+    unlink(filename);
+    g_free(filename);
+}
+
 int main(int argc, char **argv)
 {
     bdrv_init();
@@ -77,6 +217,11 @@ int main(int argc, char **argv)
     g_test_add_func("/block-backend/drain_aio_error", test_drain_aio_error);
     g_test_add_func("/block-backend/drain_all_aio_error",
                     test_drain_all_aio_error);
+    g_test_add_func("/block-backend/multiqueue_completion",
+                    test_multiqueue_completion);
+    g_test_add_func("/block-backend/multiqueue_graph", test_multiqueue_graph);
+    g_test_add_func("/block-backend/multiqueue_insert",
+                    test_multiqueue_insert);
 
     return g_test_run();
 }
@@ -0,0 +1,67 @@
+/*
+ * QEMU CRC32C test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+
+static uint8_t buffer[3 * 8192 * 2 + 64];
+
+/* Bit-at-a-time reference implementation */
+static uint32_t crc32c_ref(uint32_t crc, const uint8_t *data, size_t len)
+{
+    int i;
+
+    while (len--) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78 : 0);
+        }
+    }
+    return crc ^ 0xffffffff;
+}
+
+static void test_1(void)
+{
+    size_t a, s;
+
+    /* Check value from the iSCSI specification (RFC 3720, B.4) */
+    g_assert_cmphex(crc32c(0xffffffff, (const uint8_t *)"123456789", 9), ==,
+                    0xe3069283);
+
+    /* Sizes and alignments that exercise the head, the interleaved blocks
+     * and the tail of the accelerated implementations. */
+    for (a = 0; a < 8; a++) {
+        for (s = 0; s < 1024; s++) {
+            g_assert_cmphex(crc32c(0xffffffff, buffer + a, s), ==,
+                            crc32c_ref(0xffffffff, buffer + a, s));
+        }
+        for (s = 3 * 256 - 8; s < sizeof(buffer) - 64; s += 1021) {
+            g_assert_cmphex(crc32c(0xffffffff, buffer + a, s), ==,
+                            crc32c_ref(0xffffffff, buffer + a, s));
+        }
+    }
+}
+
+static void test_2(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = g_test_rand_int();
+    }
+    do {
+        test_1();
+    } while (test_crc32c_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/crc32c/accel", test_2);
+
+    return g_test_run();
+}
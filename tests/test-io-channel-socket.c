@@ -377,6 +377,7 @@ static void test_io_channel_unix_fd_pass(void)
                             G_N_ELEMENTS(iosend),
                             fdsend,
                             G_N_ELEMENTS(fdsend),
+                            0,
                             &error_abort);
 
     qio_channel_readv_full(dst,
@@ -484,6 +485,69 @@ static void test_io_channel_ipv4_fd(void)
 }
 
 
+static void test_io_channel_ipv4_zero_copy(void)
+{
+    SocketAddress *listen_addr = g_new0(SocketAddress, 1);
+    SocketAddress *connect_addr = g_new0(SocketAddress, 1);
+    QIOChannel *src, *dst;
+    char *bufsend, *bufrecv;
+    struct iovec iosend[2];
+    size_t len = 4096;
+    size_t i;
+
+    listen_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    listen_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Auto-select */
+    };
+
+    connect_addr->type = SOCKET_ADDRESS_TYPE_INET;
+    connect_addr->u.inet = (InetSocketAddress) {
+        .host = g_strdup("127.0.0.1"),
+        .port = NULL, /* Filled in later */
+    };
+
+    test_io_channel_setup_sync(listen_addr, connect_addr, &src, &dst);
+
+    if (!qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        g_test_skip("Zero copy writes not supported by the host");
+        goto cleanup;
+    }
+
+    bufsend = g_malloc(len * 2);
+    bufrecv = g_malloc0(len * 2);
+    for (i = 0; i < len * 2; i++) {
+        bufsend[i] = i % 251;
+    }
+    iosend[0].iov_base = bufsend;
+    iosend[0].iov_len = len;
+    iosend[1].iov_base = bufsend + len;
+    iosend[1].iov_len = len;
+
+    g_assert_cmpint(qio_channel_writev_full_all(src, iosend, 2, NULL, 0,
+                                                QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                                &error_abort), ==, 0);
+    /* The kernel copies the data on loopback, so 1 is fine as well */
+    g_assert_cmpint(qio_channel_flush(src, &error_abort), >=, 0);
+
+    /* Nothing left to flush */
+    g_assert_cmpint(qio_channel_flush(src, &error_abort), ==, 0);
+
+    g_assert_cmpint(qio_channel_read_all(dst, bufrecv, len * 2,
+                                         &error_abort), ==, 0);
+    g_assert(memcmp(bufsend, bufrecv, len * 2) == 0);
+
+    g_free(bufsend);
+    g_free(bufrecv);
+
+ cleanup:
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(dst));
+    qapi_free_SocketAddress(listen_addr);
+    qapi_free_SocketAddress(connect_addr);
+}
+
+
 int main(int argc, char **argv)
 {
     bool has_ipv4, has_ipv6;
@@ -509,6 +573,8 @@ int main(int argc, char **argv)
                         test_io_channel_ipv4_async);
         g_test_add_func("/io/channel/socket/ipv4-fd",
                         test_io_channel_ipv4_fd);
+        g_test_add_func("/io/channel/socket/ipv4-zero-copy",
+                        test_io_channel_ipv4_zero_copy);
     }
     if (has_ipv6) {
         g_test_add_func("/io/channel/socket/ipv6-sync",
@@ -0,0 +1,274 @@
+/*
+ * qcow2 metadata cache tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "block/block.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "../block/qcow2.h"
+
+#define CACHE_TABLES 4
+
+/* Far enough from the metadata of a new image to pass the overlap checks */
+#define TABLE_BASE   (16 * MiB)
+
+typedef struct TestCache {
+    char path[32];
+    BlockBackend *blk;
+    BlockDriverState *bs;
+    Qcow2Cache *c;
+    unsigned table_size;
+} TestCache;
+
+static void test_cache_open(TestCache *t)
+{
+    QDict *options = qdict_new();
+    BDRVQcow2State *s;
+    int fd;
+
+    pstrcpy(t->path, sizeof(t->path), "/tmp/qcow2-cache.XXXXXX");
+    fd = mkstemp(t->path);
+    g_assert(fd >= 0);
+    close(fd);
+
+    bdrv_img_create(t->path, "qcow2", NULL, NULL, NULL, 64 * MiB, 0, true,
+                    &error_abort);
+
+    qdict_put_str(options, "driver", "qcow2");
+    t->blk = blk_new_open(t->path, NULL, options, BDRV_O_RDWR, &error_abort);
+    t->bs = blk_bs(t->blk);
+    s = t->bs->opaque;
+
+    t->table_size = s->cluster_size;
+    t->c = qcow2_cache_create(t->bs, CACHE_TABLES, t->table_size);
+    g_assert(t->c);
+    qcow2_cache_check_consistency(t->c);
+}
+
+static void test_cache_close(TestCache *t)
+{
+    g_assert_cmpint(qcow2_cache_destroy(t->c), ==, 0);
+    blk_unref(t->blk);
+    unlink(t->path);
+}
+
+static uint64_t table_offset(TestCache *t, int i)
+{
+    return TABLE_BASE + (uint64_t) i * t->table_size;
+}
+
+/* Gets and releases table @i, leaving it at the tail of the LRU list */
+static void *touch_table(TestCache *t, int i, bool read_from_disk)
+{
+    void *table;
+    int ret;
+
+    if (read_from_disk) {
+        ret = qcow2_cache_get(t->bs, t->c, table_offset(t, i), &table);
+    } else {
+        ret = qcow2_cache_get_empty(t->bs, t->c, table_offset(t, i), &table);
+    }
+    g_assert_cmpint(ret, ==, 0);
+    qcow2_cache_check_consistency(t->c);
+
+    qcow2_cache_put(t->c, &table);
+    g_assert(table == NULL);
+    qcow2_cache_check_consistency(t->c);
+
+    return qcow2_cache_is_table_offset(t->c, table_offset(t, i));
+}
+
+static void test_cache_get_put(void)
+{
+    TestCache t;
+    void *tables[CACHE_TABLES];
+    int i;
+
+    test_cache_open(&t);
+
+    /* While every entry is referenced the LRU list is empty */
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert_cmpint(qcow2_cache_get_empty(t.bs, t.c, table_offset(&t, i),
+                                              &tables[i]), ==, 0);
+        g_assert(qcow2_cache_is_table_offset(t.c, table_offset(&t, i)) ==
+                 tables[i]);
+        qcow2_cache_check_consistency(t.c);
+    }
+
+    /* A second reference returns the same table */
+    for (i = 0; i < CACHE_TABLES; i++) {
+        void *table;
+
+        g_assert_cmpint(qcow2_cache_get(t.bs, t.c, table_offset(&t, i),
+                                        &table), ==, 0);
+        g_assert(table == tables[i]);
+        qcow2_cache_put(t.c, &table);
+        qcow2_cache_check_consistency(t.c);
+    }
+
+    for (i = 0; i < CACHE_TABLES; i++) {
+        qcow2_cache_put(t.c, &tables[i]);
+        qcow2_cache_check_consistency(t.c);
+    }
+
+    test_cache_close(&t);
+}
+
+static void test_cache_evict_lru(void)
+{
+    TestCache t;
+    int i;
+
+    test_cache_open(&t);
+
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert(touch_table(&t, i, false));
+    }
+
+    /* A hit moves table 0 to the tail, so table 1 is the next victim */
+    g_assert(touch_table(&t, 0, false));
+    g_assert(touch_table(&t, CACHE_TABLES, false));
+    g_assert(qcow2_cache_is_table_offset(t.c, table_offset(&t, 0)));
+    g_assert(!qcow2_cache_is_table_offset(t.c, table_offset(&t, 1)));
+
+    /* Then tables 2 and 3, in the order they were released */
+    g_assert(touch_table(&t, CACHE_TABLES + 1, false));
+    g_assert(!qcow2_cache_is_table_offset(t.c, table_offset(&t, 2)));
+    g_assert(qcow2_cache_is_table_offset(t.c, table_offset(&t, 3)));
+    g_assert(touch_table(&t, CACHE_TABLES + 2, false));
+    g_assert(!qcow2_cache_is_table_offset(t.c, table_offset(&t, 3)));
+    g_assert(qcow2_cache_is_table_offset(t.c, table_offset(&t, 0)));
+
+    test_cache_close(&t);
+}
+
+static void test_cache_evict_dirty(void)
+{
+    TestCache t;
+    void *table;
+    int i;
+
+    test_cache_open(&t);
+
+    g_assert_cmpint(qcow2_cache_get_empty(t.bs, t.c, table_offset(&t, 0),
+                                          &table), ==, 0);
+    memset(table, 0xa5, t.table_size);
+    qcow2_cache_entry_mark_dirty(t.c, table);
+    qcow2_cache_put(t.c, &table);
+    qcow2_cache_check_consistency(t.c);
+
+    /* Evicting the dirty table writes it back to the image */
+    for (i = 1; i <= CACHE_TABLES; i++) {
+        g_assert(touch_table(&t, i, false));
+    }
+    g_assert(!qcow2_cache_is_table_offset(t.c, table_offset(&t, 0)));
+
+    table = touch_table(&t, 0, true);
+    g_assert(table);
+    g_assert_cmpint(((uint8_t *) table)[0], ==, 0xa5);
+    g_assert_cmpint(((uint8_t *) table)[t.table_size - 1], ==, 0xa5);
+
+    test_cache_close(&t);
+}
+
+static void test_cache_flush_empty(void)
+{
+    TestCache t;
+    void *table;
+    int i;
+
+    test_cache_open(&t);
+
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert_cmpint(qcow2_cache_get_empty(t.bs, t.c, table_offset(&t, i),
+                                              &table), ==, 0);
+        memset(table, i + 1, t.table_size);
+        qcow2_cache_entry_mark_dirty(t.c, table);
+        qcow2_cache_put(t.c, &table);
+    }
+
+    /* Flushing keeps the tables cached */
+    g_assert_cmpint(qcow2_cache_flush(t.bs, t.c), ==, 0);
+    qcow2_cache_check_consistency(t.c);
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert(qcow2_cache_is_table_offset(t.c, table_offset(&t, i)));
+    }
+
+    /* Emptying forgets all of them */
+    g_assert_cmpint(qcow2_cache_empty(t.bs, t.c), ==, 0);
+    qcow2_cache_check_consistency(t.c);
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert(!qcow2_cache_is_table_offset(t.c, table_offset(&t, i)));
+    }
+
+    /* The flushed contents can be read back */
+    for (i = 0; i < CACHE_TABLES; i++) {
+        table = touch_table(&t, i, true);
+        g_assert(table);
+        g_assert_cmpint(((uint8_t *) table)[t.table_size / 2], ==, i + 1);
+    }
+
+    test_cache_close(&t);
+}
+
+static void test_cache_discard_clean(void)
+{
+    TestCache t;
+    void *table;
+    int i;
+
+    test_cache_open(&t);
+
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert(touch_table(&t, i, false));
+    }
+
+    /* A discarded entry is the first one to be reused */
+    table = qcow2_cache_is_table_offset(t.c, table_offset(&t, 2));
+    qcow2_cache_discard(t.c, table);
+    qcow2_cache_check_consistency(t.c);
+    g_assert(!qcow2_cache_is_table_offset(t.c, table_offset(&t, 2)));
+
+    g_assert(touch_table(&t, CACHE_TABLES, false));
+    for (i = 0; i < CACHE_TABLES; i++) {
+        g_assert(!!qcow2_cache_is_table_offset(t.c, table_offset(&t, i)) ==
+                 (i != 2));
+    }
+
+    /* Only tables that were not used since the last pass are cleaned */
+    qcow2_cache_clean_unused(t.c);
+    qcow2_cache_check_consistency(t.c);
+    g_assert(touch_table(&t, 0, false));
+    qcow2_cache_clean_unused(t.c);
+    qcow2_cache_check_consistency(t.c);
+
+    for (i = 0; i <= CACHE_TABLES; i++) {
+        g_assert(!!qcow2_cache_is_table_offset(t.c, table_offset(&t, i)) ==
+                 (i == 0));
+    }
+
+    test_cache_close(&t);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/qcow2-cache/get-put", test_cache_get_put);
+    g_test_add_func("/qcow2-cache/evict-lru", test_cache_evict_lru);
+    g_test_add_func("/qcow2-cache/evict-dirty", test_cache_evict_dirty);
+    g_test_add_func("/qcow2-cache/flush-empty", test_cache_flush_empty);
+    g_test_add_func("/qcow2-cache/discard-clean", test_cache_discard_clean);
+
+    return g_test_run();
+}
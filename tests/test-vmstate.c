@@ -853,6 +853,49 @@ static void test_tmp_struct(void)
     g_assert_cmpint(obj.f, ==, 8); /* From the child->parent */
 }
 
+/* Positioned I/O on the channel, as used by the fixed-ram format */
+#define PIO_OFFSET 4096
+
+static void test_qemu_file_pwrite_pread(void)
+{
+    uint8_t data[16], buf[16];
+    QEMUFile *f;
+
+    memset(data, 0xaa, sizeof(data));
+
+    f = open_test_file(true);
+    qemu_put_be32(f, 0x12345678);
+    g_assert_cmpint(qemu_file_pwrite(f, data, sizeof(data), PIO_OFFSET), ==,
+                    sizeof(data));
+    /* The buffered stream continues after the region */
+    g_assert_cmpint(qemu_file_seek(f, PIO_OFFSET + sizeof(data), SEEK_SET),
+                    ==, PIO_OFFSET + sizeof(data));
+    qemu_put_be32(f, 0x9abcdef0);
+    g_assert(!qemu_file_get_error(f));
+    qemu_fclose(f);
+
+    f = open_test_file(false);
+    g_assert_cmpint(qemu_get_be32(f), ==, 0x12345678);
+    g_assert_cmpint(qemu_file_pread(f, buf, sizeof(buf), PIO_OFFSET), ==,
+                    sizeof(buf));
+    SUCCESS(memcmp(buf, data, sizeof(buf)));
+    /* The region between the header and the positioned write is a hole */
+    g_assert_cmpint(qemu_file_pread(f, buf, sizeof(buf), 4), ==, sizeof(buf));
+    memset(data, 0, sizeof(data));
+    SUCCESS(memcmp(buf, data, sizeof(buf)));
+
+    /* A relative seek starts from the stream position, not the transport's */
+    g_assert_cmpint(qemu_file_seek(f, PIO_OFFSET + sizeof(data) - 4,
+                                   SEEK_CUR), ==, PIO_OFFSET + sizeof(data));
+    g_assert_cmpint(qemu_get_be32(f), ==, 0x9abcdef0);
+    g_assert(!qemu_file_get_error(f));
+
+    /* Reading past the end of the transport is an error */
+    g_assert_cmpint(qemu_file_pread(f, buf, sizeof(buf),
+                                    PIO_OFFSET + sizeof(data)), ==, -EIO);
+    qemu_fclose(f);
+}
+
 int main(int argc, char **argv)
 {
     temp_fd = mkstemp(temp_file);
@@ -883,6 +926,8 @@ int main(int argc, char **argv)
     g_test_add_func("/vmstate/qtailq/save/saveq", test_save_q);
     g_test_add_func("/vmstate/qtailq/load/loadq", test_load_q);
     g_test_add_func("/vmstate/tmp_struct", test_tmp_struct);
+    g_test_add_func("/vmstate/qemu-file/pwrite-pread",
+                    test_qemu_file_pwrite_pread);
     g_test_run();
 
     close(temp_fd);
@@ -13,7 +13,9 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/cutils.h"
+#include "qapi/error.h"
 #include "../migration/xbzrle.h"
+#include "../migration/page_cache.h"
 
 #define PAGE_SIZE 4096
 
@@ -174,6 +176,134 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_PAGES 64
+
+static void fill_accel_page(uint8_t *old, uint8_t *new, int n)
+{
+    int i, density = (n % 8) * 14;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old[i] = g_test_rand_int_range(0, 4);
+        new[i] = old[i];
+        if (g_test_rand_int_range(0, 100) < density) {
+            new[i] = g_test_rand_int_range(0, 4);
+        }
+    }
+}
+
+/* All encoder implementations must produce the very same stream, including
+ * when the destination buffer is too small.
+ */
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE * ACCEL_PAGES);
+    uint8_t *new = g_malloc(PAGE_SIZE * ACCEL_PAGES);
+    uint8_t *ref = g_malloc(PAGE_SIZE * ACCEL_PAGES);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    int ref_len[ACCEL_PAGES];
+    bool first = true;
+    int i, dlen;
+
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        fill_accel_page(old + i * PAGE_SIZE, new + i * PAGE_SIZE, i);
+    }
+
+    do {
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            dlen = xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                        new + i * PAGE_SIZE, PAGE_SIZE,
+                                        compressed, PAGE_SIZE - i * 16);
+            if (first) {
+                ref_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(ref + i * PAGE_SIZE, compressed, dlen);
+                }
+                continue;
+            }
+            g_assert_cmpint(dlen, ==, ref_len[i]);
+            if (dlen > 0) {
+                g_assert(memcmp(ref + i * PAGE_SIZE, compressed, dlen) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(ref);
+    g_free(compressed);
+}
+
+/* Pages that are this far apart fall in the same set of a 64 page cache */
+#define CACHE_SET_STRIDE (8 * PAGE_SIZE)
+
+static void test_page_cache(void)
+{
+    PageCache *cache = cache_init(64 * PAGE_SIZE, PAGE_SIZE, &error_abort);
+    uint8_t *page = g_malloc(PAGE_SIZE);
+    CacheItem *item, *other;
+    int i;
+
+    /* Several pages of the same set can be cached at once */
+    for (i = 0; i < 8; i++) {
+        memset(page, i, PAGE_SIZE);
+        g_assert_cmpint(cache_insert(cache, i * CACHE_SET_STRIDE, page, 0,
+                                     NULL), ==, 0);
+    }
+    for (i = 0; i < 8; i++) {
+        item = cache_lookup(cache, i * CACHE_SET_STRIDE, 0);
+        g_assert(item && cache_item_data(item)[0] == i);
+        cache_release(item);
+    }
+
+    /* Fresh pages are not replaced */
+    g_assert_cmpint(cache_insert(cache, 8 * CACHE_SET_STRIDE, page, 1, NULL),
+                    ==, -1);
+
+    /* Once they are not fresh anymore, the least used one goes first */
+    for (i = 0; i < 7; i++) {
+        item = cache_lookup(cache, i * CACHE_SET_STRIDE, 1);
+        g_assert(item);
+        cache_release(item);
+    }
+    g_assert_cmpint(cache_insert(cache, 8 * CACHE_SET_STRIDE, page, 3, &item),
+                    ==, 1);
+    g_assert(item);
+    g_assert(!cache_lookup(cache, 7 * CACHE_SET_STRIDE, 3));
+
+    /* A claimed entry cannot be looked up until it is released */
+    g_assert(!cache_lookup(cache, 8 * CACHE_SET_STRIDE, 3));
+    cache_release(item);
+    other = cache_lookup(cache, 8 * CACHE_SET_STRIDE, 3);
+    g_assert(other == item);
+    cache_release(other);
+
+    cache_fini(cache);
+    g_free(page);
+}
+
+static void test_page_cache_free_way(void)
+{
+    PageCache *cache = cache_init(64 * PAGE_SIZE, PAGE_SIZE, &error_abort);
+    uint8_t *page = g_malloc0(PAGE_SIZE);
+    CacheItem *item;
+
+    /* A stale page scores 0, but a free way is still taken first */
+    g_assert_cmpint(cache_insert(cache, 0, page, 0, NULL), ==, 0);
+    g_assert_cmpint(cache_insert(cache, CACHE_SET_STRIDE, page, 100, NULL),
+                    ==, 0);
+
+    item = cache_lookup(cache, 0, 100);
+    g_assert(item);
+    cache_release(item);
+    item = cache_lookup(cache, CACHE_SET_STRIDE, 100);
+    g_assert(item);
+    cache_release(item);
+
+    cache_fini(cache);
+    g_free(page);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +316,9 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/page_cache", test_page_cache);
+    g_test_add_func("/xbzrle/page_cache/free_way", test_page_cache_free_way);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -27,6 +27,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu-common.h"
+#include "qemu/bswap.h"
 #include "qemu/crc32c.h"
 
 /*
@@ -106,11 +107,202 @@ static const uint32_t crc32c_table[256] = {
 };
 
 
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+static uint32_t crc32c_int(uint32_t crc, const uint8_t *data, size_t length)
 {
     while (length--) {
         crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
-    return crc^0xffffffff;
+    return crc;
+}
+
+#if defined(CONFIG_CRC32C_OPT) && defined(__x86_64__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2,pclmul")
+#include <smmintrin.h>
+#include <wmmintrin.h>
+
+/* Buffers are processed in three interleaved streams so that the three
+ * crc32 instructions in flight hide each other's latency.  The partial CRCs
+ * are then merged by multiplying with x^(8 * len) mod P, which PCLMULQDQ and
+ * a final crc32 do in a handful of cycles.
+ */
+#define CRC32C_LONG     8192
+#define CRC32C_SHORT    256
+
+/* x^(8 * CRC32C_LONG - 33) and x^(8 * CRC32C_SHORT - 33) mod P, bit-reflected;
+ * the missing x^33 comes from the carry-less multiply and the crc32 below.
+ */
+#define CRC32C_LONG_K   0x54a86326
+#define CRC32C_SHORT_K  0xb9e02b86
+
+static inline uint32_t crc32c_shift_pclmul(uint32_t crc, uint32_t k)
+{
+    __m128i p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+                                     _mm_cvtsi32_si128(k), 0);
+
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(p));
+}
+
+static inline const uint8_t *crc32c_sse42_3way(uint32_t *crc,
+                                               const uint8_t *data,
+                                               size_t len, uint32_t k)
+{
+    uint64_t crc0 = *crc, crc1 = 0, crc2 = 0;
+    const uint8_t *end = data + len;
+
+    do {
+        crc0 = _mm_crc32_u64(crc0, ldq_le_p(data));
+        crc1 = _mm_crc32_u64(crc1, ldq_le_p(data + len));
+        crc2 = _mm_crc32_u64(crc2, ldq_le_p(data + 2 * len));
+        data += 8;
+    } while (data < end);
+
+    *crc = crc32c_shift_pclmul(crc32c_shift_pclmul(crc0, k) ^ crc1, k) ^ crc2;
+    return data + 2 * len;
+}
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length)
+{
+    while (length && ((uintptr_t)data & 7)) {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+    while (length >= 3 * CRC32C_LONG) {
+        data = crc32c_sse42_3way(&crc, data, CRC32C_LONG, CRC32C_LONG_K);
+        length -= 3 * CRC32C_LONG;
+    }
+    while (length >= 3 * CRC32C_SHORT) {
+        data = crc32c_sse42_3way(&crc, data, CRC32C_SHORT, CRC32C_SHORT_K);
+        length -= 3 * CRC32C_SHORT;
+    }
+    while (length >= 8) {
+        crc = _mm_crc32_u64(crc, ldq_le_p(data));
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+
+#define CRC32C_ACCEL_SSE42  1
+
+static void crc32c_init_accel(unsigned cache);
+
+static void __attribute__((constructor)) crc32c_init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if ((c & bit_SSE4_2) && (c & bit_PCLMUL)) {
+            cache |= CRC32C_ACCEL_SSE42;
+        }
+    }
+    crc32c_init_accel(cache);
+}
+
+#elif defined(CONFIG_CRC32C_OPT) && defined(__aarch64__)
+#pragma GCC push_options
+#pragma GCC target("+crc")
+#include <arm_acle.h>
+
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *data, size_t length)
+{
+    while (length && ((uintptr_t)data & 7)) {
+        crc = __crc32cb(crc, *data++);
+        length--;
+    }
+    while (length >= 32) {
+        crc = __crc32cd(crc, ldq_le_p(data));
+        crc = __crc32cd(crc, ldq_le_p(data + 8));
+        crc = __crc32cd(crc, ldq_le_p(data + 16));
+        crc = __crc32cd(crc, ldq_le_p(data + 24));
+        data += 32;
+        length -= 32;
+    }
+    while (length >= 8) {
+        crc = __crc32cd(crc, ldq_le_p(data));
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#pragma GCC pop_options
+
+#include <sys/auxv.h>
+
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32         (1 << 7)
+#endif
+
+#define CRC32C_ACCEL_ARMV8  1
+
+static void crc32c_init_accel(unsigned cache);
+
+static void __attribute__((constructor)) crc32c_init_hwcap_cache(void)
+{
+    unsigned cache = 0;
+
+    if (qemu_getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        cache |= CRC32C_ACCEL_ARMV8;
+    }
+    crc32c_init_accel(cache);
+}
+#endif
+
+#ifdef CONFIG_CRC32C_OPT
+static unsigned crc32c_cache;
+static uint32_t (*crc32c_accel)(uint32_t, const uint8_t *, size_t) =
+    crc32c_int;
+
+static void crc32c_init_accel(unsigned cache)
+{
+    uint32_t (*fn)(uint32_t, const uint8_t *, size_t) = crc32c_int;
+
+#ifdef __x86_64__
+    if (cache & CRC32C_ACCEL_SSE42) {
+        fn = crc32c_sse42;
+    }
+#else
+    if (cache & CRC32C_ACCEL_ARMV8) {
+        fn = crc32c_armv8;
+    }
+#endif
+    crc32c_cache = cache;
+    crc32c_accel = fn;
+}
+
+bool test_crc32c_next_accel(void)
+{
+    /* If no bits set, we just tested crc32c_int, and there
+       are no more acceleration options to test.  */
+    if (crc32c_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    crc32c_init_accel(crc32c_cache & (crc32c_cache - 1));
+    return true;
+}
+#else
+#define crc32c_accel  crc32c_int
+bool test_crc32c_next_accel(void)
+{
+    return false;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+{
+    return crc32c_accel(crc, data, length) ^ 0xffffffff;
 }
 
@@ -313,6 +313,20 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "tlb-min-bits",
+            .type = QEMU_OPT_NUMBER,
+            .help = "log2 of the minimum number of TLB entries (TCG)",
+        },
+        {
+            .name = "tlb-max-bits",
+            .type = QEMU_OPT_NUMBER,
+            .help = "log2 of the maximum number of TLB entries (TCG)",
+        }, {
+            .name = "tiered",
+            .type = QEMU_OPT_BOOL,
+            .help = "retranslate hot code as traces (TCG)",
+        },
         { /* end of list */ }
     },
 };